@@ -0,0 +1,171 @@
+#ifndef USB_CAMERA_BOUNDED_QUEUE_H
+#define USB_CAMERA_BOUNDED_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usb_camera {
+
+enum class QueuePolicy {
+    Block,      // push() waits for room
+    DropOldest  // push() evicts the oldest element, the producer never waits
+};
+
+// Returns false for anything but "block" and "drop_oldest".
+inline bool parseQueuePolicy(const std::string& name, QueuePolicy& policy)
+{
+    if (name == "block") {
+        policy = QueuePolicy::Block;
+    } else if (name == "drop_oldest") {
+        policy = QueuePolicy::DropOldest;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Multi producer / multi consumer FIFO over a ring preallocated at
+// construction, meant for cheap handles (pointers, indices) passed between
+// pipeline threads. Elements evicted by DropOldest are handed to the drop
+// callback (outside the lock) so the owner can recycle them.
+template <typename T>
+class BoundedQueue {
+public:
+    typedef std::function<void(const T&)> Drop;
+
+    explicit BoundedQueue(size_t capacity, QueuePolicy policy = QueuePolicy::Block, const Drop& drop = Drop())
+        : m_ring(capacity < 1 ? 1 : capacity),
+          m_head(0),
+          m_size(0),
+          m_policy(policy),
+          m_drop(drop),
+          m_dropped(0),
+          m_closed(false)
+    {
+    }
+
+    // Returns false if the queue is closed, `value` was not queued then.
+    bool push(const T& value)
+    {
+        T evicted;
+        bool didEvict = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_policy == QueuePolicy::Block) {
+                m_notFull.wait(lock, [this] { return m_closed || m_size < m_ring.size(); });
+            }
+            if (m_closed) {
+                return false;
+            }
+            if (m_size == m_ring.size()) {
+                evicted = m_ring[m_head];
+                m_head = (m_head + 1) % m_ring.size();
+                m_size--;
+                m_dropped++;
+                didEvict = true;
+            }
+            m_ring[(m_head + m_size) % m_ring.size()] = value;
+            m_size++;
+        }
+        m_notEmpty.notify_one();
+        if (didEvict && m_drop) {
+            m_drop(evicted);
+        }
+        return true;
+    }
+
+    // Wait for an element. Returns false once the queue is closed and empty,
+    // so consumers drain what was queued before close().
+    bool pop(T& value)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return m_closed || m_size > 0; });
+            if (m_size == 0) {
+                return false;
+            }
+            value = m_ring[m_head];
+            m_head = (m_head + 1) % m_ring.size();
+            m_size--;
+        }
+        m_notFull.notify_one();
+        return true;
+    }
+
+    // pop() giving up after `timeout`.
+    template <typename Rep, typename Period>
+    bool popFor(T& value, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!m_notEmpty.wait_for(lock, timeout, [this] { return m_closed || m_size > 0; }) || m_size == 0) {
+                return false;
+            }
+            value = m_ring[m_head];
+            m_head = (m_head + 1) % m_ring.size();
+            m_size--;
+        }
+        m_notFull.notify_one();
+        return true;
+    }
+
+    bool tryPop(T& value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_size == 0) {
+                return false;
+            }
+            value = m_ring[m_head];
+            m_head = (m_head + 1) % m_ring.size();
+            m_size--;
+        }
+        m_notFull.notify_one();
+        return true;
+    }
+
+    // Wake everybody, further pushes fail and pops fail once empty.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t capacity() const { return m_ring.size(); }
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+    // Number of elements evicted by DropOldest so far.
+    size_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+private:
+    std::vector<T> m_ring;
+    size_t m_head;
+    size_t m_size;
+    QueuePolicy m_policy;
+    Drop m_drop;
+    size_t m_dropped;
+    bool m_closed;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_BOUNDED_QUEUE_H
@@ -0,0 +1,43 @@
+#ifndef USB_CAMERA_CAMERA_MODEL_H
+#define USB_CAMERA_CAMERA_MODEL_H
+
+#include <opencv2/core.hpp>
+
+#include <string>
+
+#include <sensor_msgs/CameraInfo.h>
+
+namespace usb_camera {
+
+// Stereo calibration as written by stereo_calibration (m2_calibration_*.yml).
+struct StereoCameraModel {
+    cv::Size imageSize;     // per eye
+    cv::Mat cameraMatrix[2];
+    cv::Mat distCoeffs[2];
+    cv::Mat R[2];
+    cv::Mat P[2];
+    cv::Mat Q;
+
+    bool load(const std::string& path);
+    bool empty() const { return cameraMatrix[0].empty(); }
+
+    // The same rig imaged at `scale` times the calibrated resolution (e.g.
+    // 0.5 for a 2x downscaled decode): K and P are rescaled, distortion and
+    // rectifying rotations are unchanged.
+    StereoCameraModel scaled(double scale) const;
+    // The rectified image at `scale` times this model's resolution, cropped
+    // to `roi` (in scaled pixels, empty: all of it). K, P and Q describe the
+    // output image, imageSize is its size.
+    StereoCameraModel rectifiedView(double scale, const cv::Rect& roi) const;
+
+    void toCameraInfo(int eye, sensor_msgs::CameraInfo& info) const;
+    // CV_16SC2/CV_16UC1 maps for StereoRectifier::init.
+    void rectifyMaps(cv::Mat map1[2], cv::Mat map2[2]) const { rectifyMaps(*this, map1, map2); }
+    // Maps from this model's images straight to the rectified `output` of
+    // rectifiedView(), one remap for undistortion, scaling and crop.
+    void rectifyMaps(const StereoCameraModel& output, cv::Mat map1[2], cv::Mat map2[2]) const;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CAMERA_MODEL_H
@@ -0,0 +1,75 @@
+#ifndef USB_CAMERA_CAPTURE_DEVICE_H
+#define USB_CAMERA_CAPTURE_DEVICE_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace usb_camera {
+
+inline uint32_t fourcc(char a, char b, char c, char d)
+{
+    return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+struct CaptureFormat {
+    int width = 1280;
+    int height = 480;
+    uint32_t fourcc = usb_camera::fourcc('M', 'J', 'P', 'G');
+    double fps = 30.0;
+};
+
+// A buffer handed out by CaptureDevice::dequeue(). `data` is a view over the
+// driver (or fake) buffer, it stays valid until the frame is given back with
+// CaptureDevice::release().
+//   MJPG: 1 x bytesused CV_8UC1 holding the compressed bitstream
+//   YUYV: height x width CV_8UC2
+//   BGR3: height x width CV_8UC3
+//   GREY: height x width CV_8UC1
+struct CapturedFrame {
+    int index = -1;
+    cv::Mat data;
+    uint32_t fourcc = 0;
+    size_t bytesused = 0;
+    uint32_t sequence = 0;
+    int64_t timestamp_ns = 0;   // CLOCK_MONOTONIC
+    int dmabuf_fd = -1;         // exported buffer, -1 if not exported
+};
+
+class CaptureDevice {
+public:
+    virtual ~CaptureDevice() {}
+
+    virtual bool open(const std::string& deviceName, const CaptureFormat& format) = 0;
+    virtual void close() = 0;
+    virtual bool isOpened() const = 0;
+
+    // Negotiated format, may differ from the one requested in open().
+    virtual CaptureFormat format() const = 0;
+    virtual int bufferCount() const = 0;
+
+    // Wait up to timeout_ms for the next filled buffer. Returns false on
+    // timeout or error, the frame is untouched in that case.
+    virtual bool dequeue(CapturedFrame& frame, int timeout_ms) = 0;
+    // Give a dequeued buffer back to the device. Views into it must not be
+    // used afterwards.
+    virtual void release(CapturedFrame& frame) = 0;
+
+    // true once a finite source (a replay) has delivered its last frame;
+    // dequeue() failing then is not an error.
+    virtual bool endOfStream() const { return false; }
+};
+
+// Convert a dequeued frame to BGR. `bgr` is reused when it already has the
+// right size, for BGR3 frames it becomes a view of the buffer itself.
+bool convertToBgr(const CapturedFrame& frame, cv::Mat& bgr);
+
+// Luminance of a dequeued frame without going through BGR: the Y samples of
+// YUYV, a view of the buffer for GREY. MJPG goes through imdecode, prefer
+// JpegCodec::decodeGray.
+bool convertToGray(const CapturedFrame& frame, cv::Mat& gray);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CAPTURE_DEVICE_H
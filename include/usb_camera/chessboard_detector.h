@@ -0,0 +1,62 @@
+#ifndef USB_CAMERA_CHESSBOARD_DETECTOR_H
+#define USB_CAMERA_CHESSBOARD_DETECTOR_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace usb_camera {
+
+class CornerCache;
+
+struct ChessboardOptions {
+    cv::Size boardSize = cv::Size(9, 6);
+    int flags = cv::CALIB_CB_ADAPTIVE_THRESH;
+    cv::Size subPixWindow = cv::Size(5, 5);
+    // Find the board on a pyrDown level first and refine the corners mapped
+    // back at full resolution. 0: full resolution only, -1: as many levels as
+    // keep the image at least kPyramidMinWidth wide.
+    int pyramidLevels = 0;
+
+    static const int kPyramidMinWidth = 640;
+};
+
+// Result for one calibration image.
+struct CornerDetection {
+    bool loaded = false;    // the image could be read
+    bool found = false;     // the whole board was found
+    cv::Size imageSize;
+    std::vector<cv::Point2f> corners;   // refined to sub-pixel if found
+    double sharpness = -1;  // boardSharpness() if found, -1: unknown
+    uint64_t hash = 0;      // contentHash() of the file, when read through a cache
+    bool cached = false;    // taken from the cache, not detected
+};
+
+// Find and refine the board corners in a grayscale image.
+//
+// With a pyramid the board is searched on the reduced image, with
+// CALIB_CB_FAST_CHECK so frames without a board are rejected quickly. Corners
+// found there are scaled up and refined twice with cornerSubPix at full
+// resolution: once with a window covering the upscaling error, then with
+// subPixWindow as in the full resolution path. If the reduced image shows no
+// board the full resolution image is searched (also fast checked) before
+// giving up, small or distant boards don't get lost.
+bool detectChessboard(const cv::Mat& gray, const ChessboardOptions& options, std::vector<cv::Point2f>& corners);
+// Variance of the Laplacian over the board's bounding box, drops as the
+// image gets blurrier. Only comparable between views of the same board.
+double boardSharpness(const cv::Mat& gray, const std::vector<cv::Point2f>& corners);
+CornerDetection detectChessboard(const std::string& path, const ChessboardOptions& options);
+
+// Detect in every file on OpenCV's thread pool (cv::setNumThreads). The
+// result has one entry per file, in the order of `files`, whatever order the
+// workers finished in. With a cache, files whose content and options are
+// known are not decoded at all, new detections are added to the cache.
+std::vector<CornerDetection> detectChessboards(const std::vector<std::string>& files, const ChessboardOptions& options,
+                                               CornerCache* cache = nullptr);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CHESSBOARD_DETECTOR_H
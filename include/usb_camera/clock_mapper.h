@@ -0,0 +1,57 @@
+#ifndef USB_CAMERA_CLOCK_MAPPER_H
+#define USB_CAMERA_CLOCK_MAPPER_H
+
+#include <cstdint>
+#include <deque>
+
+#include <ros/time.h>
+
+namespace usb_camera {
+
+// CLOCK_MONOTONIC nanoseconds, the clock of V4L2 buffer timestamps.
+int64_t monotonicNow();
+
+// Maps CLOCK_MONOTONIC timestamps to ros::Time.
+//
+// The offset between the two clocks is sampled every `samplePeriod` seconds
+// (the ROS clock read bracketed by two monotonic reads, keeping the tightest
+// of a few tries) and a line is fitted through the last `window` samples, so
+// the mapping follows NTP slewing instead of jumping with every sample.
+// Not thread safe, update() and toRos() are meant for the capture thread.
+class ClockMapper {
+public:
+    explicit ClockMapper(size_t window = 30, double samplePeriod = 1.0);
+
+    // Take a new sample if the last one is older than the sample period.
+    void update();
+    // Add an offset sample directly, for tests.
+    void addSample(int64_t monotonic_ns, int64_t ros_ns);
+
+    ros::Time toRos(int64_t monotonic_ns) const;
+    int64_t toRosNs(int64_t monotonic_ns) const;
+
+    bool empty() const { return m_samples.empty(); }
+    // ros - monotonic at the newest sample, and its rate of change
+    double offsetSeconds() const { return m_offset * 1e-9; }
+    double driftPpm() const { return m_slope * 1e6; }
+
+private:
+    struct Sample {
+        int64_t monotonic_ns;
+        int64_t offset_ns;
+    };
+
+    void fit();
+
+    size_t m_window;
+    int64_t m_samplePeriod_ns;
+    std::deque<Sample> m_samples;
+    // offset(t) = m_offset + m_slope * (t - m_t0)
+    int64_t m_t0;
+    double m_offset;
+    double m_slope;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CLOCK_MAPPER_H
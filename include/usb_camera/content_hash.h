@@ -0,0 +1,19 @@
+#ifndef USB_CAMERA_CONTENT_HASH_H
+#define USB_CAMERA_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace usb_camera {
+
+// 64 bit FNV-1a, e.g. of a file's bytes. Stable across runs and builds, so
+// it can key caches on disk.
+uint64_t contentHash(const void* data, size_t size);
+uint64_t contentHash(const std::vector<unsigned char>& data);
+uint64_t contentHash(const std::string& data);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CONTENT_HASH_H
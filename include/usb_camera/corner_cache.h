@@ -0,0 +1,42 @@
+#ifndef USB_CAMERA_CORNER_CACHE_H
+#define USB_CAMERA_CORNER_CACHE_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "usb_camera/chessboard_detector.h"
+#include "usb_camera/content_hash.h"
+
+namespace usb_camera {
+
+// Chessboard detections of previous runs, keyed by image content and the
+// detection settings (board size, flags, sub-pixel window, pyramid), so
+// renamed or re-globbed files still hit and changed images or settings miss.
+// Stored as a cv::FileStorage file, usually next to the calibration it was
+// made for.
+class CornerCache {
+public:
+    // A missing file is an empty cache, not an error.
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    bool find(uint64_t hash, const ChessboardOptions& options, CornerDetection& detection) const;
+    void insert(uint64_t hash, const ChessboardOptions& options, const CornerDetection& detection);
+
+    size_t size() const { return m_entries.size(); }
+    bool modified() const { return m_modified; }
+
+private:
+    static std::string key(uint64_t hash, const ChessboardOptions& options);
+
+    std::map<std::string, CornerDetection> m_entries;
+    bool m_modified = false;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_CORNER_CACHE_H
@@ -0,0 +1,60 @@
+#ifndef USB_CAMERA_DISPARITY_ESTIMATOR_H
+#define USB_CAMERA_DISPARITY_ESTIMATOR_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include <vector>
+
+namespace usb_camera {
+
+struct DisparityOptions {
+    bool sgbm = true;           // false: cv::StereoBM
+    int minDisparity = 0;
+    int numDisparities = 64;    // multiple of 16
+    int blockSize = 9;          // odd
+    int downscale = 1;          // the pair is shrunk by this factor before matching
+    cv::Rect roi;               // in rectified pixels, empty: the whole image
+    int strips = 0;             // 0: cv::getNumThreads()
+    int uniquenessRatio = 10;
+    int speckleWindowSize = 100;
+    int speckleRange = 2;
+};
+
+// Disparity of a rectified pair with cv::StereoSGBM or cv::StereoBM, run on
+// horizontal strips in parallel (SGBM itself is single threaded). A strip is
+// matched with kOverlap + blockSize / 2 rows of context above and below, so
+// the rows it keeps see nearly the neighbourhood of a full-frame match. The
+// pair is cropped to the roi (a view, no copy), converted to gray if it is
+// BGR and shrunk by `downscale`.
+class DisparityEstimator {
+public:
+    static const int kOverlap = 16;
+
+    explicit DisparityEstimator(const DisparityOptions& options);
+
+    const DisparityOptions& options() const { return m_options; }
+
+    // The part of a `rectSize` image that is matched: the roi clipped to the
+    // image, aligned to multiples of downscale.
+    cv::Rect matchedRoi(cv::Size rectSize) const;
+
+    // CV_32F disparity in pixels of the matched (cropped, shrunk) image,
+    // minDisparity - 1 where nothing matched. `disparity` is written in place
+    // if it already has that size and type, e.g. a message buffer.
+    void compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity);
+
+private:
+    cv::Ptr<cv::StereoMatcher> createMatcher() const;
+
+    DisparityOptions m_options;
+    std::vector<cv::Ptr<cv::StereoMatcher> > m_matchers;   // one per strip
+    std::vector<cv::Mat> m_stripDisparity;
+    cv::Mat m_gray[2];
+    cv::Mat m_input[2];
+    cv::Mat m_fixed;    // CV_16S, 4 fractional bits
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_DISPARITY_ESTIMATOR_H
@@ -0,0 +1,50 @@
+#ifndef USB_CAMERA_FAKE_CAPTURE_H
+#define USB_CAMERA_FAKE_CAPTURE_H
+
+#include "usb_camera/capture_device.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace usb_camera {
+
+// File-backed stand-in for V4L2Capture. `deviceName` is either a single file
+// or a directory; every file is one frame in the requested pixel format (a
+// JPEG for MJPG, raw pixels otherwise). Frames are played in a loop at the
+// requested fps through a fixed set of buffers, so buffer ownership behaves
+// like the real driver: dequeue() fails once every buffer is handed out.
+// As with V4L2, release() may be called from another thread than dequeue().
+class FakeCapture : public CaptureDevice {
+public:
+    explicit FakeCapture(int bufferCount = 4);
+
+    bool open(const std::string& deviceName, const CaptureFormat& format) override;
+    void close() override;
+    bool isOpened() const override { return !m_frames.empty(); }
+
+    CaptureFormat format() const override { return m_format; }
+    int bufferCount() const override { return (int)m_buffers.size(); }
+
+    bool dequeue(CapturedFrame& frame, int timeout_ms) override;
+    void release(CapturedFrame& frame) override;
+
+private:
+    struct Buffer {
+        std::vector<uchar> storage;
+        bool queued = true;
+    };
+
+    int m_requestedBuffers;
+    CaptureFormat m_format;
+    std::vector<std::vector<uchar> > m_frames;
+    std::vector<Buffer> m_buffers;
+    std::mutex m_bufferMutex;   // guards Buffer::queued
+    size_t m_next;
+    uint32_t m_sequence;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_FAKE_CAPTURE_H
@@ -0,0 +1,64 @@
+#ifndef USB_CAMERA_HAND_EYE_H
+#define USB_CAMERA_HAND_EYE_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace usb_camera {
+
+// One robot pose with the calibration target seen from the camera, both as
+// 4x4 homogeneous transforms.
+struct HandEyeSample {
+    cv::Matx44d effectorWrtWorld;
+    cv::Matx44d objectWrtSensor;
+};
+
+// Append the samples of an easy_handeye style file (calib/m2_hand_eye_samples_*.yaml):
+// a list of {effector_wrt_world, object_wrt_sensor}, each 16 values in row
+// major order. The file is read line by line, never held as a whole.
+bool readHandEyeSamples(const std::string& path, std::vector<HandEyeSample>& samples);
+
+struct HandEyeOptions {
+    // camera on the effector: the result is the sensor wrt the effector;
+    // otherwise the camera is fixed and the result is the sensor wrt world
+    bool eyeInHand = false;
+    int iterations = 1000;          // RANSAC hypotheses
+    int sampleSize = 3;             // poses per hypothesis, calibrateHandEye needs 3
+    double maxTranslation = 0.01;   // inlier threshold, meters
+    double maxRotationDeg = 1.0;    // inlier threshold
+    int bootstrap = 200;            // resamples of the consensus set for the spread of the winner
+    uint64_t seed = 1;
+};
+
+struct HandEyeResult {
+    std::string method;             // TSAI, PARK, HORAUD, ANDREFF, DANIILIDIS
+    bool ok = false;
+    cv::Matx44d transform;          // see HandEyeOptions::eyeInHand
+    int inliers = 0;                // samples within the thresholds for this transform
+    double translationRms = 0;      // over the consensus set, meters
+    double rotationRmsDeg = 0;
+    double translationStd = 0;      // bootstrap spread, best method only
+    double rotationStdDeg = 0;
+};
+
+// Robust hand-eye calibration with every cv::calibrateHandEye method.
+//
+// A sample's error is how far its target pose in the frame the target is
+// fixed to (the effector with a fixed camera, the world with the camera on
+// the effector), computed through a candidate transform, lies from the median
+// of all samples. RANSAC solves `iterations` random minimal sets (TSAI) in
+// parallel and keeps the hypothesis with most inliers; every method is then
+// refit on that consensus set in parallel and ranked by its RMS errors
+// relative to the thresholds. The best one is bootstrapped on the consensus
+// set for its spread. Runs on OpenCV's thread pool (cv::setNumThreads) and
+// is deterministic for a seed. `results` is best first, `consensus` marks the
+// inliers of the RANSAC winner.
+bool solveHandEye(const std::vector<HandEyeSample>& samples, const HandEyeOptions& options,
+                  std::vector<HandEyeResult>& results, std::vector<bool>& consensus);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_HAND_EYE_H
@@ -0,0 +1,55 @@
+#ifndef USB_CAMERA_JPEG_CODEC_H
+#define USB_CAMERA_JPEG_CODEC_H
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+#include <turbojpeg.h>
+
+namespace usb_camera {
+
+// libjpeg-turbo handles for one thread. Not thread safe, use one per thread.
+class JpegCodec {
+public:
+    JpegCodec();
+    ~JpegCodec();
+    JpegCodec(const JpegCodec&) = delete;
+    JpegCodec& operator=(const JpegCodec&) = delete;
+
+    bool readHeader(const uchar* data, size_t size, int& width, int& height, int& subsamp);
+
+    // Decode to BGR at 1/scaleDenom (1, 2, 4 or 8) of the coded size. The
+    // downscale happens in the IDCT, so a reduced decode is cheaper than a
+    // full one. `bgr` is reused if it has the right size.
+    bool decode(const uchar* data, size_t size, cv::Mat& bgr, int scaleDenom = 1);
+    // Same for the luminance only, as CV_8UC1. The chroma components are
+    // entropy decoded but get no IDCT, upsampling or color conversion.
+    bool decodeGray(const uchar* data, size_t size, cv::Mat& gray, int scaleDenom = 1);
+
+    // Cut a side-by-side JPEG into its left and right half without decoding
+    // (lossless crop on the entropy coded data). Fails if the half width is
+    // not a multiple of the MCU width.
+    bool splitHalves(const uchar* data, size_t size, std::vector<uchar>& left, std::vector<uchar>& right);
+
+    // Encode 8 bit BGR or gray (always TJSAMP_GRAY) at `quality` (1-100)
+    // with chroma subsampling `subsamp` (TJSAMP_*) into `out`, reusing its
+    // capacity.
+    bool encode(const cv::Mat& image, int quality, int subsamp, std::vector<uchar>& out);
+
+    static bool validScale(int scaleDenom);
+    // "444", "422", "420" or "gray" to TJSAMP_*.
+    static bool parseSubsampling(const std::string& name, int& subsamp);
+
+private:
+    bool decompress(const uchar* data, size_t size, cv::Mat& out, int scaleDenom, int type, int pixelFormat);
+
+    tjhandle m_decompressor;
+    tjhandle m_transformer;
+    tjhandle m_compressor;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_JPEG_CODEC_H
@@ -0,0 +1,69 @@
+#ifndef USB_CAMERA_LATENCY_MONITOR_H
+#define USB_CAMERA_LATENCY_MONITOR_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+namespace usb_camera {
+
+// Log-scale histogram of durations, 10 buckets per octave from 10 us to
+// about 10 s (~7% resolution), longer values land in the last bucket.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void add(double seconds);
+    void clear();
+
+    size_t count() const { return m_count; }
+    double mean() const { return m_count ? m_sum / m_count : 0.0; }
+    double max() const { return m_max; }
+    // Upper edge of the bucket holding quantile q (0..1).
+    double percentile(double q) const;
+
+private:
+    static const int kBucketsPerOctave = 10;
+    static const int kOctaves = 20;
+
+    std::vector<uint32_t> m_buckets;
+    size_t m_count;
+    double m_sum;
+    double m_max;
+};
+
+// Per-stage latency histograms and frame loss counters of one camera,
+// reported as a DiagnosticStatus. record() and frameCaptured() may be called
+// from any thread.
+class LatencyMonitor {
+public:
+    LatencyMonitor();
+
+    void record(const std::string& name, double seconds);
+    // Count frames the driver skipped, from gaps in the V4L2 sequence.
+    void frameCaptured(uint32_t sequence);
+    // Frames dropped after capture (e.g. by pipeline queues), cumulative.
+    void setPipelineDropped(size_t dropped);
+
+    // Fill `status` with the histograms since the last call and reset them.
+    // `period` is the time the window covered, for the frame rate.
+    void report(diagnostic_msgs::DiagnosticStatus& status, double period, double maxLatency);
+
+private:
+    std::mutex m_mutex;
+    std::map<std::string, LatencyHistogram> m_histograms;
+    bool m_haveSequence;
+    uint32_t m_lastSequence;
+    size_t m_frames;            // since the last report
+    size_t m_missed;            // cumulative
+    size_t m_missedReported;
+    size_t m_pipelineDropped;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_LATENCY_MONITOR_H
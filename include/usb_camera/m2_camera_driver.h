@@ -0,0 +1,247 @@
+#ifndef USB_CAMERA_M2_CAMERA_DRIVER_H
+#define USB_CAMERA_M2_CAMERA_DRIVER_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ros/ros.h>
+#include <image_transport/image_transport.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <std_srvs/Trigger.h>
+
+#include "usb_camera/bounded_queue.h"
+#include "usb_camera/camera_model.h"
+#include "usb_camera/capture_device.h"
+#include "usb_camera/clock_mapper.h"
+#include "usb_camera/disparity_estimator.h"
+#include "usb_camera/jpeg_codec.h"
+#include "usb_camera/latency_monitor.h"
+#include "usb_camera/message_pool.h"
+#include "usb_camera/rectify_maps.h"
+#include "usb_camera/stage_graph.h"
+#include "usb_camera/stereo_frame.h"
+#include "usb_camera/worker_pool.h"
+
+namespace usb_camera {
+
+// Side-by-side stereo camera driver shared by the m2_camera_calib executable,
+// the M2CameraNodelet and m2_camera_multi. Parameters, topics and services
+// are listed in README.md.
+//
+// The driver owns the capture, the calibration and the publishers. The
+// per-frame work is a StageGraph driven by subscriber counts, run on the
+// thread calling run(), on per-step threads (~pipelined) or as tasks of a
+// shared WorkerPool. Images are written in place into pooled messages, so
+// subscribers in the same nodelet manager get them without a copy.
+class M2CameraDriver {
+public:
+    M2CameraDriver(const ros::NodeHandle& nh, const ros::NodeHandle& pnh);
+    ~M2CameraDriver();
+
+    // Share `pool` with other drivers instead of running the stages on the
+    // capture thread or on threads of its own. Call before init().
+    void setWorkerPool(WorkerPool* pool);
+
+    // args: <device>, as on the m2_camera_calib command line. Returns false
+    // if the camera can't be opened.
+    bool init(const std::vector<std::string>& args);
+
+    // Capture and publish until ROS shuts down, stop() is called or the
+    // camera fails. Returns the number of captured frames.
+    size_t run();
+    void stop() { m_running = false; }
+
+private:
+    // nullptr if the file can't be loaded
+    std::shared_ptr<LoadedCalibration> loadCalibration(const std::string& path) const;
+    // `view`: a ~rect_streams name, empty for image_rect
+    std::string mapCachePath(const std::string& calibrationPath, const std::string& view = std::string()) const;
+    void loadRectStreams(const XmlRpc::XmlRpcValue& streams);
+    bool reloadCalibration(std::string& message);
+    bool onReloadCalibration(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
+    // (Re)read ~rect_roi_requests into m_rectRoi.
+    bool loadRectRoi(std::string& message);
+    bool onUpdateRectRoi(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
+    // Calibration file watcher thread.
+    void watchCalibration();
+    bool openCamera();
+    void buildStages();
+    bool grab(StereoFrame& frame);
+    // Largest reduction of the MJPEG decode that all of `stages` can take.
+    int decodeFactor(unsigned stages) const;
+    void releaseFrame(StereoFrame& frame);
+
+    // Capture loop condition: not stopped, ROS up and, checked every
+    // kMasterCheckPeriod seconds, the master reachable.
+    bool keepRunning();
+    size_t runSerial();
+    size_t runPipelined();
+    size_t runPooled();
+    // Pool task: all stages of one frame, parallel loops split over the pool.
+    void processFrame(StereoFrame* frame);
+    // Worker for pipeline step `step`, runs until its input queue is closed and drained.
+    void worker(int step);
+    // Give a frame back to the pool, releasing its device buffer first.
+    void recycle(StereoFrame* frame);
+    // All stages of the frame are done.
+    void finishFrame(const StereoFrame& frame);
+    void publishDiagnostics();
+
+    // stages
+    bool decode(StereoFrame& frame);
+    bool decodeMono(StereoFrame& frame);
+    bool split(StereoFrame& frame);
+    bool publishRaw(StereoFrame& frame);
+    bool publishRawJpeg(StereoFrame& frame);
+    bool rectify(StereoFrame& frame);
+    bool rectifyColor(StereoFrame& frame);
+    bool publishRect(StereoFrame& frame);
+    bool publishRectColor(StereoFrame& frame);
+    bool computeDisparity(StereoFrame& frame);
+    void publishPoints(const StereoFrame& frame, const cv::Mat& disparity, const cv::Mat& Q);
+    bool rectifyStream(StereoFrame& frame, size_t i);
+    bool publishStream(StereoFrame& frame, size_t i);
+    bool rectifyRoi(StereoFrame& frame);
+    bool publishRoi(StereoFrame& frame);
+    bool publishInfo(StereoFrame& frame);
+
+    typedef MessagePool<sensor_msgs::Image> ImagePool;
+    typedef MessagePool<sensor_msgs::CompressedImage> JpegPool;
+
+    // driver side <image topic>/compressed of a left/right pair
+    struct JpegTopic {
+        ros::Publisher pub[2];
+        int quality = 80;
+        int subsampling = TJSAMP_420;
+        std::shared_ptr<JpegPool> pool;
+
+        bool subscribed() const { return pub[0].getNumSubscribers() > 0 || pub[1].getNumSubscribers() > 0; }
+    };
+
+    // Message from `pool` of the given size with its pixel buffer exposed as `view`.
+    static sensor_msgs::ImagePtr createImage(ImagePool& pool, const std_msgs::Header& header, cv::Size size, int type,
+                                             cv::Mat& view);
+    // Rectify `src` straight into left/right messages from `pool`.
+    void rectifyInto(StereoRectifier& rectifier, ImagePool& pool, const StereoFrame& frame, const cv::Mat& src,
+                     sensor_msgs::ImagePtr msg[2], cv::Mat view[2]);
+    void publishImages(image_transport::Publisher pub[2], sensor_msgs::ImagePtr msg[2]);
+    // `quality` and `subsampling` as read from the parameters, the defaults
+    // if invalid. `what` names the topic in warnings.
+    JpegTopic jpegTopic(int quality, const std::string& subsampling, const std::string& what) const;
+    // Advertise <prefix>/left|right/<image>/compressed in place of the image_transport plugin.
+    void advertiseJpeg(const std::string& prefix, const std::string& image, JpegTopic& topic);
+    bool publishJpeg(JpegTopic& topic, const StereoFrame& frame, const cv::Mat view[2]);
+
+    ros::NodeHandle m_nh;
+    ros::NodeHandle m_pnh;
+    image_transport::ImageTransport m_it;
+    image_transport::Publisher m_pubRaw[2];
+    ros::Publisher m_pubRawJpeg[2];
+    image_transport::Publisher m_pubRect[2];
+    image_transport::Publisher m_pubRectColor[2];
+    ros::Publisher m_pubInfo[2];
+    image_transport::Publisher m_pubRoi[2];
+    ros::Publisher m_pubRoiInfo[2];
+    ros::Publisher m_pubDisparity;
+    ros::Publisher m_pubPoints;
+
+    // a ~rect_streams entry
+    struct RectStream {
+        std::string name;
+        double scale = 1.0;
+        cv::Rect roi;       // in scaled pixels, empty: all of it
+        int decodeFactor = 1;   // can be rectified from frames decoded at 1/2, ... 1/decodeFactor
+        image_transport::Publisher pub[2];
+        ros::Publisher pubInfo[2];
+        std::shared_ptr<ImagePool> pool;
+        JpegTopic jpeg;     // ~rect_compressed
+    };
+    std::vector<RectStream> m_rectStreams;
+    int m_messagePoolSize;
+    ImagePool m_rawPool;
+    ImagePool m_rectPool;
+    ImagePool m_rectColorPool;
+    ImagePool m_roiPool;
+    JpegPool m_rawJpegPool;
+    bool m_rectCompressed;
+    int m_jpegQuality;
+    std::string m_jpegSubsampling;
+    JpegTopic m_rectJpeg;
+    JpegTopic m_rectColorJpeg;
+    JpegCodec m_jpegEncoders[2];    // left, right, publish step only
+    ros::Publisher m_pubDiagnostics;
+    ros::ServiceServer m_reloadService;
+    ros::ServiceServer m_roiService;
+    std::mutex m_roiMutex;
+    cv::Rect m_rectRoi;     // empty: no requests, all of image_rect
+    std_msgs::Header m_header[2];
+    StageGraph m_graph;
+
+    std::string m_deviceName;
+    std::string m_namespace;
+    std::string m_captureBackend;
+    int m_bufferCount;
+    bool m_useDmabuf;
+    cv::VideoCapture m_capture;
+    std::unique_ptr<CaptureDevice> m_device;
+    bool m_mjpegPassthrough;
+    int m_decodeScale;
+    std::vector<int> m_stageFactor;     // per stage, the decode reduction it can take
+    JpegCodec m_jpeg;   // decode step only
+    bool m_monoRect;
+    int m_rectColorEvery;
+    unsigned m_colorStages;     // rectify_color and rect_color, skipped on frames between color frames
+    unsigned m_colorCount;      // capture thread only
+    std::unique_ptr<DisparityEstimator> m_disparity;    // rectify step only
+    bool m_publishPoints;
+
+    // pipeline steps after capture: decode, rectify, publish. Step i runs
+    // the stages with ids in [m_stepFirst[i], m_stepFirst[i + 1]).
+    static const int kSteps = 3;
+    bool m_pipelined;
+    int m_queueSize;
+    QueuePolicy m_queuePolicy;
+    std::vector<int> m_cpuAffinity;
+    int m_stepFirst[kSteps + 1];
+    std::vector<std::unique_ptr<StereoFrame> > m_framePool;
+    std::unique_ptr<BoundedQueue<StereoFrame*> > m_free;
+    std::unique_ptr<BoundedQueue<StereoFrame*> > m_queues[kSteps];
+    std::thread m_workers[kSteps];
+    WorkerPool* m_workerPool;
+    int m_poolSource;
+
+    ClockMapper m_clock;        // capture thread only
+    LatencyMonitor m_latency;
+    double m_diagnosticPeriod;
+    double m_maxLatency;
+    int64_t m_lastDiagnostics;
+    static constexpr double kMasterCheckPeriod = 1.0;
+    int64_t m_lastMasterCheck;     // capture thread only
+
+    std::string m_calibrationFile;
+    std::string m_mapCacheDir;
+    double m_calibrationWatchPeriod;
+    // read with std::atomic_load by grab(), replaced with std::atomic_store
+    std::shared_ptr<LoadedCalibration> m_calibration;
+    std::mutex m_reloadMutex;   // one reload at a time
+    std::mutex m_watchMutex;
+    std::condition_variable m_watchCond;
+    bool m_watching;
+    std::thread m_watcher;
+
+    std::atomic_bool m_running;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_M2_CAMERA_DRIVER_H
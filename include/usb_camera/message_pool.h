@@ -0,0 +1,121 @@
+#ifndef USB_CAMERA_MESSAGE_POOL_H
+#define USB_CAMERA_MESSAGE_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace usb_camera {
+
+// Reusable ROS messages with a `data` vector (Image, CompressedImage).
+//
+// The pool keeps its own reference to every message it hands out. Once the
+// publisher and every subscriber queue have dropped theirs (use_count back
+// to 1) the message, with the capacity of its data vector, is handed out
+// again by acquire(). In steady state publishing allocates neither messages
+// nor pixel buffers: a slot is only allocated while fewer than `capacity`
+// are in flight, and its data only grows when a larger image comes along.
+// With all slots still held, e.g. by a slow intra-process subscriber, the
+// message is allocated unpooled. Thread safe.
+template <typename M>
+class MessagePool {
+public:
+    typedef boost::shared_ptr<M> Ptr;
+
+    struct Stats {
+        uint64_t acquired = 0;
+        uint64_t allocations = 0;   // new slots, unpooled messages and data growth
+        size_t slots = 0;
+    };
+
+    explicit MessagePool(size_t capacity = 8) : m_capacity(capacity), m_next(0) {}
+    MessagePool(const MessagePool&) = delete;
+    MessagePool& operator=(const MessagePool&) = delete;
+
+    // 0: every acquire() allocates. Slots beyond it are dropped once free.
+    void setCapacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = capacity;
+    }
+
+    // A message nobody else holds, data resized to `bytes`. Other fields keep
+    // the values of its last use.
+    Ptr acquire(size_t bytes)
+    {
+        Ptr msg;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.acquired++;
+            msg = take();
+            if (!msg && m_slots.size() < m_capacity) {
+                msg = boost::make_shared<M>();
+                m_slots.push_back(msg);
+                m_stats.allocations++;
+            }
+            if (m_slots.size() > m_capacity) {
+                trim();
+            }
+        }
+        if (!msg) {
+            msg = boost::make_shared<M>();
+            m_allocations++;
+        }
+        const size_t capacity = msg->data.capacity();
+        msg->data.resize(bytes);
+        if (msg->data.capacity() != capacity) {
+            m_allocations++;
+        }
+        return msg;
+    }
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Stats s = m_stats;
+        s.allocations += m_allocations;
+        s.slots = m_slots.size();
+        return s;
+    }
+
+private:
+    // m_mutex held
+    Ptr take()
+    {
+        for (size_t k = 0; k < m_slots.size(); k++) {
+            const size_t i = (m_next + k) % m_slots.size();
+            if (m_slots[i].use_count() == 1) {
+                // the last holder released it on another thread, see its writes
+                std::atomic_thread_fence(std::memory_order_acquire);
+                m_next = (i + 1) % m_slots.size();
+                return m_slots[i];
+            }
+        }
+        return Ptr();
+    }
+
+    void trim()
+    {
+        for (size_t i = m_slots.size(); i-- > 0 && m_slots.size() > m_capacity;) {
+            if (m_slots[i].use_count() == 1) {
+                m_slots.erase(m_slots.begin() + i);
+            }
+        }
+        m_next = 0;
+    }
+
+    mutable std::mutex m_mutex;
+    size_t m_capacity;
+    size_t m_next;
+    std::vector<Ptr> m_slots;
+    Stats m_stats;
+    std::atomic<uint64_t> m_allocations{0};     // counted outside m_mutex
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_MESSAGE_POOL_H
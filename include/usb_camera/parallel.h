@@ -0,0 +1,33 @@
+#ifndef USB_CAMERA_PARALLEL_H
+#define USB_CAMERA_PARALLEL_H
+
+#include <opencv2/core.hpp>
+
+#include "usb_camera/worker_pool.h"
+
+namespace usb_camera {
+
+// body(i) for every i in `range`, split in `stripes` chunks, -1: one per
+// thread. Inside a WorkerPool task the chunks run on the pool's workers,
+// elsewhere on OpenCV's thread pool (cv::setNumThreads).
+template <typename Body>
+void parallelFor(const cv::Range& range, const Body& body, double stripes = -1)
+{
+    if (WorkerPool* pool = WorkerPool::current()) {
+        pool->parallel(range.start, range.end, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                body(i);
+            }
+        }, stripes > 0 ? cvCeil(stripes) : 0);
+        return;
+    }
+    cv::parallel_for_(range, [&](const cv::Range& r) {
+        for (int i = r.start; i < r.end; i++) {
+            body(i);
+        }
+    }, stripes);
+}
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_PARALLEL_H
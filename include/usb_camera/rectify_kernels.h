@@ -0,0 +1,144 @@
+#ifndef USB_CAMERA_RECTIFY_KERNELS_H
+#define USB_CAMERA_RECTIFY_KERNELS_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Row kernels of StereoRectifier, shared by stereo_rectifier.cpp and the
+// AVX2 translation unit. The helpers have internal linkage so every unit
+// keeps the copy built for its own instruction set.
+
+namespace usb_camera {
+
+// Bilinear weights for every 5+5 bit fractional position, scaled to 1024 and
+// stored as int16 pairs: top = w00 | w01 << 16, bottom = w10 | w11 << 16.
+struct RectifyWeights {
+    uint32_t top[1024];
+    uint32_t bottom[1024];
+
+    RectifyWeights();   // in stereo_rectifier.cpp, not built with AVX2
+};
+
+extern const RectifyWeights g_rectifyWeights;
+
+struct RowContext {
+    const uchar* src;       // top-left of the source eye
+    size_t step;
+    cv::Size srcSize;
+    int cn;
+    const cv::Vec2s* xy;    // integer source positions of the row, for border pixels
+};
+
+// AVX2 rows, stereo_rectifier_avx2.cpp; only call them where
+// cv::checkHardwareSupport(CV_CPU_AVX2) holds.
+void remapRowC3Avx2(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst);
+void remapRowC1Avx2(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst);
+
+namespace {
+
+inline uint32_t load32(const uchar* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Pixel whose taps may fall outside the source, those taps count as 0.
+inline void blendBorder(const RowContext& c, int i, uint16_t frac, uchar* d)
+{
+    const uint32_t wt = g_rectifyWeights.top[frac], wb = g_rectifyWeights.bottom[frac];
+    const int w[4] = { (int)(wt & 0xffff), (int)(wt >> 16), (int)(wb & 0xffff), (int)(wb >> 16) };
+    int acc[4] = { 512, 512, 512, 512 };
+    for (int k = 0; k < 4; k++) {
+        const int x = c.xy[i][0] + (k & 1), y = c.xy[i][1] + (k >> 1);
+        if (w[k] == 0 || x < 0 || y < 0 || x >= c.srcSize.width || y >= c.srcSize.height) {
+            continue;
+        }
+        const uchar* s = c.src + y * c.step + x * c.cn;
+        for (int ch = 0; ch < c.cn; ch++) {
+            acc[ch] += s[ch] * w[k];
+        }
+    }
+    for (int ch = 0; ch < c.cn; ch++) {
+        d[ch] = (uchar)(acc[ch] >> 10);
+    }
+}
+
+inline void blendScalar(const uchar* s, size_t step, int cn, uint32_t wt, uint32_t wb, uchar* d)
+{
+    const int w00 = wt & 0xffff, w01 = wt >> 16, w10 = wb & 0xffff, w11 = wb >> 16;
+    for (int ch = 0; ch < cn; ch++) {
+        d[ch] = (uchar)((s[ch] * w00 + s[ch + cn] * w01 + s[step + ch] * w10 + s[step + ch + cn] * w11 + 512) >> 10);
+    }
+}
+
+// A pixel that may have taps outside the source.
+inline void blendPixel(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int i, uchar* d)
+{
+    if (ofs[i] < 0) {
+        blendBorder(c, i, frac[i], d);
+    } else {
+        blendScalar(c.src + ofs[i], c.step, c.cn, g_rectifyWeights.top[frac[i]], g_rectifyWeights.bottom[frac[i]], d);
+    }
+}
+
+#if defined(__SSE2__)
+// b00 b01 g00 g01 r00 r01 x x as int16, ready for _mm_madd_epi16 with a weight pair
+inline __m128i tapsC3(const uchar* s)
+{
+    __m128i a = _mm_cvtsi32_si128((int)load32(s));
+    __m128i b = _mm_cvtsi32_si128((int)load32(s + 3));
+    return _mm_unpacklo_epi8(_mm_unpacklo_epi8(a, b), _mm_setzero_si128());
+}
+#endif
+
+inline void blendC3(const uchar* s, size_t step, uint32_t wt, uint32_t wb, uchar* d)
+{
+#if defined(__SSE2__)
+    __m128i acc = _mm_add_epi32(_mm_madd_epi16(tapsC3(s), _mm_set1_epi32((int)wt)),
+                                _mm_madd_epi16(tapsC3(s + step), _mm_set1_epi32((int)wb)));
+    acc = _mm_srli_epi32(_mm_add_epi32(acc, _mm_set1_epi32(512)), 10);
+    acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+    uint32_t v = (uint32_t)_mm_cvtsi128_si32(acc);
+    memcpy(d, &v, 3);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x8_t t0 = vreinterpret_u8_u32(vdup_n_u32(load32(s)));
+    uint8x8_t t1 = vreinterpret_u8_u32(vdup_n_u32(load32(s + 3)));
+    uint8x8_t b0 = vreinterpret_u8_u32(vdup_n_u32(load32(s + step)));
+    uint8x8_t b1 = vreinterpret_u8_u32(vdup_n_u32(load32(s + step + 3)));
+    uint16x8_t t = vmovl_u8(vzip1_u8(t0, t1));     // b00 b01 g00 g01 r00 r01 x x
+    uint16x8_t b = vmovl_u8(vzip1_u8(b0, b1));
+    uint16x4_t vwt = vreinterpret_u16_u32(vdup_n_u32(wt));
+    uint16x4_t vwb = vreinterpret_u16_u32(vdup_n_u32(wb));
+    uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(t), vwt), vget_low_u16(b), vwb);
+    uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(t), vwt), vget_high_u16(b), vwb);
+    uint16x4_t n = vrshrn_n_u32(vpaddq_u32(lo, hi), 10);
+    uint32_t v = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(n, n))), 0);
+    memcpy(d, &v, 3);
+#else
+    blendScalar(s, step, 3, wt, wb, d);
+#endif
+}
+
+inline void blendPixelC3(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int i, uchar* d)
+{
+    if (ofs[i] < 0) {
+        blendBorder(c, i, frac[i], d);
+    } else {
+        blendC3(c.src + ofs[i], c.step, g_rectifyWeights.top[frac[i]], g_rectifyWeights.bottom[frac[i]], d);
+    }
+}
+
+}  // namespace
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_RECTIFY_KERNELS_H
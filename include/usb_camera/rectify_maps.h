@@ -0,0 +1,102 @@
+#ifndef USB_CAMERA_RECTIFY_MAPS_H
+#define USB_CAMERA_RECTIFY_MAPS_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/CameraInfo.h>
+
+#include "usb_camera/camera_model.h"
+#include "usb_camera/stereo_rectifier.h"
+
+namespace usb_camera {
+
+// CV_16SC2 / CV_16UC1 rectification maps of a StereoCameraModel, persisted
+// as a binary file so later starts mmap them instead of running
+// initUndistortRectifyMap. The file records the hash of the calibration it
+// was computed from, the image size and the OpenCV version; any mismatch
+// recomputes and rewrites it.
+//
+// File layout (native endianness): RectifyMapHeader, then map1[0], map2[0],
+// map1[1], map2[1] at 64 byte aligned offsets, rows packed.
+class RectifyMaps {
+public:
+    static const uint32_t kVersion = 1;
+
+    RectifyMaps();
+    ~RectifyMaps();
+    RectifyMaps(const RectifyMaps&) = delete;
+    RectifyMaps& operator=(const RectifyMaps&) = delete;
+
+    // Map `cachePath` if it was made for `sourceHash` and `model`, otherwise
+    // compute the maps and (best effort) write the file. An empty cachePath
+    // just computes.
+    bool load(const std::string& cachePath, uint64_t sourceHash, const StereoCameraModel& model)
+    {
+        return load(cachePath, sourceHash, model, model);
+    }
+    // Maps from `model` to the rectifiedView() `output`.
+    bool load(const std::string& cachePath, uint64_t sourceHash, const StereoCameraModel& model,
+              const StereoCameraModel& output);
+    // true if the maps point into the mmapped file
+    bool mapped() const { return m_data != nullptr; }
+
+    cv::Mat map1[2];
+    cv::Mat map2[2];
+
+private:
+    bool mapFile(const std::string& path, uint64_t sourceHash, cv::Size size);
+    bool writeFile(const std::string& path, uint64_t sourceHash) const;
+    void unmap();
+
+    void* m_data;
+    size_t m_size;
+};
+
+// An extra rectified output (~rect_streams): maps from the decoded frame
+// straight to the scaled and cropped image. A stream at half the size or
+// less also has maps from frames decoded at 1/2, 1/4, ... of the size, for
+// the frames where nothing needs the full decode.
+struct RectifiedView {
+    struct Source {
+        RectifyMaps maps;
+        StereoRectifier rectifier;
+    };
+
+    StereoCameraModel model;        // of the output, see StereoCameraModel::rectifiedView
+    RectifyMaps maps;
+    StereoRectifier rectifier;
+    std::vector<std::unique_ptr<Source> > reduced;  // from 1/2, 1/4, ... size frames
+    sensor_msgs::CameraInfo cameraInfo[2];
+
+    // For a frame decoded at 1/factor of the size, factor a power of two
+    // up to 2^reduced.size().
+    StereoRectifier& rectifierFor(int factor)
+    {
+        int i = -1;
+        for (int f = factor; f > 1; f >>= 1) {
+            i++;
+        }
+        return i < 0 ? rectifier : reduced[i]->rectifier;
+    }
+};
+
+// A calibration and everything derived from it. The driver swaps it as a
+// whole on reload, frames keep the one they were captured with.
+struct LoadedCalibration {
+    std::string path;
+    uint64_t hash = 0;
+    StereoCameraModel model;
+    RectifyMaps maps;
+    StereoRectifier rectifier;      // rectify stage only, packs itself on first use
+    sensor_msgs::CameraInfo cameraInfo[2];
+    std::vector<std::unique_ptr<RectifiedView> > views;     // in ~rect_streams order
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_RECTIFY_MAPS_H
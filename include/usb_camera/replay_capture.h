@@ -0,0 +1,112 @@
+#ifndef USB_CAMERA_REPLAY_CAPTURE_H
+#define USB_CAMERA_REPLAY_CAPTURE_H
+
+#include "usb_camera/capture_device.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "usb_camera/bounded_queue.h"
+#include "usb_camera/jpeg_codec.h"
+#include "usb_camera/stereo_recorder.h"
+
+namespace usb_camera {
+
+enum class ReplayTiming {
+    Original,   // the recording's frame intervals
+    Fixed,      // a fixed frame rate
+    Fast        // as soon as the consumer gives a buffer back
+};
+
+// Returns false for anything but "original", "fixed" and "fast".
+bool parseReplayTiming(const std::string& name, ReplayTiming& timing);
+
+struct ReplayOptions {
+    ReplayTiming timing = ReplayTiming::Original;
+    double fps = 0.0;       // Fixed rate and fallback interval, 0: the fps passed to open()
+    bool loop = false;
+    int readAhead = 8;      // frames loaded ahead of the consumer
+};
+
+// Plays recorded side-by-side frames through the CaptureDevice interface so
+// they take the same decode / rectify / publish path as a live camera.
+// `deviceName` is an .m2rec recording (StereoRecorder), a directory of frame
+// files in name order or a single file. A file holds one frame, a JPEG
+// (recognized by its SOI marker) or raw pixels in the format passed to
+// open(). Left/right pairs of a recording are joined side by side, MJPEG
+// pairs (opencv_video_camera_2) are decoded to BGR for that.
+//
+// A reader thread loads frames up to `readAhead` ahead of the consumer into
+// their own buffers, for recordings it also asks the kernel to read ahead,
+// so disk I/O overlaps with the pipeline. Frames are stamped with the
+// CLOCK_MONOTONIC time of delivery, so published headers carry the replay
+// time, not the field timestamps of the recording; those only pace
+// Original. Directories carry no timestamps, there Original plays at the
+// fixed rate. Without `loop` dequeue() fails after the
+// last frame and endOfStream() turns true.
+class ReplayCapture : public CaptureDevice {
+public:
+    ReplayCapture(int bufferCount, const ReplayOptions& options);
+    ~ReplayCapture();
+
+    bool open(const std::string& deviceName, const CaptureFormat& format) override;
+    void close() override;
+    bool isOpened() const override { return m_count > 0; }
+
+    CaptureFormat format() const override { return m_format; }
+    int bufferCount() const override { return (int)m_buffers.size(); }
+
+    bool dequeue(CapturedFrame& frame, int timeout_ms) override;
+    void release(CapturedFrame& frame) override;
+    bool endOfStream() const override { return m_end; }
+
+private:
+    struct Buffer {
+        std::vector<uchar> storage;
+        uint32_t fourcc = 0;
+        int width = 0;
+        int height = 0;
+        size_t bytes = 0;
+        int64_t stamp_ns = 0;   // recording time, 0 if unknown
+    };
+
+    void reader();
+    bool load(size_t i, Buffer& b);
+    bool loadFile(const std::string& path, Buffer& b);
+    bool loadRecord(size_t i, Buffer& b);
+    std::chrono::steady_clock::duration interval(const Buffer& b);
+
+    int m_requestedBuffers;
+    ReplayOptions m_options;
+    CaptureFormat m_format;
+    size_t m_rawSize;
+
+    std::vector<std::string> m_files;
+    StereoRecordReader m_recording;
+    bool m_isRecording;
+    size_t m_count;
+    std::vector<bool> m_unreadable;     // reader thread only
+    JpegCodec m_jpeg;                   // reader thread only, MJPEG pairs
+    cv::Mat m_decoded[2];
+
+    std::vector<Buffer> m_buffers;
+    std::unique_ptr<BoundedQueue<int> > m_empty;    // to the reader
+    std::unique_ptr<BoundedQueue<int> > m_ready;    // to dequeue()
+    std::thread m_reader;
+    std::atomic_bool m_readerDone;
+    std::atomic_bool m_end;
+
+    // consumer side
+    uint32_t m_sequence;
+    bool m_started;
+    int64_t m_prevStamp;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_REPLAY_CAPTURE_H
@@ -0,0 +1,73 @@
+#ifndef USB_CAMERA_STAGE_GRAPH_H
+#define USB_CAMERA_STAGE_GRAPH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace usb_camera {
+
+struct StereoFrame;
+
+// Per-frame work split into stages that only run while somebody consumes
+// their output. A stage is needed if its own demand function says so (e.g.
+// a publisher has subscribers) or if any needed stage takes it as input.
+// Stages must be added after their inputs, run() executes the needed ones in
+// that order.
+//
+// Which stages are needed is decided when a frame is captured: the frame
+// keeps activeMask() in StereoFrame::stages and run() follows that mask, so
+// a pipeline can run consecutive stage ranges of the same frame on different
+// threads while update() already looks at the next one.
+class StageGraph {
+public:
+    static const int kMaxStages = 32;
+
+    typedef std::function<bool()> Demand;
+    typedef std::function<bool(StereoFrame&)> Run;      // false aborts the frame
+    typedef std::function<void(int id, double seconds)> Observer;
+
+    int add(const std::string& name, const Run& run, const Demand& demand = Demand(),
+            const std::vector<int>& inputs = std::vector<int>());
+
+    // Re-evaluate demand, log stages that started or stopped.
+    // Returns true if at least one stage is active.
+    bool update();
+    // Run the stages in frame.stages, optionally only those with an id in
+    // [first, last).
+    bool run(StereoFrame& frame) const { return run(frame, 0, size()); }
+    bool run(StereoFrame& frame, int first, int last) const;
+
+    bool active(int id) const { return m_stages[id].active; }
+    bool anyActive() const;
+    // Bit i set if stage i is active.
+    unsigned activeMask() const;
+    // activeMask() for a frame that leaves out the stages in `skip` (a bit
+    // mask like activeMask()), together with inputs nothing else needs. Uses
+    // the demand seen by the last update(). Stages taking a skipped stage as
+    // input must be skipped too.
+    unsigned activeMask(unsigned skip) const;
+    int size() const { return (int)m_stages.size(); }
+    const std::string& name(int id) const { return m_stages[id].name; }
+
+    // Called by run() after each stage with its wall time, from the thread
+    // running it. Set before the first run().
+    void setObserver(const Observer& observer) { m_observer = observer; }
+
+private:
+    struct Stage {
+        std::string name;
+        Run run;
+        Demand demand;
+        std::vector<int> inputs;
+        bool demanded;
+        bool active;
+    };
+
+    std::vector<Stage> m_stages;
+    Observer m_observer;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_STAGE_GRAPH_H
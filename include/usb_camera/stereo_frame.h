@@ -0,0 +1,74 @@
+#ifndef USB_CAMERA_STEREO_FRAME_H
+#define USB_CAMERA_STEREO_FRAME_H
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+#include <vector>
+
+#include <std_msgs/Header.h>
+#include <sensor_msgs/Image.h>
+
+#include "usb_camera/capture_device.h"
+
+namespace usb_camera {
+
+struct LoadedCalibration;
+
+// Everything one side-by-side frame carries through the stages. Instances
+// are pooled and reused, Mats keep their allocation from frame to frame.
+struct StereoFrame {
+    CapturedFrame captured;     // device buffer, index < 0 once released
+    std_msgs::Header header[2];
+    unsigned stages = 0;        // StageGraph::activeMask() when captured
+    std::shared_ptr<LoadedCalibration> calibration;     // in effect when captured
+    cv::Rect rectRoi;           // union of the ~rect_roi_requests when captured, in image_rect pixels
+    int decodeFactor = 1;       // decoded at 1/decodeFactor of the ~decode_scale size
+
+    cv::Mat bgr;                // decoded frame
+    cv::Mat storage;            // owned pixels when bgr is resized or copied out of the device buffer
+    cv::Mat half[2];            // views into bgr
+    cv::Mat gray;               // decoded luminance, rect_encoding mono8
+    cv::Mat grayStorage;        // owned pixels when gray is resized or copied out of the device buffer
+    sensor_msgs::ImagePtr rectMsg[2];
+    cv::Mat rectView[2];        // views into rectMsg pixel data
+    sensor_msgs::ImagePtr rectColorMsg[2];  // image_rect_color next to mono8 image_rect
+    cv::Mat rectColorView[2];
+    sensor_msgs::ImagePtr roiMsg[2];    // rectRoi of image_rect
+    cv::Mat roiView[2];
+    std::vector<sensor_msgs::ImagePtr> streamMsg;  // left, right per ~rect_streams entry
+    std::vector<cv::Mat> streamView;
+
+    // Drop per-frame results, keep allocations.
+    void reset()
+    {
+        stages = 0;
+        decodeFactor = 1;
+        calibration.reset();
+        if (!bgr.u) {
+            // a view of the device buffer, don't decode into it next time
+            bgr.release();
+        }
+        if (!gray.u) {
+            gray.release();
+        }
+        half[0].release();
+        half[1].release();
+        for (int k = 0; k < 2; k++) {
+            rectMsg[k].reset();
+            rectView[k].release();
+            rectColorMsg[k].reset();
+            rectColorView[k].release();
+            roiMsg[k].reset();
+            roiView[k].release();
+        }
+        for (size_t i = 0; i < streamMsg.size(); i++) {
+            streamMsg[i].reset();
+            streamView[i].release();
+        }
+    }
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_STEREO_FRAME_H
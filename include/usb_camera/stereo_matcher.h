@@ -0,0 +1,115 @@
+#ifndef USB_CAMERA_STEREO_MATCHER_H
+#define USB_CAMERA_STEREO_MATCHER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <utility>
+
+namespace usb_camera {
+
+// Pairs the frames of two independently clocked cameras by timestamp.
+//
+// Frames are pushed per stream in capture order. A frame is paired with the
+// frame of the other stream closest in time if they are at most `tolerance`
+// apart. A frame that is older than every possible partner by more than the
+// tolerance is dropped; a frame whose partner may still arrive waits, but at
+// most `depth` frames per stream, after that the oldest is dropped. Only
+// timestamps are looked at, so the matcher can be driven by synthetic
+// streams; T is whatever payload travels with a frame.
+template <typename T>
+class StereoMatcher {
+public:
+    struct Frame {
+        int64_t stamp_ns;
+        T payload;
+    };
+
+    explicit StereoMatcher(int64_t tolerance_ns, size_t depth = 4)
+        : m_tolerance(tolerance_ns), m_depth(depth < 1 ? 1 : depth), m_matched(0)
+    {
+        m_dropped[0] = m_dropped[1] = 0;
+    }
+
+    void push(int stream, int64_t stamp_ns, T payload)
+    {
+        std::deque<Frame>& q = m_queue[stream];
+        Frame f;
+        f.stamp_ns = stamp_ns;
+        f.payload = std::move(payload);
+        if (!q.empty() && stamp_ns < q.back().stamp_ns) {
+            // out of order (clock step), nothing queued can be trusted
+            m_dropped[stream] += q.size();
+            q.clear();
+        }
+        q.push_back(std::move(f));
+        while (q.size() > m_depth) {
+            q.pop_front();
+            m_dropped[stream]++;
+        }
+    }
+
+    // Next matched pair, false if none is ready yet.
+    bool pop(Frame& left, Frame& right)
+    {
+        std::deque<Frame>* q = m_queue;
+        while (!q[0].empty() && !q[1].empty()) {
+            const int64_t a = q[0].front().stamp_ns;
+            const int64_t b = q[1].front().stamp_ns;
+            // the later streams only bring later frames: an older front
+            // that is out of tolerance can never be matched
+            if (a < b - m_tolerance) {
+                dropFront(0);
+                continue;
+            }
+            if (b < a - m_tolerance) {
+                dropFront(1);
+                continue;
+            }
+            // within tolerance, but the next frame of the earlier stream may
+            // be closer to the other front
+            const int early = a <= b ? 0 : 1;
+            const int64_t other = early == 0 ? b : a;
+            const int64_t dist = std::llabs(a - b);
+            if (q[early].size() > 1 && std::llabs(q[early][1].stamp_ns - other) < dist) {
+                dropFront(early);
+                continue;
+            }
+            left = std::move(q[0].front());
+            right = std::move(q[1].front());
+            q[0].pop_front();
+            q[1].pop_front();
+            m_matched++;
+            return true;
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        m_queue[0].clear();
+        m_queue[1].clear();
+    }
+
+    int64_t tolerance() const { return m_tolerance; }
+    size_t matched() const { return m_matched; }
+    size_t dropped(int stream) const { return m_dropped[stream]; }
+    size_t pending(int stream) const { return m_queue[stream].size(); }
+
+private:
+    void dropFront(int stream)
+    {
+        m_queue[stream].pop_front();
+        m_dropped[stream]++;
+    }
+
+    int64_t m_tolerance;
+    size_t m_depth;
+    std::deque<Frame> m_queue[2];
+    size_t m_matched;
+    size_t m_dropped[2];
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_STEREO_MATCHER_H
@@ -0,0 +1,177 @@
+#ifndef USB_CAMERA_STEREO_RECORDER_H
+#define USB_CAMERA_STEREO_RECORDER_H
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "usb_camera/bounded_queue.h"
+
+namespace usb_camera {
+
+// Stereo recording container (.m2rec), append only:
+//
+//   file header (4 KiB)
+//   chunk*      chunk header, records, zero padding to a 4 KiB multiple
+//   index       one entry (sequence, stamp, record offset) per record,
+//               padded to 4 KiB, the trailer in the last bytes of the file
+//
+// A record is a capture timestamp per eye plus either one side-by-side
+// image or a left and a right image. Images are stored as they come: MJPG
+// bitstreams or uncompressed BGR3 / GREY pixels with packed rows. A file
+// whose recording was interrupted has no index, readers rebuild it from the
+// chunk headers.
+struct RecordedImage {
+    uint32_t fourcc = 0;        // MJPG, BGR3 or GREY
+    int width = 0;
+    int height = 0;
+    cv::Mat data;               // MJPG: 1 x size CV_8UC1, otherwise height x width pixels
+};
+
+struct StereoRecord {
+    uint64_t sequence = 0;
+    int64_t stamp_ns[2] = { 0, 0 };
+    bool sideBySide = false;    // image[0] holds both eyes, image[1] is empty
+    RecordedImage image[2];
+};
+
+struct RecorderOptions {
+    size_t chunkSize = 8 << 20;     // rounded up to 4 KiB, must hold the largest record
+    int chunks = 8;                 // buffer pool size
+    bool directIo = false;
+};
+
+// Records stereo frames through a background writer thread.
+//
+// write() only copies the frame into a preallocated chunk buffer; full
+// chunks are handed to the writer, which writes each with one large
+// sequential write (optionally with O_DIRECT, falling back to buffered I/O
+// where the file system doesn't support it). write() never waits for the
+// disk: if every chunk is still queued for writing the frame is dropped and
+// counted. open(), write() and close() may be called from different threads.
+class StereoRecorder {
+public:
+    StereoRecorder();
+    ~StereoRecorder();
+    StereoRecorder(const StereoRecorder&) = delete;
+    StereoRecorder& operator=(const StereoRecorder&) = delete;
+
+    bool open(const std::string& path, const RecorderOptions& options = RecorderOptions());
+    // Flush queued chunks and write the index.
+    void close();
+    bool isOpen() const;
+    std::string path() const;
+
+    // `frame`: a side-by-side BGR or gray image.
+    bool write(int64_t stamp_ns, const cv::Mat& frame);
+    bool write(const int64_t stamp_ns[2], const cv::Mat& left, const cv::Mat& right);
+    // The camera's MJPEG bitstream of a side-by-side frame, stored undecoded.
+    bool writeJpeg(int64_t stamp_ns, const uchar* data, size_t size, int width, int height);
+    // MJPEG bitstreams (1 x size CV_8UC1) of two cameras' `size` frames.
+    bool writeJpeg(const int64_t stamp_ns[2], const cv::Mat& left, const cv::Mat& right, cv::Size size);
+
+    size_t recorded() const { return m_recorded; }
+    size_t dropped() const { return m_dropped; }
+    uint64_t bytesWritten() const { return m_bytesWritten; }
+
+    static uint32_t fourccOf(const cv::Mat& image);
+
+private:
+    struct IndexEntry {
+        uint64_t sequence;
+        int64_t stamp_ns;
+        uint64_t offset;    // chunk relative until the writer places the chunk
+    };
+    struct Chunk {
+        uchar* data = nullptr;
+        size_t used = 0;
+        uint32_t records = 0;
+        std::vector<IndexEntry> index;
+    };
+    struct Source {
+        uint32_t fourcc;
+        int width;
+        int height;
+        const cv::Mat* image;   // nullptr for a bitstream
+        const uchar* bytes;
+        size_t size;
+    };
+
+    bool append(const int64_t stamp_ns[2], bool sideBySide, const Source* sources, int count);
+    void writer();
+    bool writeAll(const uchar* data, size_t size);
+    void writeIndex();
+    void freeChunks();
+
+    mutable std::mutex m_mutex;     // producer side: m_fill, m_open, m_sequence
+    bool m_open;
+    std::string m_path;
+    RecorderOptions m_options;
+    int m_fd;
+    bool m_directIo;
+    std::vector<std::unique_ptr<Chunk> > m_chunks;
+    std::unique_ptr<BoundedQueue<Chunk*> > m_free;
+    std::unique_ptr<BoundedQueue<Chunk*> > m_full;
+    Chunk* m_fill;
+    uint64_t m_sequence;
+    std::thread m_writer;
+
+    // writer thread (and close() after joining it)
+    uint64_t m_fileOffset;
+    std::vector<IndexEntry> m_index;
+    bool m_writeFailed;
+
+    std::atomic<size_t> m_recorded;
+    std::atomic<size_t> m_dropped;
+    std::atomic<uint64_t> m_bytesWritten;
+};
+
+// <dir>stereo_YYYYmmdd_HHMMSS.m2rec, `dir` ends with a slash.
+std::string recordingPath(const std::string& dir);
+// Start recording into a new recordingPath(dir), or stop and print what was
+// recorded; the 'r' key of the capture tools.
+void toggleRecording(StereoRecorder& recorder, const std::string& dir, bool directIo);
+
+// Random access to a .m2rec file through a read only mapping.
+class StereoRecordReader {
+public:
+    StereoRecordReader();
+    ~StereoRecordReader();
+    StereoRecordReader(const StereoRecordReader&) = delete;
+    StereoRecordReader& operator=(const StereoRecordReader&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    size_t size() const { return m_index.size(); }
+    int64_t stamp(size_t i) const { return m_index[i].stamp_ns; }
+    // `record` views the mapping, valid until close().
+    bool read(size_t i, StereoRecord& record) const;
+    // Hint the kernel to read records [first, last) ahead.
+    void prefetch(size_t first, size_t last) const;
+
+private:
+    struct Entry {
+        uint64_t sequence;
+        int64_t stamp_ns;
+        uint64_t offset;
+    };
+
+    bool readIndex();
+    bool scanChunks();
+    bool recordExtent(uint64_t offset, size_t& size) const;
+
+    const uchar* m_data;
+    size_t m_size;
+    std::vector<Entry> m_index;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_STEREO_RECORDER_H
@@ -0,0 +1,87 @@
+#ifndef USB_CAMERA_STEREO_RECTIFIER_H
+#define USB_CAMERA_STEREO_RECTIFIER_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace usb_camera {
+
+// Bilinear rectification of both eyes of a stereo pair in one pass.
+//
+// The CV_16SC2/CV_16UC1 maps from cv::initUndistortRectifyMap are repacked
+// into tiles of kTileWidth x kTileHeight output pixels. Per pixel a tile
+// stores the byte offset of the top-left source tap and the 5+5 bit
+// fractional position, so the inner loop is a plain gather + fixed-point
+// blend (SSE2/NEON, scalar fallback; AVX2 rows are built in their own unit
+// and picked at runtime on CPUs that have it). Work is split in bands of one
+// tile row, each band rectifies the same rows of the left and right eye so
+// both halves of a side-by-side frame are walked together.
+//
+// Results match cv::remap(INTER_LINEAR, BORDER_CONSTANT) up to +-1 LSB, see
+// test/test_stereo_rectifier.cpp.
+//
+// The offsets depend on the source step and channel count. They are kept for
+// the last two source layouts, so alternating mono8 and bgr8 frames doesn't
+// repack on every frame.
+class StereoRectifier {
+public:
+    static const int kTileWidth = 64;
+    static const int kTileHeight = 16;
+
+    StereoRectifier();
+
+    // map1/map2 per eye as returned by cv::initUndistortRectifyMap(..., CV_16SC2, map1, map2).
+    void init(const cv::Mat map1[2], const cv::Mat map2[2]);
+    bool empty() const { return m_tiles.empty(); }
+    cv::Size size() const { return m_size; }
+
+    // Rectify the left and right half of a side-by-side frame. `left` and
+    // `right` are only (re)allocated when they don't have the output size and
+    // the frame type yet, pass the same Mats every frame.
+    void rectify(const cv::Mat& frame, cv::Mat& left, cv::Mat& right);
+    void rectify(const cv::Mat& srcL, const cv::Mat& srcR, cv::Mat& left, cv::Mat& right);
+    // Only `roi` (output pixels, clipped to size(), not empty) of the
+    // rectified images, `left` and `right` get its size. Only the tiles
+    // covering roi are walked, the cost scales with its area.
+    void rectify(const cv::Mat& frame, cv::Mat& left, cv::Mat& right, const cv::Rect& roi);
+    void rectify(const cv::Mat& srcL, const cv::Mat& srcR, cv::Mat& left, cv::Mat& right, const cv::Rect& roi);
+
+private:
+    struct Tile {
+        int x, y, width, height;
+        size_t first;   // index of the tile's first entry in Layout::ofs/m_frac
+    };
+
+    // packed maps for one source layout
+    struct Layout {
+        size_t step = 0;
+        int cn = 0;
+        cv::Size src;
+        std::vector<int32_t> ofs[2];    // byte offset of the top-left tap, -1 if a tap is outside
+        uint64_t lastUse = 0;
+    };
+
+    // The layout for this source geometry, packed into the least recently
+    // used slot if it isn't there yet.
+    const Layout& layout(size_t step, int cn, cv::Size srcSize);
+    void pack(Layout& l) const;
+    // The part of band `band` inside `roi`, dst starts at roi's top-left.
+    void rectifyBand(int band, const Layout& l, const cv::Mat* src, cv::Mat* dst, const cv::Rect& roi) const;
+
+    cv::Size m_size;
+    cv::Mat m_map1[2];
+    std::vector<Tile> m_tiles;
+    int m_tilesPerRow;
+    int m_bands;
+
+    // packed maps, laid out tile after tile
+    std::vector<uint16_t> m_frac[2];    // fy << 5 | fx, as in the CV_16UC1 map
+    Layout m_layouts[2];
+    uint64_t m_uses;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_STEREO_RECTIFIER_H
@@ -0,0 +1,17 @@
+#ifndef USB_CAMERA_THREAD_UTIL_H
+#define USB_CAMERA_THREAD_UTIL_H
+
+#include <string>
+
+namespace usb_camera {
+
+// Restrict the calling thread to one CPU. cpu < 0 leaves it unpinned.
+// Returns false (and leaves the thread as is) if the CPU is not available.
+bool pinCurrentThread(int cpu);
+
+// Name shown by top -H / htop, truncated to 15 characters.
+void setCurrentThreadName(const std::string& name);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_THREAD_UTIL_H
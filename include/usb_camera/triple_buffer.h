@@ -0,0 +1,104 @@
+#ifndef USB_CAMERA_TRIPLE_BUFFER_H
+#define USB_CAMERA_TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace usb_camera {
+
+// Single producer / single consumer "latest value" buffer.
+//
+// Three preallocated slots rotate between the writer (back), the reader
+// (front) and a shared middle slot. Publishing and acquiring are a single
+// atomic exchange of slot ownership, nothing is copied and neither side ever
+// waits for the other. A reader that only wants fresh data can block in
+// waitAcquire(); the mutex there is only taken by a writer when somebody is
+// actually waiting.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer()
+        : m_middle(1), m_back(0), m_front(2), m_waiters(0), m_closed(false)
+    {
+    }
+
+    // Writer side: fill back(), then publish() it. Unread data in the middle
+    // slot is dropped, the reader always sees the newest value.
+    T& back() { return m_slots[m_back]; }
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | kFresh) & kIndex;
+        wake();
+    }
+
+    // Reader side: front() is owned by the reader until the next successful
+    // acquire. tryAcquire() returns false if nothing new was published.
+    T& front() { return m_slots[m_front]; }
+    bool tryAcquire()
+    {
+        if (!(m_middle.load() & kFresh)) {
+            return false;
+        }
+        m_front = m_middle.exchange(m_front) & kIndex;
+        return true;
+    }
+
+    // Block until a new value is published (true) or close() is called (false).
+    bool waitAcquire()
+    {
+        return waitAcquire(std::chrono::hours(24 * 365));
+    }
+    template <typename Rep, typename Period>
+    bool waitAcquire(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if (tryAcquire()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiters++;
+        m_cond.wait_for(lock, timeout, [this] { return m_closed.load() || (m_middle.load() & kFresh); });
+        m_waiters--;
+        lock.unlock();
+        return tryAcquire();
+    }
+
+    void close()
+    {
+        m_closed = true;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_all();
+    }
+    bool closed() const { return m_closed; }
+
+    // Direct slot access for preallocation before the writer starts.
+    T& slot(int i) { return m_slots[i]; }
+
+private:
+    static const unsigned kIndex = 0x3;
+    static const unsigned kFresh = 0x4;
+
+    void wake()
+    {
+        if (m_waiters.load() > 0) {
+            // serialize with a reader between its predicate check and wait
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+    }
+
+    T m_slots[3];
+    std::atomic<unsigned> m_middle;
+    unsigned m_back;    // writer only
+    unsigned m_front;   // reader only
+
+    std::atomic<int> m_waiters;
+    std::atomic_bool m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_TRIPLE_BUFFER_H
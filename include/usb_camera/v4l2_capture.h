@@ -0,0 +1,50 @@
+#ifndef USB_CAMERA_V4L2_CAPTURE_H
+#define USB_CAMERA_V4L2_CAPTURE_H
+
+#include "usb_camera/capture_device.h"
+
+#include <vector>
+
+namespace usb_camera {
+
+// Native V4L2 streaming capture. Driver buffers are mmap()ed once and
+// dequeued frames are handed out as cv::Mat views over them, nothing is
+// copied or decoded here.
+class V4L2Capture : public CaptureDevice {
+public:
+    explicit V4L2Capture(int bufferCount = 4, bool exportDmabuf = false);
+    ~V4L2Capture();
+
+    bool open(const std::string& deviceName, const CaptureFormat& format) override;
+    void close() override;
+    bool isOpened() const override { return m_fd >= 0; }
+
+    CaptureFormat format() const override { return m_format; }
+    int bufferCount() const override { return (int)m_buffers.size(); }
+
+    bool dequeue(CapturedFrame& frame, int timeout_ms) override;
+    void release(CapturedFrame& frame) override;
+
+private:
+    struct Buffer {
+        void* start = nullptr;
+        size_t length = 0;
+        int dmabuf_fd = -1;
+    };
+
+    bool setFormat(const CaptureFormat& format);
+    bool initBuffers();
+    void freeBuffers();
+
+    int m_fd;
+    int m_requestedBuffers;
+    bool m_exportDmabuf;
+    bool m_streaming;
+    uint32_t m_bytesPerLine;
+    CaptureFormat m_format;
+    std::vector<Buffer> m_buffers;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_V4L2_CAPTURE_H
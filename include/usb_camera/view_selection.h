@@ -0,0 +1,47 @@
+#ifndef USB_CAMERA_VIEW_SELECTION_H
+#define USB_CAMERA_VIEW_SELECTION_H
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+namespace usb_camera {
+
+// Where a board lies in the image, each in [0, 1], as on the progress bars
+// of ROS camera_calibration: x and y of its center, size (square root of
+// its area relative to the image) and skew (how far the angle at its first
+// corner is from 90 degrees).
+struct BoardPose {
+    double x = 0;
+    double y = 0;
+    double size = 0;
+    double skew = 0;
+};
+
+BoardPose boardPose(const std::vector<cv::Point2f>& corners, cv::Size boardSize, cv::Size imageSize);
+
+// One stereo view: the board corners seen by both cameras.
+struct StereoView {
+    const std::vector<cv::Point2f>* corners[2];
+    double sharpness = -1;  // the lower of both CornerDetection::sharpness, -1: unknown
+};
+
+struct ViewSelectionOptions {
+    int maxViews = 40;                  // 0: all views
+    cv::Size grid = cv::Size(8, 6);     // image cells for the area coverage
+    // views blurrier than this fraction of the median sharpness are only
+    // taken when nothing else is left
+    double minSharpness = 0.5;
+};
+
+// Greedily picks up to maxViews diverse views, best first. A view's gain is
+// how much it adds to the image area covered in both cameras (cells hit by
+// few selected views count more) plus its board pose distance to the
+// nearest selected view, scaled by its sharpness relative to the median.
+// Returns the indices into `views` in selection order.
+std::vector<int> selectViews(const std::vector<StereoView>& views, cv::Size boardSize, cv::Size imageSize,
+                             const ViewSelectionOptions& options);
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_VIEW_SELECTION_H
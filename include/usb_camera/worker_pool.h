@@ -0,0 +1,103 @@
+#ifndef USB_CAMERA_WORKER_POOL_H
+#define USB_CAMERA_WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "usb_camera/bounded_queue.h"
+
+namespace usb_camera {
+
+// Threads shared by several producers ("sources", one per camera).
+//
+// Every source has its own bounded FIFO with its own QueuePolicy. A
+// source's tasks run one at a time and in submission order, so per-camera
+// state (decoder, rectifier, publish order) needs no locking; different
+// sources run in parallel. An idle worker takes the next task round-robin
+// over the sources that have work and are not already running, so whichever
+// worker is free picks up any camera's backlog and a camera producing more
+// than its share can't starve the others.
+//
+// Inside a task, parallel() (and so parallelFor()) splits loops such as
+// rectifier bands, JPEG eyes or disparity strips into chunks on the calling
+// worker's deque. The caller runs them from the back, and idle workers
+// steal from the front before taking a new task, so a frame in flight
+// finishes first and the loops don't need threads outside the pool.
+class WorkerPool {
+public:
+    struct Task {
+        std::function<void()> run;
+        std::function<void()> drop;     // instead of run() when evicted by DropOldest
+    };
+
+    // `cpus`: CPU of worker i is cpus[i % cpus.size()], empty: not pinned.
+    explicit WorkerPool(int threads, const std::vector<int>& cpus = std::vector<int>());
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int addSource(const std::string& name, size_t capacity, QueuePolicy policy);
+    // Returns false once the pool is stopped, the task is not run then.
+    bool submit(int source, const Task& task);
+    // Wait until the source has nothing queued or running.
+    void drain(int source);
+    size_t dropped(int source) const;
+    int threads() const { return (int)m_threads.size(); }
+
+    // body(begin, end) over [begin, end) split in `stripes` chunks (<= 0:
+    // one per worker); returns when all chunks are done. Called from a task
+    // of this pool, otherwise runs the whole range on the caller.
+    void parallel(int begin, int end, const std::function<void(int, int)>& body, int stripes);
+    // The pool whose task is running on this thread, nullptr elsewhere.
+    static WorkerPool* current();
+
+    // Run what is queued, then join the workers.
+    void stop();
+
+private:
+    struct Source {
+        std::string name;
+        std::vector<Task> ring;
+        size_t head = 0;
+        size_t size = 0;
+        QueuePolicy policy = QueuePolicy::Block;
+        bool running = false;
+        size_t dropped = 0;
+    };
+    // one parallel() call
+    struct Job {
+        const std::function<void(int, int)>* body;
+        int pending;        // chunks not finished
+    };
+    struct Chunk {
+        Job* job = nullptr;
+        int begin = 0;
+        int end = 0;
+    };
+
+    void worker(int index, int cpu);
+    // Next runnable task round-robin, m_mutex held.
+    bool next(int& source, Task& task);
+    // Oldest chunk of another worker's parallel(), m_mutex held.
+    bool steal(int self, Chunk& chunk);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_work;     // a task was queued or stop()
+    std::condition_variable m_changed;  // a task was taken or finished
+    std::condition_variable m_chunkDone;    // a stolen chunk finished
+    std::vector<std::deque<Chunk> > m_chunks;   // per worker
+    std::vector<std::unique_ptr<Source> > m_sources;
+    size_t m_cursor;
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+};
+
+}  // namespace usb_camera
+
+#endif  // USB_CAMERA_WORKER_POOL_H
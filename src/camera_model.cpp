@@ -0,0 +1,125 @@
+#include "usb_camera/camera_model.h"
+
+#include <opencv2/calib3d.hpp>
+#include <iostream>
+
+namespace usb_camera {
+
+// Scale the first two rows of a 3xN projection, keeping pixel centers aligned.
+static cv::Mat scaleProjection(const cv::Mat& M, double scale)
+{
+    cv::Mat S = cv::Mat::eye(3, 3, CV_64F);
+    S.at<double>(0, 0) = scale;
+    S.at<double>(1, 1) = scale;
+    S.at<double>(0, 2) = 0.5 * scale - 0.5;
+    S.at<double>(1, 2) = 0.5 * scale - 0.5;
+    return S * M;
+}
+
+bool StereoCameraModel::load(const std::string& path)
+{
+    // read parameter
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "ERROR: Can't open " << path << std::endl;
+        return false;
+    }
+    fs["imageWidth"] >> imageSize.width;
+    fs["imageHeight"] >> imageSize.height;
+    fs["cameraMatrix1"] >> cameraMatrix[0];
+    fs["cameraMatrix2"] >> cameraMatrix[1];
+    fs["distCoeffs1"] >> distCoeffs[0];
+    fs["distCoeffs2"] >> distCoeffs[1];
+    fs["R1"] >> R[0];
+    fs["R2"] >> R[1];
+    fs["P1"] >> P[0];
+    fs["P2"] >> P[1];
+    fs["Q"] >> Q;
+    fs.release();
+
+    if (empty() || P[0].empty() || P[1].empty()) {
+        std::cerr << "ERROR: " << path << " is not a stereo calibration" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+StereoCameraModel StereoCameraModel::scaled(double scale) const
+{
+    StereoCameraModel m;
+    m.imageSize = cv::Size(cvRound(imageSize.width * scale), cvRound(imageSize.height * scale));
+    for (int k = 0; k < 2; k++) {
+        m.cameraMatrix[k] = scaleProjection(cameraMatrix[k], scale);
+        m.distCoeffs[k] = distCoeffs[k].clone();
+        m.R[k] = R[k].clone();
+        m.P[k] = scaleProjection(P[k], scale);
+    }
+    if (!Q.empty()) {
+        // [X Y Z W] = Q [x y d 1], map scaled x, y, d back to the calibrated
+        // ones with the same pixel center convention as scaleProjection
+        cv::Mat S = cv::Mat::eye(4, 4, CV_64F);
+        S.at<double>(0, 0) = S.at<double>(1, 1) = S.at<double>(2, 2) = 1.0 / scale;
+        S.at<double>(0, 3) = S.at<double>(1, 3) = 0.5 / scale - 0.5;
+        m.Q = Q * S;
+    }
+    return m;
+}
+
+StereoCameraModel StereoCameraModel::rectifiedView(double scale, const cv::Rect& roi) const
+{
+    StereoCameraModel m = scaled(scale);
+    if (roi.area() == 0) {
+        return m;
+    }
+    // move the origin to the top-left corner of the crop
+    cv::Mat T = cv::Mat::eye(3, 3, CV_64F);
+    T.at<double>(0, 2) = -roi.x;
+    T.at<double>(1, 2) = -roi.y;
+    for (int k = 0; k < 2; k++) {
+        m.cameraMatrix[k] = T * m.cameraMatrix[k];
+        m.P[k] = T * m.P[k];
+    }
+    if (!m.Q.empty()) {
+        cv::Mat S = cv::Mat::eye(4, 4, CV_64F);
+        S.at<double>(0, 3) = roi.x;
+        S.at<double>(1, 3) = roi.y;
+        m.Q = m.Q * S;
+    }
+    m.imageSize = roi.size();
+    return m;
+}
+
+void StereoCameraModel::toCameraInfo(int eye, sensor_msgs::CameraInfo& info) const
+{
+    const cv::Mat& K = cameraMatrix[eye];
+    const cv::Mat& D = distCoeffs[eye];
+    const cv::Mat& R = this->R[eye];
+    const cv::Mat& P = this->P[eye];
+    info.width = imageSize.width;
+    info.height = imageSize.height;
+    info.distortion_model = "plumb_bob";
+    info.K = { K.at<double>(0,0), K.at<double>(0,1), K.at<double>(0,2),
+               K.at<double>(1,0), K.at<double>(1,1), K.at<double>(1,2),
+               K.at<double>(2,0), K.at<double>(2,1), K.at<double>(2,2)};
+    info.D = { D.at<double>(0,0),
+               D.at<double>(1,0),
+               D.at<double>(2,0),
+               D.at<double>(3,0),
+               D.at<double>(4,0)};
+    info.R = { R.at<double>(0,0), R.at<double>(0,1), R.at<double>(0,2),
+               R.at<double>(1,0), R.at<double>(1,1), R.at<double>(1,2),
+               R.at<double>(2,0), R.at<double>(2,1), R.at<double>(2,2)};
+    info.P = { P.at<double>(0,0), P.at<double>(0,1), P.at<double>(0,2), P.at<double>(0,3),
+               P.at<double>(1,0), P.at<double>(1,1), P.at<double>(1,2), P.at<double>(1,3),
+               P.at<double>(2,0), P.at<double>(2,1), P.at<double>(2,2), P.at<double>(2,3)};
+}
+
+void StereoCameraModel::rectifyMaps(const StereoCameraModel& output, cv::Mat map1[2], cv::Mat map2[2]) const
+{
+    for (int k = 0; k < 2; k++) {
+        cv::initUndistortRectifyMap(cameraMatrix[k], distCoeffs[k], R[k], output.P[k], output.imageSize, CV_16SC2,
+                                    map1[k], map2[k]);
+    }
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,42 @@
+#include "usb_camera/capture_device.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace usb_camera {
+
+bool convertToBgr(const CapturedFrame& frame, cv::Mat& bgr)
+{
+    if (frame.data.empty()) {
+        return false;
+    }
+    if (frame.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        cv::cvtColor(frame.data, bgr, cv::COLOR_YUV2BGR_YUYV);
+    } else if (frame.fourcc == fourcc('B', 'G', 'R', '3')) {
+        bgr = frame.data;
+    } else if (frame.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        cv::cvtColor(frame.data, bgr, cv::COLOR_GRAY2BGR);
+    } else {
+        cv::imdecode(frame.data, cv::IMREAD_COLOR, &bgr);
+    }
+    return !bgr.empty();
+}
+
+bool convertToGray(const CapturedFrame& frame, cv::Mat& gray)
+{
+    if (frame.data.empty()) {
+        return false;
+    }
+    if (frame.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        cv::extractChannel(frame.data, gray, 0);
+    } else if (frame.fourcc == fourcc('B', 'G', 'R', '3')) {
+        cv::cvtColor(frame.data, gray, cv::COLOR_BGR2GRAY);
+    } else if (frame.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        gray = frame.data;
+    } else {
+        cv::imdecode(frame.data, cv::IMREAD_GRAYSCALE, &gray);
+    }
+    return !gray.empty();
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,147 @@
+#include "usb_camera/chessboard_detector.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "usb_camera/corner_cache.h"
+#include "usb_camera/parallel.h"
+
+namespace usb_camera {
+
+static const cv::TermCriteria kSubPixCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.1);
+
+static int pyramidLevels(const cv::Mat& gray, const ChessboardOptions& options)
+{
+    if (options.pyramidLevels >= 0) {
+        return options.pyramidLevels;
+    }
+    int levels = 0;
+    while ((gray.cols >> (levels + 1)) >= ChessboardOptions::kPyramidMinWidth) {
+        levels++;
+    }
+    return levels;
+}
+
+bool detectChessboard(const cv::Mat& gray, const ChessboardOptions& options, std::vector<cv::Point2f>& corners)
+{
+    corners.clear();
+    const int levels = pyramidLevels(gray, options);
+    if (levels == 0) {
+        if (!cv::findChessboardCorners(gray, options.boardSize, corners, options.flags)) {
+            return false;
+        }
+        cv::cornerSubPix(gray, corners, options.subPixWindow, cv::Size(-1, -1), kSubPixCriteria);
+        return true;
+    }
+
+    cv::Mat small = gray;
+    for (int l = 0; l < levels; l++) {
+        cv::pyrDown(small, small);
+    }
+    const int flags = options.flags | cv::CALIB_CB_FAST_CHECK;
+    if (cv::findChessboardCorners(small, options.boardSize, corners, flags)) {
+        // pyrDown keeps pixel x of a level at 2x of the level below
+        const float scale = (float)(1 << levels);
+        for (size_t i = 0; i < corners.size(); i++) {
+            corners[i] *= scale;
+        }
+        // a corner found on level L is off by up to about 2^L pixels here,
+        // pull it in with a matching window before the regular refinement
+        const cv::Size coarse(std::max(options.subPixWindow.width, 1 << (levels + 1)),
+                              std::max(options.subPixWindow.height, 1 << (levels + 1)));
+        cv::cornerSubPix(gray, corners, coarse, cv::Size(-1, -1), kSubPixCriteria);
+    } else if (!cv::findChessboardCorners(gray, options.boardSize, corners, flags)) {
+        return false;
+    }
+    cv::cornerSubPix(gray, corners, options.subPixWindow, cv::Size(-1, -1), kSubPixCriteria);
+    return true;
+}
+
+double boardSharpness(const cv::Mat& gray, const std::vector<cv::Point2f>& corners)
+{
+    const cv::Rect box = cv::boundingRect(corners) & cv::Rect(0, 0, gray.cols, gray.rows);
+    if (box.area() == 0) {
+        return 0;
+    }
+    cv::Mat lap;
+    cv::Laplacian(gray(box), lap, CV_32F);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(lap, mean, stddev);
+    return stddev[0] * stddev[0];
+}
+
+CornerDetection detectChessboard(const std::string& path, const ChessboardOptions& options)
+{
+    CornerDetection d;
+    cv::Mat gray = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (gray.empty()) {
+        return d;
+    }
+    d.loaded = true;
+    d.imageSize = gray.size();
+    d.found = detectChessboard(gray, options, d.corners);
+    if (d.found) {
+        d.sharpness = boardSharpness(gray, d.corners);
+    }
+    return d;
+}
+
+namespace {
+
+// Hash the file, take the cached detection if there is one, else decode
+// the bytes already read and detect.
+CornerDetection detectCached(const std::string& path, const ChessboardOptions& options, const CornerCache& cache)
+{
+    CornerDetection d;
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::vector<uchar> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        return d;
+    }
+    const uint64_t hash = contentHash(data);
+    if (cache.find(hash, options, d)) {
+        d.hash = hash;
+        d.cached = true;
+        return d;
+    }
+    cv::Mat gray = cv::imdecode(data, cv::IMREAD_GRAYSCALE);
+    if (gray.empty()) {
+        return d;
+    }
+    d.loaded = true;
+    d.imageSize = gray.size();
+    d.found = detectChessboard(gray, options, d.corners);
+    if (d.found) {
+        d.sharpness = boardSharpness(gray, d.corners);
+    }
+    d.hash = hash;
+    return d;
+}
+
+}  // namespace
+
+std::vector<CornerDetection> detectChessboards(const std::vector<std::string>& files, const ChessboardOptions& options,
+                                               CornerCache* cache)
+{
+    std::vector<CornerDetection> results(files.size());
+    // one stripe per image, detection time varies a lot between images
+    // every index writes its own slot and the cache is only read here, no
+    // locking needed
+    parallelFor(cv::Range(0, (int)files.size()), [&](int i) {
+        results[i] = cache ? detectCached(files[i], options, *cache) : detectChessboard(files[i], options);
+    }, (double)files.size());
+    if (cache) {
+        for (size_t i = 0; i < results.size(); i++) {
+            if (!results[i].cached) {
+                cache->insert(results[i].hash, options, results[i]);
+            }
+        }
+    }
+    return results;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,103 @@
+#include "usb_camera/clock_mapper.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#include <time.h>
+
+namespace usb_camera {
+
+int64_t monotonicNow()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+ClockMapper::ClockMapper(size_t window, double samplePeriod)
+    : m_window(window < 1 ? 1 : window),
+      m_samplePeriod_ns((int64_t)(samplePeriod * 1e9)),
+      m_t0(0),
+      m_offset(0.0),
+      m_slope(0.0)
+{
+}
+
+void ClockMapper::update()
+{
+    int64_t now = monotonicNow();
+    if (!m_samples.empty() && now - m_samples.back().monotonic_ns < m_samplePeriod_ns) {
+        return;
+    }
+
+    // a preempted read shows up as a wide bracket, keep the tightest one
+    int64_t bestWidth = INT64_MAX, bestMono = 0, bestRos = 0;
+    for (int i = 0; i < 3; i++) {
+        int64_t before = monotonicNow();
+        int64_t ros = (int64_t)ros::Time::now().toNSec();
+        int64_t after = monotonicNow();
+        if (after - before < bestWidth) {
+            bestWidth = after - before;
+            bestMono = before + (after - before) / 2;
+            bestRos = ros;
+        }
+    }
+    addSample(bestMono, bestRos);
+}
+
+void ClockMapper::addSample(int64_t monotonic_ns, int64_t ros_ns)
+{
+    Sample s;
+    s.monotonic_ns = monotonic_ns;
+    s.offset_ns = ros_ns - monotonic_ns;
+    if (!m_samples.empty() && std::llabs(s.offset_ns - m_samples.back().offset_ns) > 1000000000LL) {
+        // the ROS clock jumped (settimeofday, sim time restart), start over
+        m_samples.clear();
+    }
+    m_samples.push_back(s);
+    while (m_samples.size() > m_window) {
+        m_samples.pop_front();
+    }
+    fit();
+}
+
+void ClockMapper::fit()
+{
+    // least squares in seconds relative to the newest sample, offsets
+    // relative to its offset, to keep the sums well conditioned
+    const Sample& last = m_samples.back();
+    m_t0 = last.monotonic_ns;
+    const double n = (double)m_samples.size();
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < m_samples.size(); i++) {
+        double x = (m_samples[i].monotonic_ns - m_t0) * 1e-9;
+        double y = (double)(m_samples[i].offset_ns - last.offset_ns);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    const double det = n * sxx - sx * sx;
+    if (m_samples.size() < 3 || det < 1e-9) {
+        m_slope = 0.0;
+        m_offset = (double)last.offset_ns;
+        return;
+    }
+    const double slope = (n * sxy - sx * sy) / det;    // ns per second
+    m_offset = last.offset_ns + (sy - slope * sx) / n;
+    m_slope = slope * 1e-9;
+}
+
+int64_t ClockMapper::toRosNs(int64_t monotonic_ns) const
+{
+    return monotonic_ns + (int64_t)std::llround(m_offset + m_slope * (double)(monotonic_ns - m_t0));
+}
+
+ros::Time ClockMapper::toRos(int64_t monotonic_ns) const
+{
+    ros::Time t;
+    t.fromNSec((uint64_t)toRosNs(monotonic_ns));
+    return t;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,26 @@
+#include "usb_camera/content_hash.h"
+
+namespace usb_camera {
+
+uint64_t contentHash(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t contentHash(const std::vector<unsigned char>& data)
+{
+    return contentHash(data.data(), data.size());
+}
+
+uint64_t contentHash(const std::string& data)
+{
+    return contentHash(data.data(), data.size());
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,111 @@
+#include "usb_camera/corner_cache.h"
+
+#include <cstdio>
+#include <iostream>
+
+#include <unistd.h>
+
+namespace usb_camera {
+
+std::string CornerCache::key(uint64_t hash, const ChessboardOptions& options)
+{
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%016llx_%dx%d_%d_%dx%d_%d", (unsigned long long)hash,
+             options.boardSize.width, options.boardSize.height, options.flags,
+             options.subPixWindow.width, options.subPixWindow.height, options.pyramidLevels);
+    return buf;
+}
+
+bool CornerCache::load(const std::string& path)
+{
+    m_entries.clear();
+    m_modified = false;
+    if (access(path.c_str(), R_OK) != 0) {
+        return true;
+    }
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        std::cerr << "WARNING: Can't read corner cache " << path << std::endl;
+        return false;
+    }
+    cv::FileNode entries = fs["detections"];
+    for (cv::FileNodeIterator it = entries.begin(); it != entries.end(); ++it) {
+        const cv::FileNode& n = *it;
+        CornerDetection d;
+        std::string k;
+        int found = 0;
+        cv::Mat corners;
+        n["key"] >> k;
+        n["found"] >> found;
+        n["width"] >> d.imageSize.width;
+        n["height"] >> d.imageSize.height;
+        n["corners"] >> corners;
+        if (!n["sharpness"].empty()) {
+            n["sharpness"] >> d.sharpness;
+        }
+        if (k.empty()) {
+            continue;
+        }
+        d.loaded = true;
+        d.found = found != 0;
+        if (!corners.empty()) {
+            d.corners.assign(corners.ptr<cv::Point2f>(), corners.ptr<cv::Point2f>() + corners.total());
+        }
+        m_entries[k] = d;
+    }
+    return true;
+}
+
+bool CornerCache::save(const std::string& path) const
+{
+    // write next to the target and rename, an interrupted run keeps the old cache
+    const std::string tmp = path + ".tmp.yml";
+    {
+        cv::FileStorage fs(tmp, cv::FileStorage::WRITE);
+        if (!fs.isOpened()) {
+            std::cerr << "WARNING: Can't write corner cache " << tmp << std::endl;
+            return false;
+        }
+        fs << "detections" << "[";
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            const CornerDetection& d = it->second;
+            fs << "{";
+            fs << "key" << it->first;
+            fs << "found" << (int)d.found;
+            fs << "width" << d.imageSize.width;
+            fs << "height" << d.imageSize.height;
+            if (!d.corners.empty()) {
+                fs << "corners" << cv::Mat(d.corners);
+                fs << "sharpness" << d.sharpness;
+            }
+            fs << "}";
+        }
+        fs << "]";
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "WARNING: Can't replace corner cache " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CornerCache::find(uint64_t hash, const ChessboardOptions& options, CornerDetection& detection) const
+{
+    auto it = m_entries.find(key(hash, options));
+    if (it == m_entries.end()) {
+        return false;
+    }
+    detection = it->second;
+    return true;
+}
+
+void CornerCache::insert(uint64_t hash, const ChessboardOptions& options, const CornerDetection& detection)
+{
+    if (!detection.loaded) {
+        return;
+    }
+    m_entries[key(hash, options)] = detection;
+    m_modified = true;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,89 @@
+#include "usb_camera/disparity_estimator.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+
+#include "usb_camera/parallel.h"
+
+namespace usb_camera {
+
+DisparityEstimator::DisparityEstimator(const DisparityOptions& options)
+    : m_options(options)
+{
+    m_options.numDisparities = std::max(16, (m_options.numDisparities + 15) / 16 * 16);
+    m_options.blockSize = std::max(m_options.sgbm ? 1 : 5, m_options.blockSize | 1);
+    m_options.downscale = std::max(m_options.downscale, 1);
+}
+
+cv::Ptr<cv::StereoMatcher> DisparityEstimator::createMatcher() const
+{
+    const DisparityOptions& o = m_options;
+    if (!o.sgbm) {
+        cv::Ptr<cv::StereoBM> bm = cv::StereoBM::create(o.numDisparities, o.blockSize);
+        bm->setMinDisparity(o.minDisparity);
+        bm->setUniquenessRatio(o.uniquenessRatio);
+        bm->setSpeckleWindowSize(o.speckleWindowSize);
+        bm->setSpeckleRange(o.speckleRange);
+        return bm;
+    }
+    // P1/P2 as suggested in the OpenCV docs for one channel
+    const int area = o.blockSize * o.blockSize;
+    return cv::StereoSGBM::create(o.minDisparity, o.numDisparities, o.blockSize, 8 * area, 32 * area, 1,
+                                  0, o.uniquenessRatio, o.speckleWindowSize, o.speckleRange);
+}
+
+cv::Rect DisparityEstimator::matchedRoi(cv::Size rectSize) const
+{
+    const int s = m_options.downscale;
+    cv::Rect roi = m_options.roi & cv::Rect(cv::Point(), rectSize);
+    if (roi.area() == 0) {
+        roi = cv::Rect(cv::Point(), rectSize);
+    }
+    // whole pixels after the shrink, so the scaled model describes it exactly
+    const int x = (roi.x + s - 1) / s * s;
+    const int y = (roi.y + s - 1) / s * s;
+    return cv::Rect(x, y, (roi.x + roi.width - x) / s * s, (roi.y + roi.height - y) / s * s);
+}
+
+void DisparityEstimator::compute(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparity)
+{
+    const cv::Rect roi = matchedRoi(left.size());
+    const int s = m_options.downscale;
+    const cv::Mat src[2] = { left, right };
+    for (int k = 0; k < 2; k++) {
+        cv::Mat gray = src[k](roi);
+        if (gray.channels() == 3) {
+            cv::cvtColor(gray, m_gray[k], cv::COLOR_BGR2GRAY);
+            gray = m_gray[k];
+        }
+        if (s > 1) {
+            cv::resize(gray, m_input[k], cv::Size(roi.width / s, roi.height / s), 0, 0, cv::INTER_AREA);
+        } else {
+            m_input[k] = gray;
+        }
+    }
+
+    const int rows = m_input[0].rows;
+    const int margin = kOverlap + m_options.blockSize / 2;
+    // strips much thinner than their context only add overhead
+    int strips = m_options.strips > 0 ? m_options.strips : cv::getNumThreads();
+    strips = std::max(1, std::min(strips, rows / (2 * margin)));
+    while ((int)m_matchers.size() < strips) {
+        m_matchers.push_back(createMatcher());
+    }
+    m_stripDisparity.resize(strips);
+    m_fixed.create(m_input[0].size(), CV_16S);
+
+    parallelFor(cv::Range(0, strips), [&](int i) {
+        const int y0 = rows * i / strips, y1 = rows * (i + 1) / strips;
+        const int a = std::max(0, y0 - margin), b = std::min(rows, y1 + margin);
+        m_matchers[i]->compute(m_input[0].rowRange(a, b), m_input[1].rowRange(a, b), m_stripDisparity[i]);
+        m_stripDisparity[i].rowRange(y0 - a, y1 - a).copyTo(m_fixed.rowRange(y0, y1));
+    }, strips);
+
+    disparity.create(m_fixed.size(), CV_32F);
+    m_fixed.convertTo(disparity, CV_32F, 1.0 / 16);
+}
+
+}  // namespace usb_camera
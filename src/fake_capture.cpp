@@ -0,0 +1,163 @@
+#include "usb_camera/fake_capture.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+#include <sys/stat.h>
+
+namespace usb_camera {
+
+static bool readFile(const std::string& path, std::vector<uchar>& data)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !data.empty();
+}
+
+FakeCapture::FakeCapture(int bufferCount)
+    : m_requestedBuffers(bufferCount < 2 ? 2 : bufferCount),
+      m_next(0),
+      m_sequence(0)
+{
+}
+
+bool FakeCapture::open(const std::string& deviceName, const CaptureFormat& format)
+{
+    close();
+
+    std::vector<cv::String> files;
+    struct stat st;
+    if (stat(deviceName.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        cv::glob(deviceName + "/*", files);
+    } else {
+        files.push_back(deviceName);
+    }
+
+    size_t rawSize = 0;
+    if (format.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        rawSize = (size_t)format.width * format.height * 2;
+    } else if (format.fourcc == fourcc('B', 'G', 'R', '3')) {
+        rawSize = (size_t)format.width * format.height * 3;
+    } else if (format.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        rawSize = (size_t)format.width * format.height;
+    }
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::vector<uchar> data;
+        if (!readFile(files[i], data)) {
+            continue;
+        }
+        if (rawSize && data.size() != rawSize) {
+            std::cerr << "WARNING: Skip " << files[i] << ", expected " << rawSize << " bytes" << std::endl;
+            continue;
+        }
+        capacity = std::max(capacity, data.size());
+        m_frames.push_back(std::move(data));
+    }
+    if (m_frames.empty()) {
+        std::cerr << "ERROR: No frames found in " << deviceName << std::endl;
+        return false;
+    }
+
+    m_format = format;
+    m_buffers.resize(m_requestedBuffers);
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        m_buffers[i].storage.resize(capacity);
+        m_buffers[i].queued = true;
+    }
+    m_next = 0;
+    m_sequence = 0;
+    m_deadline = std::chrono::steady_clock::now();
+    return true;
+}
+
+void FakeCapture::close()
+{
+    m_frames.clear();
+    m_buffers.clear();
+}
+
+bool FakeCapture::dequeue(CapturedFrame& frame, int timeout_ms)
+{
+    if (m_frames.empty()) {
+        return false;
+    }
+
+    int index = -1;
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        for (size_t i = 0; i < m_buffers.size(); i++) {
+            if (m_buffers[i].queued) {
+                index = (int)i;
+                break;
+            }
+        }
+    }
+    if (index < 0) {
+        // every buffer is held by the caller, a real driver would stall too
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (m_deadline - now > std::chrono::milliseconds(timeout_ms)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return false;
+    }
+    std::this_thread::sleep_until(m_deadline);
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / (m_format.fps > 0 ? m_format.fps : 30.0)));
+    m_deadline = std::max(m_deadline + period, now);
+
+    // "DMA" the next frame into the free buffer
+    const std::vector<uchar>& src = m_frames[m_next];
+    m_next = (m_next + 1) % m_frames.size();
+    Buffer& b = m_buffers[index];
+    std::copy(src.begin(), src.end(), b.storage.begin());
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        b.queued = false;
+    }
+
+    frame.index = index;
+    frame.fourcc = m_format.fourcc;
+    frame.bytesused = src.size();
+    frame.sequence = m_sequence++;
+    frame.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    frame.dmabuf_fd = -1;
+
+    uchar* ptr = b.storage.data();
+    if (m_format.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC2, ptr);
+    } else if (m_format.fourcc == fourcc('B', 'G', 'R', '3')) {
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC3, ptr);
+    } else if (m_format.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC1, ptr);
+    } else {
+        frame.data = cv::Mat(1, (int)src.size(), CV_8UC1, ptr);
+    }
+    return true;
+}
+
+void FakeCapture::release(CapturedFrame& frame)
+{
+    if (frame.index < 0 || frame.index >= (int)m_buffers.size()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        m_buffers[frame.index].queued = true;
+    }
+    frame.data.release();
+    frame.index = -1;
+}
+
+}  // namespace usb_camera
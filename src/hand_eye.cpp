@@ -0,0 +1,402 @@
+#include "usb_camera/hand_eye.h"
+
+#include <opencv2/calib3d.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "usb_camera/parallel.h"
+
+namespace usb_camera {
+
+namespace {
+
+std::string trim(const std::string& s)
+{
+    const size_t a = s.find_first_not_of(" \t\r");
+    if (a == std::string::npos) {
+        return std::string();
+    }
+    return s.substr(a, s.find_last_not_of(" \t\r") - a + 1);
+}
+
+struct Method {
+    const char* name;
+    int id;
+};
+
+std::vector<Method> methods()
+{
+    std::vector<Method> m;
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 1)
+    m.push_back({ "TSAI", cv::CALIB_HAND_EYE_TSAI });
+    m.push_back({ "PARK", cv::CALIB_HAND_EYE_PARK });
+    m.push_back({ "HORAUD", cv::CALIB_HAND_EYE_HORAUD });
+    m.push_back({ "ANDREFF", cv::CALIB_HAND_EYE_ANDREFF });
+    m.push_back({ "DANIILIDIS", cv::CALIB_HAND_EYE_DANIILIDIS });
+#endif
+    return m;
+}
+
+cv::Matx44d compose(const cv::Matx33d& R, const cv::Vec3d& t)
+{
+    cv::Matx44d T = cv::Matx44d::eye();
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            T(r, c) = R(r, c);
+        }
+        T(r, 3) = t[r];
+    }
+    return T;
+}
+
+cv::Matx33d rotation(const cv::Matx44d& T)
+{
+    return cv::Matx33d(T(0, 0), T(0, 1), T(0, 2), T(1, 0), T(1, 1), T(1, 2), T(2, 0), T(2, 1), T(2, 2));
+}
+
+cv::Vec3d translation(const cv::Matx44d& T)
+{
+    return cv::Vec3d(T(0, 3), T(1, 3), T(2, 3));
+}
+
+cv::Matx44d inverse(const cv::Matx44d& T)
+{
+    const cv::Matx33d Rt = rotation(T).t();
+    return compose(Rt, -(Rt * translation(T)));
+}
+
+// Nearest rotation in the Frobenius sense.
+cv::Matx33d projectToRotation(const cv::Matx33d& M)
+{
+    cv::Mat w, u, vt;
+    cv::SVD::compute(cv::Mat(M), w, u, vt);
+    cv::Mat R = u * vt;
+    if (cv::determinant(R) < 0) {
+        u.col(2) *= -1;
+        R = u * vt;
+    }
+    return cv::Matx33d(R);
+}
+
+double angleDeg(const cv::Matx33d& R)
+{
+    const double c = std::max(-1.0, std::min(1.0, (cv::trace(R) - 1) * 0.5));
+    return std::acos(c) * 180.0 / CV_PI;
+}
+
+double median(std::vector<double>& v)
+{
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+// Samples in the form calibrateHandEye takes them, A = the robot side
+// (inverted for a fixed camera), B = the target in the camera.
+class Problem {
+public:
+    Problem(const std::vector<HandEyeSample>& samples, const HandEyeOptions& options)
+        : m_options(options)
+    {
+        for (size_t i = 0; i < samples.size(); i++) {
+            m_A.push_back(options.eyeInHand ? samples[i].effectorWrtWorld : inverse(samples[i].effectorWrtWorld));
+            m_B.push_back(samples[i].objectWrtSensor);
+        }
+    }
+
+    size_t size() const { return m_A.size(); }
+
+    bool solve(const std::vector<int>& indices, int method, cv::Matx44d& X) const
+    {
+        std::vector<cv::Mat> RA, tA, RB, tB;
+        for (size_t k = 0; k < indices.size(); k++) {
+            const int i = indices[k];
+            RA.push_back(cv::Mat(rotation(m_A[i])));
+            tA.push_back(cv::Mat(translation(m_A[i])));
+            RB.push_back(cv::Mat(rotation(m_B[i])));
+            tB.push_back(cv::Mat(translation(m_B[i])));
+        }
+        cv::Mat R, t;
+        try {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 1)
+            cv::calibrateHandEye(RA, tA, RB, tB, R, t, (cv::HandEyeCalibrationMethod)method);
+#else
+            (void)method;
+            return false;
+#endif
+        } catch (const cv::Exception&) {
+            // degenerate set, e.g. parallel rotation axes
+            return false;
+        }
+        if (R.empty() || t.empty() || !cv::checkRange(R) || !cv::checkRange(t)) {
+            return false;
+        }
+        X = compose(cv::Matx33d(R), cv::Vec3d(t));
+        return true;
+    }
+
+    // Per sample distance of the fixed target pose A X B from the median.
+    void errors(const cv::Matx44d& X, std::vector<double>& translationErr, std::vector<double>& rotationErrDeg) const
+    {
+        const size_t n = size();
+        std::vector<cv::Matx44d> C(n);
+        for (size_t i = 0; i < n; i++) {
+            C[i] = m_A[i] * X * m_B[i];
+        }
+        cv::Vec3d tc;
+        cv::Matx33d Rc;
+        std::vector<double> v(n);
+        for (int r = 0; r < 3; r++) {
+            for (size_t i = 0; i < n; i++) {
+                v[i] = C[i](r, 3);
+            }
+            tc[r] = median(v);
+            for (int c = 0; c < 3; c++) {
+                for (size_t i = 0; i < n; i++) {
+                    v[i] = C[i](r, c);
+                }
+                Rc(r, c) = median(v);
+            }
+        }
+        Rc = projectToRotation(Rc);
+        translationErr.resize(n);
+        rotationErrDeg.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            translationErr[i] = cv::norm(translation(C[i]) - tc);
+            rotationErrDeg[i] = angleDeg(Rc.t() * rotation(C[i]));
+        }
+    }
+
+    bool inlier(double translationErr, double rotationErrDeg) const
+    {
+        return translationErr <= m_options.maxTranslation && rotationErrDeg <= m_options.maxRotationDeg;
+    }
+
+    // Errors relative to the thresholds, so meters and degrees add up.
+    double cost(double translationErr, double rotationErrDeg) const
+    {
+        return translationErr / m_options.maxTranslation + rotationErrDeg / m_options.maxRotationDeg;
+    }
+
+private:
+    HandEyeOptions m_options;
+    std::vector<cv::Matx44d> m_A;
+    std::vector<cv::Matx44d> m_B;
+};
+
+struct Hypothesis {
+    bool ok = false;
+    int inliers = 0;
+    double cost = 0;
+};
+
+}  // namespace
+
+bool readHandEyeSamples(const std::string& path, std::vector<HandEyeSample>& samples)
+{
+    std::ifstream in(path.c_str());
+    if (!in) {
+        std::cerr << "ERROR: Can't open " << path << std::endl;
+        return false;
+    }
+    std::vector<double> values[2];
+    int current = -1;
+    int lineNo = 0;
+    auto flush = [&]() {
+        if (values[0].empty() && values[1].empty()) {
+            return true;
+        }
+        if (values[0].size() != 16 || values[1].size() != 16) {
+            std::cerr << "ERROR: " << path << ":" << lineNo << ": a sample needs 16 values per pose" << std::endl;
+            return false;
+        }
+        HandEyeSample s;
+        std::copy(values[0].begin(), values[0].end(), s.effectorWrtWorld.val);
+        std::copy(values[1].begin(), values[1].end(), s.objectWrtSensor.val);
+        samples.push_back(s);
+        values[0].clear();
+        values[1].clear();
+        return true;
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        lineNo++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        const bool item = line.compare(0, 2, "- ") == 0;
+        const std::string body = item ? trim(line.substr(2)) : line;
+        if (body.back() == ':') {
+            // "- key:" opens the next sample
+            if (item && !flush()) {
+                return false;
+            }
+            const std::string key = body.substr(0, body.size() - 1);
+            current = key == "effector_wrt_world" ? 0 : key == "object_wrt_sensor" ? 1 : -1;
+            if (current < 0) {
+                std::cerr << "ERROR: " << path << ":" << lineNo << ": unknown key " << key << std::endl;
+                return false;
+            }
+            continue;
+        }
+        char* end = nullptr;
+        const double v = strtod(body.c_str(), &end);
+        if (!item || current < 0 || end == body.c_str() || *end != '\0') {
+            std::cerr << "ERROR: " << path << ":" << lineNo << ": expected a pose value, got " << line << std::endl;
+            return false;
+        }
+        values[current].push_back(v);
+    }
+    return flush();
+}
+
+bool solveHandEye(const std::vector<HandEyeSample>& samples, const HandEyeOptions& options,
+                  std::vector<HandEyeResult>& results, std::vector<bool>& consensus)
+{
+    results.clear();
+    consensus.clear();
+    const std::vector<Method> all = methods();
+    if (all.empty()) {
+        std::cerr << "ERROR: cv::calibrateHandEye needs OpenCV 4.1 or newer" << std::endl;
+        return false;
+    }
+    const int n = (int)samples.size();
+    const int k = std::max(options.sampleSize, 3);
+    if (n < k) {
+        std::cerr << "ERROR: " << n << " samples, at least " << k << " are needed" << std::endl;
+        return false;
+    }
+    const Problem problem(samples, options);
+
+    // RANSAC: every hypothesis draws from its own seeded generator, so the
+    // result doesn't depend on how the pool schedules them
+    const int iterations = std::max(options.iterations, 1);
+    std::vector<Hypothesis> hypotheses(iterations);
+    std::vector<cv::Matx44d> candidates(iterations);
+    parallelFor(cv::Range(0, iterations), [&](int h) {
+        cv::RNG rng(options.seed * 0x9e3779b97f4a7c15ULL + (uint64_t)h);
+        std::vector<int> set;
+        while ((int)set.size() < k) {
+            const int i = rng.uniform(0, n);
+            if (std::find(set.begin(), set.end(), i) == set.end()) {
+                set.push_back(i);
+            }
+        }
+        Hypothesis& hyp = hypotheses[h];
+        if (!problem.solve(set, all[0].id, candidates[h])) {
+            return;
+        }
+        std::vector<double> et, er;
+        problem.errors(candidates[h], et, er);
+        hyp.ok = true;
+        for (int i = 0; i < n; i++) {
+            if (problem.inlier(et[i], er[i])) {
+                hyp.inliers++;
+                hyp.cost += problem.cost(et[i], er[i]);
+            }
+        }
+    });
+    int best = -1;
+    for (int h = 0; h < iterations; h++) {
+        const Hypothesis& hyp = hypotheses[h];
+        if (hyp.ok && (best < 0 || hyp.inliers > hypotheses[best].inliers ||
+                       (hyp.inliers == hypotheses[best].inliers && hyp.cost < hypotheses[best].cost))) {
+            best = h;
+        }
+    }
+    if (best < 0 || hypotheses[best].inliers < k) {
+        std::cerr << "ERROR: No consistent set of " << k << " samples, check the thresholds" << std::endl;
+        return false;
+    }
+    std::vector<int> inliers;
+    {
+        std::vector<double> et, er;
+        problem.errors(candidates[best], et, er);
+        consensus.assign(n, false);
+        for (int i = 0; i < n; i++) {
+            if (problem.inlier(et[i], er[i])) {
+                consensus[i] = true;
+                inliers.push_back(i);
+            }
+        }
+    }
+
+    // every method on the consensus set
+    results.resize(all.size());
+    parallelFor(cv::Range(0, (int)all.size()), [&](int m) {
+        HandEyeResult& r = results[m];
+        r.method = all[m].name;
+        if (!problem.solve(inliers, all[m].id, r.transform)) {
+            return;
+        }
+        std::vector<double> et, er;
+        problem.errors(r.transform, et, er);
+        double st = 0, sr = 0;
+        for (int i = 0; i < n; i++) {
+            if (problem.inlier(et[i], er[i])) {
+                r.inliers++;
+            }
+            if (consensus[i]) {
+                st += et[i] * et[i];
+                sr += er[i] * er[i];
+            }
+        }
+        r.translationRms = std::sqrt(st / inliers.size());
+        r.rotationRmsDeg = std::sqrt(sr / inliers.size());
+        r.ok = true;
+    });
+    std::stable_sort(results.begin(), results.end(), [&](const HandEyeResult& a, const HandEyeResult& b) {
+        if (a.ok != b.ok) {
+            return a.ok;
+        }
+        return problem.cost(a.translationRms, a.rotationRmsDeg) < problem.cost(b.translationRms, b.rotationRmsDeg);
+    });
+    if (!results[0].ok) {
+        std::cerr << "ERROR: No method solved the consensus set" << std::endl;
+        return false;
+    }
+
+    // bootstrap the winner for its spread
+    HandEyeResult& winner = results[0];
+    int method = all[0].id;
+    for (size_t m = 0; m < all.size(); m++) {
+        if (winner.method == all[m].name) {
+            method = all[m].id;
+        }
+    }
+    const int resamples = std::max(options.bootstrap, 0);
+    std::vector<cv::Matx44d> boot(resamples);
+    std::vector<char> bootOk(resamples, 0);
+    parallelFor(cv::Range(0, resamples), [&](int b) {
+        cv::RNG rng(options.seed * 0xbf58476d1ce4e5b9ULL + (uint64_t)b);
+        std::vector<int> set(inliers.size());
+        for (size_t i = 0; i < set.size(); i++) {
+            set[i] = inliers[rng.uniform(0, (int)inliers.size())];
+        }
+        bootOk[b] = problem.solve(set, method, boot[b]);
+    });
+    double st = 0, sr = 0;
+    int count = 0;
+    for (int b = 0; b < resamples; b++) {
+        if (!bootOk[b]) {
+            continue;
+        }
+        const double dt = cv::norm(translation(boot[b]) - translation(winner.transform));
+        const double dr = angleDeg(rotation(winner.transform).t() * rotation(boot[b]));
+        st += dt * dt;
+        sr += dr * dr;
+        count++;
+    }
+    if (count > 0) {
+        winner.translationStd = std::sqrt(st / count);
+        winner.rotationStdDeg = std::sqrt(sr / count);
+    }
+    return true;
+}
+
+}  // namespace usb_camera
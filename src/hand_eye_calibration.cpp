@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "usb_camera/hand_eye.h"
+
+// Solves calib/m2_hand_eye_samples_*.yaml and writes the winner in the
+// format of launch/camera_pose_*.launch.
+
+namespace {
+
+// URDF rpy (extrinsic XYZ)
+cv::Vec3d rpy(const cv::Matx44d& T)
+{
+    return cv::Vec3d(std::atan2(T(2, 1), T(2, 2)),
+                     std::atan2(-T(2, 0), std::sqrt(T(2, 1) * T(2, 1) + T(2, 2) * T(2, 2))),
+                     std::atan2(T(1, 0), T(0, 0)));
+}
+
+// x, y, z, w
+cv::Vec4d quaternion(const cv::Matx44d& T)
+{
+    const cv::Matx33d R(T(0, 0), T(0, 1), T(0, 2), T(1, 0), T(1, 1), T(1, 2), T(2, 0), T(2, 1), T(2, 2));
+    const double trace = cv::trace(R);
+    cv::Vec4d q;
+    if (trace > 0) {
+        const double s = std::sqrt(trace + 1.0) * 2;
+        q = cv::Vec4d((R(2, 1) - R(1, 2)) / s, (R(0, 2) - R(2, 0)) / s, (R(1, 0) - R(0, 1)) / s, 0.25 * s);
+    } else if (R(0, 0) > R(1, 1) && R(0, 0) > R(2, 2)) {
+        const double s = std::sqrt(1.0 + R(0, 0) - R(1, 1) - R(2, 2)) * 2;
+        q = cv::Vec4d(0.25 * s, (R(0, 1) + R(1, 0)) / s, (R(0, 2) + R(2, 0)) / s, (R(2, 1) - R(1, 2)) / s);
+    } else if (R(1, 1) > R(2, 2)) {
+        const double s = std::sqrt(1.0 + R(1, 1) - R(0, 0) - R(2, 2)) * 2;
+        q = cv::Vec4d((R(0, 1) + R(1, 0)) / s, 0.25 * s, (R(1, 2) + R(2, 1)) / s, (R(0, 2) - R(2, 0)) / s);
+    } else {
+        const double s = std::sqrt(1.0 + R(2, 2) - R(0, 0) - R(1, 1)) * 2;
+        q = cv::Vec4d((R(0, 2) + R(2, 0)) / s, (R(1, 2) + R(2, 1)) / s, 0.25 * s, (R(1, 0) - R(0, 1)) / s);
+    }
+    return q;
+}
+
+void writeLaunch(std::ostream& out, const cv::Matx44d& T, const std::string& parent, const std::string& child)
+{
+    const cv::Vec3d a = rpy(T);
+    const cv::Vec4d q = quaternion(T);
+    out.precision(6);
+    out << "<launch>\n"
+        << "  <!-- The rpy in the comment uses the extrinsic XYZ convention, which is the same as is used in a URDF. See\n"
+        << "       http://wiki.ros.org/geometry2/RotationMethods and https://en.wikipedia.org/wiki/Euler_angles for more info. -->\n"
+        << "  <!-- xyz=\"" << T(0, 3) << " " << T(1, 3) << " " << T(2, 3) << "\" rpy=\"" << a[0] << " " << a[1] << " " << a[2]
+        << "\" -->\n"
+        << "  <node pkg=\"tf2_ros\" type=\"static_transform_publisher\" name=\"camera_link_broadcaster\"\n"
+        << "      args=\"" << T(0, 3) << " " << T(1, 3) << " " << T(2, 3) << "   " << q[0] << " " << q[1] << " " << q[2] << " "
+        << q[3] << " " << parent << " " << child << "\" />\n"
+        << "</launch>\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    usb_camera::HandEyeOptions options;
+    std::string parent = "base_link";
+    std::string child = "camera_left";
+    std::string output;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--eye-in-hand") {
+            options.eyeInHand = true;
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--max-translation" && i + 1 < argc) {
+            options.maxTranslation = atof(argv[++i]);
+        } else if (arg == "--max-rotation" && i + 1 < argc) {
+            options.maxRotationDeg = atof(argv[++i]);
+        } else if (arg == "--bootstrap" && i + 1 < argc) {
+            options.bootstrap = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            cv::setNumThreads(atoi(argv[++i]));
+        } else if (arg == "--parent" && i + 1 < argc) {
+            parent = argv[++i];
+        } else if (arg == "--child" && i + 1 < argc) {
+            child = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg.compare(0, 2, "--") != 0) {
+            files.push_back(arg);
+        } else {
+            files.clear();
+            break;
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--eye-in-hand] [--iterations N] [--max-translation m]"
+                  << " [--max-rotation deg] [--bootstrap N] [--seed N] [--threads N] [--parent base_link]"
+                  << " [--child camera_left] [--output camera_pose.launch] samples.yaml..." << std::endl;
+        return 1;
+    }
+    if (options.maxTranslation <= 0 || options.maxRotationDeg <= 0) {
+        std::cerr << "ERROR: The thresholds must be positive" << std::endl;
+        return 1;
+    }
+
+    std::vector<usb_camera::HandEyeSample> samples;
+    const int64 t0 = cv::getTickCount();
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!usb_camera::readHandEyeSamples(files[i], samples)) {
+            return 1;
+        }
+    }
+    const int64 t1 = cv::getTickCount();
+    std::cerr << samples.size() << " samples read in " << (t1 - t0) * 1000.0 / cv::getTickFrequency() << " ms" << std::endl;
+
+    std::vector<usb_camera::HandEyeResult> results;
+    std::vector<bool> consensus;
+    if (!usb_camera::solveHandEye(samples, options, results, consensus)) {
+        return 1;
+    }
+    const int64 t2 = cv::getTickCount();
+    int inliers = 0;
+    for (size_t i = 0; i < consensus.size(); i++) {
+        inliers += consensus[i] ? 1 : 0;
+    }
+    fprintf(stderr, "%d of %d samples in the consensus set, solved in %.1f ms on %d threads\n", inliers,
+            (int)samples.size(), (t2 - t1) * 1000.0 / cv::getTickFrequency(), cv::getNumThreads());
+    fprintf(stderr, "  %-10s %8s %10s %10s\n", "method", "inliers", "rms [mm]", "rms [deg]");
+    for (size_t i = 0; i < results.size(); i++) {
+        const usb_camera::HandEyeResult& r = results[i];
+        if (r.ok) {
+            fprintf(stderr, "  %-10s %8d %10.3f %10.4f\n", r.method.c_str(), r.inliers, r.translationRms * 1000,
+                    r.rotationRmsDeg);
+        } else {
+            fprintf(stderr, "  %-10s failed\n", r.method.c_str());
+        }
+    }
+    const usb_camera::HandEyeResult& best = results[0];
+    fprintf(stderr, "%s, bootstrap spread %.3f mm %.4f deg\n", best.method.c_str(), best.translationStd * 1000,
+            best.rotationStdDeg);
+
+    if (output.empty()) {
+        writeLaunch(std::cout, best.transform, parent, child);
+        return 0;
+    }
+    std::ofstream out(output.c_str());
+    writeLaunch(out, best.transform, parent, child);
+    if (!out) {
+        std::cerr << "ERROR: Can't write " << output << std::endl;
+        return 1;
+    }
+    std::cerr << "Wrote " << output << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "usb_camera/jpeg_codec.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace usb_camera {
+
+JpegCodec::JpegCodec()
+    : m_decompressor(tjInitDecompress()),
+      m_transformer(tjInitTransform()),
+      m_compressor(tjInitCompress())
+{
+}
+
+JpegCodec::~JpegCodec()
+{
+    if (m_decompressor) {
+        tjDestroy(m_decompressor);
+    }
+    if (m_transformer) {
+        tjDestroy(m_transformer);
+    }
+    if (m_compressor) {
+        tjDestroy(m_compressor);
+    }
+}
+
+bool JpegCodec::validScale(int scaleDenom)
+{
+    return scaleDenom == 1 || scaleDenom == 2 || scaleDenom == 4 || scaleDenom == 8;
+}
+
+bool JpegCodec::parseSubsampling(const std::string& name, int& subsamp)
+{
+    if (name == "444") {
+        subsamp = TJSAMP_444;
+    } else if (name == "422") {
+        subsamp = TJSAMP_422;
+    } else if (name == "420") {
+        subsamp = TJSAMP_420;
+    } else if (name == "gray") {
+        subsamp = TJSAMP_GRAY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool JpegCodec::readHeader(const uchar* data, size_t size, int& width, int& height, int& subsamp)
+{
+    int colorspace;
+    if (tjDecompressHeader3(m_decompressor, data, (unsigned long)size, &width, &height, &subsamp, &colorspace) != 0) {
+        std::cerr << "ERROR: Bad JPEG header: " << tjGetErrorStr() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool JpegCodec::decode(const uchar* data, size_t size, cv::Mat& bgr, int scaleDenom)
+{
+    return decompress(data, size, bgr, scaleDenom, CV_8UC3, TJPF_BGR);
+}
+
+bool JpegCodec::decodeGray(const uchar* data, size_t size, cv::Mat& gray, int scaleDenom)
+{
+    return decompress(data, size, gray, scaleDenom, CV_8UC1, TJPF_GRAY);
+}
+
+bool JpegCodec::decompress(const uchar* data, size_t size, cv::Mat& out, int scaleDenom, int type, int pixelFormat)
+{
+    int width, height, subsamp;
+    if (!validScale(scaleDenom) || !readHeader(data, size, width, height, subsamp)) {
+        return false;
+    }
+    tjscalingfactor factor = { 1, scaleDenom };
+    const int w = TJSCALED(width, factor);
+    const int h = TJSCALED(height, factor);
+    out.create(h, w, type);
+    if (tjDecompress2(m_decompressor, data, (unsigned long)size, out.data, w, (int)out.step, h, pixelFormat, 0) != 0) {
+        std::cerr << "ERROR: JPEG decode failed: " << tjGetErrorStr() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool JpegCodec::splitHalves(const uchar* data, size_t size, std::vector<uchar>& left, std::vector<uchar>& right)
+{
+    int width, height, subsamp;
+    if (!readHeader(data, size, width, height, subsamp)) {
+        return false;
+    }
+    const int half = width / 2;
+    if (half % tjMCUWidth[subsamp] != 0) {
+        return false;
+    }
+
+    tjtransform xf[2];
+    memset(xf, 0, sizeof(xf));
+    for (int k = 0; k < 2; k++) {
+        xf[k].r.x = k * half;
+        xf[k].r.y = 0;
+        xf[k].r.w = half;
+        xf[k].r.h = height;
+        xf[k].op = TJXOP_NONE;
+        xf[k].options = TJXOPT_CROP;
+    }
+
+    // both crops share one entropy decode, output goes to caller buffers
+    const unsigned long capacity = tjBufSize(half, height, subsamp);
+    left.resize(capacity);
+    right.resize(capacity);
+    unsigned char* bufs[2] = { left.data(), right.data() };
+    unsigned long sizes[2] = { capacity, capacity };
+    if (tjTransform(m_transformer, data, (unsigned long)size, 2, bufs, sizes, xf, TJFLAG_NOREALLOC) != 0) {
+        std::cerr << "ERROR: JPEG crop failed: " << tjGetErrorStr() << std::endl;
+        return false;
+    }
+    left.resize(sizes[0]);
+    right.resize(sizes[1]);
+    return true;
+}
+
+bool JpegCodec::encode(const cv::Mat& image, int quality, int subsamp, std::vector<uchar>& out)
+{
+    const bool gray = image.type() == CV_8UC1;
+    if (!gray && image.type() != CV_8UC3) {
+        std::cerr << "ERROR: JPEG encode needs 8 bit BGR or gray" << std::endl;
+        return false;
+    }
+    if (gray) {
+        subsamp = TJSAMP_GRAY;
+    }
+    // worst case size, kept as capacity when `out` is reused
+    const unsigned long capacity = tjBufSize(image.cols, image.rows, subsamp);
+    out.resize(capacity);
+    unsigned char* buf = out.data();
+    unsigned long size = capacity;
+    if (tjCompress2(m_compressor, const_cast<uchar*>(image.data), image.cols, (int)image.step, image.rows,
+                    gray ? TJPF_GRAY : TJPF_BGR, &buf, &size, subsamp, quality, TJFLAG_NOREALLOC) != 0) {
+        std::cerr << "ERROR: JPEG encode failed: " << tjGetErrorStr() << std::endl;
+        return false;
+    }
+    out.resize(size);
+    return true;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,152 @@
+#include "usb_camera/latency_monitor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <diagnostic_msgs/KeyValue.h>
+
+namespace usb_camera {
+
+static const double kHistogramMin = 10e-6;
+
+LatencyHistogram::LatencyHistogram()
+    : m_buckets(kBucketsPerOctave * kOctaves + 1, 0),
+      m_count(0),
+      m_sum(0.0),
+      m_max(0.0)
+{
+}
+
+void LatencyHistogram::add(double seconds)
+{
+    int b = 0;
+    if (seconds > kHistogramMin) {
+        b = (int)std::ceil(std::log2(seconds / kHistogramMin) * kBucketsPerOctave);
+        b = std::min(b, (int)m_buckets.size() - 1);
+    }
+    m_buckets[b]++;
+    m_count++;
+    m_sum += seconds;
+    m_max = std::max(m_max, seconds);
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), 0);
+    m_count = 0;
+    m_sum = 0.0;
+    m_max = 0.0;
+}
+
+double LatencyHistogram::percentile(double q) const
+{
+    if (m_count == 0) {
+        return 0.0;
+    }
+    const size_t rank = (size_t)std::ceil(q * m_count);
+    size_t seen = 0;
+    for (size_t b = 0; b < m_buckets.size(); b++) {
+        seen += m_buckets[b];
+        if (seen >= rank && seen > 0) {
+            return std::min(kHistogramMin * std::exp2((double)b / kBucketsPerOctave), m_max);
+        }
+    }
+    return m_max;
+}
+
+LatencyMonitor::LatencyMonitor()
+    : m_haveSequence(false),
+      m_lastSequence(0),
+      m_frames(0),
+      m_missed(0),
+      m_missedReported(0),
+      m_pipelineDropped(0)
+{
+}
+
+void LatencyMonitor::record(const std::string& name, double seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_histograms[name].add(seconds);
+}
+
+void LatencyMonitor::frameCaptured(uint32_t sequence)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_haveSequence) {
+        // unsigned difference also covers wrap around
+        uint32_t gap = sequence - m_lastSequence;
+        if (gap > 1 && gap < 0x80000000u) {
+            m_missed += gap - 1;
+        }
+    }
+    m_haveSequence = true;
+    m_lastSequence = sequence;
+    m_frames++;
+}
+
+void LatencyMonitor::setPipelineDropped(size_t dropped)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pipelineDropped = dropped;
+}
+
+static void addValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const std::string& value)
+{
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    kv.value = value;
+    status.values.push_back(kv);
+}
+
+static std::string ms(double seconds)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.2f", seconds * 1e3);
+    return buf;
+}
+
+void LatencyMonitor::report(diagnostic_msgs::DiagnosticStatus& status, double period, double maxLatency)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = "OK";
+    status.values.clear();
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", period > 0 ? m_frames / period : 0.0);
+    addValue(status, "fps", buf);
+    addValue(status, "frames missed (sequence)", std::to_string(m_missed));
+    addValue(status, "frames dropped (pipeline)", std::to_string(m_pipelineDropped));
+    for (auto it = m_histograms.begin(); it != m_histograms.end(); ++it) {
+        const LatencyHistogram& h = it->second;
+        if (h.count() == 0) {
+            continue;
+        }
+        // one line per stage: mean / p50 / p90 / p99 / max in ms
+        addValue(status, it->first + " ms (mean p50 p90 p99 max)",
+                 ms(h.mean()) + " " + ms(h.percentile(0.5)) + " " + ms(h.percentile(0.9)) + " " +
+                 ms(h.percentile(0.99)) + " " + ms(h.max()));
+    }
+
+    auto e2e = m_histograms.find("end_to_end");
+    if (m_missed > m_missedReported) {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "Frames missed by the driver";
+    } else if (e2e != m_histograms.end() && e2e->second.count() > 0 && e2e->second.percentile(0.9) > maxLatency) {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "High latency";
+    } else if (m_frames == 0) {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "No frames";
+    }
+
+    for (auto it = m_histograms.begin(); it != m_histograms.end(); ++it) {
+        it->second.clear();
+    }
+    m_frames = 0;
+    m_missedReported = m_missed;
+}
+
+}  // namespace usb_camera
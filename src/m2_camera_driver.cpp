@@ -0,0 +1,1491 @@
+#include "usb_camera/m2_camera_driver.h"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include <ros/package.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/image_encodings.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <stereo_msgs/DisparityImage.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include "usb_camera/content_hash.h"
+#include "usb_camera/parallel.h"
+#include "usb_camera/v4l2_capture.h"
+#include "usb_camera/fake_capture.h"
+#include "usb_camera/replay_capture.h"
+#include "usb_camera/thread_util.h"
+
+namespace usb_camera {
+
+namespace {
+
+std::string defaultMapCacheDir()
+{
+    const char* rosHome = getenv("ROS_HOME");
+    if (rosHome && *rosHome) {
+        return std::string(rosHome) + "/usb_camera";
+    }
+    const char* home = getenv("HOME");
+    return home ? std::string(home) + "/.ros/usb_camera" : std::string();
+}
+
+// mtime and size, (-1, -1) if the file is missing
+std::pair<int64_t, int64_t> fileStamp(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return std::make_pair(-1, -1);
+    }
+    return std::make_pair((int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, (int64_t)st.st_size);
+}
+
+}  // namespace
+
+M2CameraDriver::M2CameraDriver(const ros::NodeHandle& nh, const ros::NodeHandle& pnh)
+    : m_nh(nh),
+      m_pnh(pnh),
+      m_it(nh),
+      m_messagePoolSize(8),
+      m_rectCompressed(false),
+      m_jpegQuality(80),
+      m_deviceName("/dev/video0"),
+      m_bufferCount(4),
+      m_useDmabuf(false),
+      m_mjpegPassthrough(false),
+      m_decodeScale(1),
+      m_monoRect(false),
+      m_rectColorEvery(1),
+      m_colorStages(0),
+      m_colorCount(0),
+      m_publishPoints(false),
+      m_pipelined(false),
+      m_queueSize(2),
+      m_queuePolicy(QueuePolicy::DropOldest),
+      m_workerPool(nullptr),
+      m_poolSource(-1),
+      m_diagnosticPeriod(1.0),
+      m_maxLatency(0.1),
+      m_lastDiagnostics(0),
+      m_lastMasterCheck(0),
+      m_calibrationWatchPeriod(1.0),
+      m_watching(false),
+      m_running(false)
+{
+    // "v4l2": native mmap capture, "opencv": cv::VideoCapture, "fake": frames from a file or directory
+    // in a loop, "replay": a recording or directory played once (see ReplayCapture)
+    m_pnh.param<std::string>("capture_backend", m_captureBackend, "v4l2");
+    m_pnh.param("buffer_count", m_bufferCount, 4);
+    m_pnh.param("use_dmabuf", m_useDmabuf, false);
+    m_pnh.param("mjpeg_passthrough", m_mjpegPassthrough, false);
+    m_pnh.param("decode_scale", m_decodeScale, 1);
+    if (!JpegCodec::validScale(m_decodeScale)) {
+        std::cerr << "WARNING: decode_scale must be 1, 2, 4 or 8, using 1" << std::endl;
+        m_decodeScale = 1;
+    }
+    if (m_captureBackend == "opencv" && (m_mjpegPassthrough || m_decodeScale != 1)) {
+        std::cerr << "WARNING: mjpeg_passthrough and decode_scale need the v4l2 or fake backend" << std::endl;
+        m_mjpegPassthrough = false;
+        m_decodeScale = 1;
+    }
+
+    std::string rectEncoding;
+    m_pnh.param<std::string>("rect_encoding", rectEncoding, "bgr8");
+    m_pnh.param("rect_color_every", m_rectColorEvery, 1);
+    if (rectEncoding != "bgr8" && rectEncoding != "mono8") {
+        std::cerr << "WARNING: rect_encoding must be bgr8 or mono8, using bgr8" << std::endl;
+    }
+    m_monoRect = rectEncoding == "mono8";
+    m_rectColorEvery = std::max(m_rectColorEvery, 0);
+    bool disparity;
+    m_pnh.param("disparity", disparity, false);
+    if (disparity) {
+        DisparityOptions options;
+        std::string algorithm;
+        std::vector<int> roi;
+        m_pnh.param<std::string>("disparity_algorithm", algorithm, "sgbm");
+        m_pnh.param("disparity_min", options.minDisparity, 0);
+        m_pnh.param("disparity_num", options.numDisparities, 64);
+        m_pnh.param("disparity_block_size", options.blockSize, 9);
+        m_pnh.param("disparity_downscale", options.downscale, 1);
+        m_pnh.param("disparity_roi", roi, std::vector<int>());
+        m_pnh.param("disparity_strips", options.strips, 0);
+        m_pnh.param("disparity_uniqueness_ratio", options.uniquenessRatio, 10);
+        m_pnh.param("disparity_speckle_window_size", options.speckleWindowSize, 100);
+        m_pnh.param("disparity_speckle_range", options.speckleRange, 2);
+        m_pnh.param("publish_points", m_publishPoints, false);
+        if (algorithm != "sgbm" && algorithm != "bm") {
+            std::cerr << "WARNING: disparity_algorithm must be sgbm or bm, using sgbm" << std::endl;
+        }
+        options.sgbm = algorithm != "bm";
+        if (roi.size() == 4) {
+            options.roi = cv::Rect(roi[0], roi[1], roi[2], roi[3]);
+        } else if (!roi.empty()) {
+            std::cerr << "WARNING: disparity_roi must be [x, y, width, height], matching the whole image" << std::endl;
+        }
+        m_disparity.reset(new DisparityEstimator(options));
+    }
+
+    m_pnh.param("message_pool_size", m_messagePoolSize, 8);
+    m_messagePoolSize = std::max(m_messagePoolSize, 0);
+    m_rawPool.setCapacity(m_messagePoolSize);
+    m_rectPool.setCapacity(m_messagePoolSize);
+    m_rectColorPool.setCapacity(m_messagePoolSize);
+    m_roiPool.setCapacity(m_messagePoolSize);
+    m_rawJpegPool.setCapacity(m_messagePoolSize);
+
+    m_pnh.param("rect_compressed", m_rectCompressed, false);
+    if (m_rectCompressed) {
+        m_pnh.param("jpeg_quality", m_jpegQuality, 80);
+        m_pnh.param<std::string>("jpeg_subsampling", m_jpegSubsampling, "420");
+        int subsamp;
+        if (m_jpegQuality < 1 || m_jpegQuality > 100) {
+            std::cerr << "WARNING: jpeg_quality must be in [1, 100], using 80" << std::endl;
+            m_jpegQuality = 80;
+        }
+        if (!JpegCodec::parseSubsampling(m_jpegSubsampling, subsamp)) {
+            std::cerr << "WARNING: jpeg_subsampling must be 444, 422, 420 or gray, using 420" << std::endl;
+            m_jpegSubsampling = "420";
+        }
+        int quality;
+        std::string subsampling;
+        m_pnh.param("rect_jpeg_quality", quality, m_jpegQuality);
+        m_pnh.param<std::string>("rect_jpeg_subsampling", subsampling, m_jpegSubsampling);
+        m_rectJpeg = jpegTopic(quality, subsampling, "image_rect");
+        m_pnh.param("rect_color_jpeg_quality", quality, m_jpegQuality);
+        m_pnh.param<std::string>("rect_color_jpeg_subsampling", subsampling, m_jpegSubsampling);
+        m_rectColorJpeg = jpegTopic(quality, subsampling, "image_rect_color");
+    }
+
+    XmlRpc::XmlRpcValue rectStreams;
+    if (m_pnh.getParam("rect_streams", rectStreams)) {
+        loadRectStreams(rectStreams);
+    }
+    std::string roiMessage;
+    if (!loadRectRoi(roiMessage)) {
+        std::cerr << "WARNING: " << roiMessage << std::endl;
+    }
+
+    std::string queuePolicy;
+    m_pnh.param("pipelined", m_pipelined, false);
+    m_pnh.param("queue_size", m_queueSize, 2);
+    m_pnh.param<std::string>("queue_policy", queuePolicy, "drop_oldest");
+    m_pnh.param("cpu_affinity", m_cpuAffinity, std::vector<int>());
+    if (!parseQueuePolicy(queuePolicy, m_queuePolicy)) {
+        std::cerr << "WARNING: queue_policy must be block or drop_oldest, using drop_oldest" << std::endl;
+        m_queuePolicy = QueuePolicy::DropOldest;
+    }
+    m_queueSize = std::max(m_queueSize, 1);
+    m_cpuAffinity.resize(kSteps + 1, -1);
+    if (m_pipelined && m_captureBackend == "opencv") {
+        // grab() and retrieve() of cv::VideoCapture can't run on different threads
+        std::cerr << "WARNING: pipelined needs the v4l2 or fake backend" << std::endl;
+        m_pipelined = false;
+    }
+    if (m_pipelined && m_bufferCount < m_queueSize + 3) {
+        // capture, the decode queue and the decode step hold buffers, the
+        // driver needs one more to fill
+        m_bufferCount = m_queueSize + 3;
+        std::cout << "buffer_count raised to " << m_bufferCount << " for the pipeline" << std::endl;
+    }
+
+    m_pnh.param("diagnostic_period", m_diagnosticPeriod, 1.0);
+    // end-to-end p90 above this is reported as a warning
+    m_pnh.param("max_latency", m_maxLatency, 0.1);
+
+    m_pnh.param<std::string>("calibration_file", m_calibrationFile,
+        ros::package::getPath("usb_camera") + "/calib/m2_calibration_480p.yml");
+    m_pnh.param<std::string>("map_cache_dir", m_mapCacheDir, defaultMapCacheDir());
+    m_pnh.param("calibration_watch_period", m_calibrationWatchPeriod, 1.0);
+
+    // topics go to <namespace>/left|right/..., the device may also come from the command line
+    m_pnh.param<std::string>("device", m_deviceName, m_deviceName);
+    m_pnh.param<std::string>("namespace", m_namespace, "m2_camera");
+    m_pnh.param<std::string>("left_frame_id", m_header[0].frame_id, "camera_left");
+    m_pnh.param<std::string>("right_frame_id", m_header[1].frame_id, "camera_right");
+}
+
+void M2CameraDriver::loadRectStreams(const XmlRpc::XmlRpcValue& streams)
+{
+    // two stages per stream (three with rect_compressed), next to at most 13 (15) others
+    const int kMaxStreams = m_rectCompressed ? 5 : 9;
+    if (streams.getType() != XmlRpc::XmlRpcValue::TypeArray) {
+        std::cerr << "WARNING: rect_streams must be a list" << std::endl;
+        return;
+    }
+    for (int i = 0; i < streams.size(); i++) {
+        XmlRpc::XmlRpcValue entry = streams[i];
+        RectStream s;
+        if (entry.getType() != XmlRpc::XmlRpcValue::TypeStruct || !entry.hasMember("name") ||
+            entry["name"].getType() != XmlRpc::XmlRpcValue::TypeString) {
+            std::cerr << "WARNING: Skip rect_streams entry " << i << ", it has no name" << std::endl;
+            continue;
+        }
+        s.name = static_cast<std::string>(entry["name"]);
+        if (s.name == "roi") {
+            std::cerr << "WARNING: Skip rect_streams entry roi, the name is taken by the ROI crop" << std::endl;
+            continue;
+        }
+        if (entry.hasMember("scale")) {
+            XmlRpc::XmlRpcValue& v = entry["scale"];
+            s.scale = v.getType() == XmlRpc::XmlRpcValue::TypeInt ? (double)static_cast<int>(v)
+                    : v.getType() == XmlRpc::XmlRpcValue::TypeDouble ? static_cast<double>(v) : 0.0;
+        }
+        if (entry.hasMember("roi")) {
+            XmlRpc::XmlRpcValue& v = entry["roi"];
+            bool ok = v.getType() == XmlRpc::XmlRpcValue::TypeArray && v.size() == 4;
+            for (int k = 0; ok && k < 4; k++) {
+                ok = v[k].getType() == XmlRpc::XmlRpcValue::TypeInt;
+            }
+            if (!ok) {
+                std::cerr << "WARNING: Skip rect_streams entry " << s.name << ", roi must be [x, y, width, height]" << std::endl;
+                continue;
+            }
+            s.roi = cv::Rect(static_cast<int>(v[0]), static_cast<int>(v[1]), static_cast<int>(v[2]), static_cast<int>(v[3]));
+        }
+        if (s.scale <= 0 || s.scale > 4) {
+            std::cerr << "WARNING: Skip rect_streams entry " << s.name << ", scale must be in (0, 4]" << std::endl;
+            continue;
+        }
+        // frames nothing larger is active for are decoded down to this stream's size
+        while (s.scale * s.decodeFactor * 2 <= 1.0 && m_decodeScale * s.decodeFactor * 2 <= 8) {
+            s.decodeFactor *= 2;
+        }
+        if ((int)m_rectStreams.size() == kMaxStreams) {
+            std::cerr << "WARNING: At most " << kMaxStreams << " rect_streams, skipping " << s.name << std::endl;
+            break;
+        }
+        if (m_rectCompressed) {
+            int quality = m_jpegQuality;
+            std::string subsampling = m_jpegSubsampling;
+            if (entry.hasMember("jpeg_quality") && entry["jpeg_quality"].getType() == XmlRpc::XmlRpcValue::TypeInt) {
+                quality = static_cast<int>(entry["jpeg_quality"]);
+            }
+            if (entry.hasMember("jpeg_subsampling") &&
+                entry["jpeg_subsampling"].getType() == XmlRpc::XmlRpcValue::TypeString) {
+                subsampling = static_cast<std::string>(entry["jpeg_subsampling"]);
+            }
+            s.jpeg = jpegTopic(quality, subsampling, s.name + "/image_rect");
+        }
+        s.pool = std::make_shared<ImagePool>(m_messagePoolSize);
+        m_rectStreams.push_back(s);
+    }
+}
+
+M2CameraDriver::~M2CameraDriver()
+{
+    stop();
+    m_reloadService.shutdown();
+    m_roiService.shutdown();
+    {
+        std::lock_guard<std::mutex> lock(m_watchMutex);
+        m_watching = false;
+    }
+    m_watchCond.notify_all();
+    if (m_watcher.joinable()) {
+        m_watcher.join();
+    }
+    for (size_t i = 0; i < m_framePool.size(); i++) {
+        releaseFrame(*m_framePool[i]);
+    }
+}
+
+void M2CameraDriver::setWorkerPool(WorkerPool* pool)
+{
+    if (pool && m_captureBackend == "opencv") {
+        std::cerr << "WARNING: the shared worker pool needs the v4l2, fake or replay backend" << std::endl;
+        return;
+    }
+    m_workerPool = pool;
+    if (!m_workerPool) {
+        return;
+    }
+    // the pool replaces the per-driver pipeline threads
+    m_pipelined = false;
+    if (m_bufferCount < m_queueSize + 3) {
+        m_bufferCount = m_queueSize + 3;
+        std::cout << "buffer_count raised to " << m_bufferCount << " for the worker pool" << std::endl;
+    }
+}
+
+bool M2CameraDriver::init(const std::vector<std::string>& args)
+{
+    if (args.size() >= 1) {
+        m_deviceName = args[0];
+        std::cout << "deviceName: " << m_deviceName << std::endl;
+    }
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == "raw" || args[i] == "rect" || args[i] == "info") {
+            std::cout << "'" << args[i] << "' is no longer needed, topics are published while they have subscribers" << std::endl;
+        }
+    }
+
+    if (m_mjpegPassthrough) {
+        // image_raw/compressed carries the camera's own JPEG, keep the
+        // image_transport plugin from advertising the same topic
+        std::vector<std::string> disabled(1, "image_transport/compressed");
+        m_nh.setParam(m_namespace + "/left/image_raw/disable_pub_plugins", disabled);
+        m_nh.setParam(m_namespace + "/right/image_raw/disable_pub_plugins", disabled);
+        m_pubRawJpeg[0] = m_nh.advertise<sensor_msgs::CompressedImage>(m_namespace + "/left/image_raw/compressed", 1);
+        m_pubRawJpeg[1] = m_nh.advertise<sensor_msgs::CompressedImage>(m_namespace + "/right/image_raw/compressed", 1);
+    }
+    m_pubRaw[0] = m_it.advertise(m_namespace + "/left/image_raw", 1);
+    m_pubRaw[1] = m_it.advertise(m_namespace + "/right/image_raw", 1);
+    if (m_rectCompressed) {
+        advertiseJpeg(m_namespace, "image_rect", m_rectJpeg);
+        if (m_monoRect && m_rectColorEvery > 0) {
+            advertiseJpeg(m_namespace, "image_rect_color", m_rectColorJpeg);
+        }
+        for (size_t i = 0; i < m_rectStreams.size(); i++) {
+            advertiseJpeg(m_namespace + "/" + m_rectStreams[i].name, "image_rect", m_rectStreams[i].jpeg);
+        }
+    }
+    m_pubRect[0] = m_it.advertise(m_namespace + "/left/image_rect", 1);
+    m_pubRect[1] = m_it.advertise(m_namespace + "/right/image_rect", 1);
+    m_pubRoi[0] = m_it.advertise(m_namespace + "/roi/left/image_rect", 1);
+    m_pubRoi[1] = m_it.advertise(m_namespace + "/roi/right/image_rect", 1);
+    m_pubRoiInfo[0] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/roi/left/camera_info", 1);
+    m_pubRoiInfo[1] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/roi/right/camera_info", 1);
+    if (m_disparity) {
+        m_pubDisparity = m_nh.advertise<stereo_msgs::DisparityImage>(m_namespace + "/disparity", 1);
+        if (m_publishPoints) {
+            m_pubPoints = m_nh.advertise<sensor_msgs::PointCloud2>(m_namespace + "/points2", 1);
+        }
+    }
+    for (size_t i = 0; i < m_rectStreams.size(); i++) {
+        RectStream& s = m_rectStreams[i];
+        s.pub[0] = m_it.advertise(m_namespace + "/" + s.name + "/left/image_rect", 1);
+        s.pub[1] = m_it.advertise(m_namespace + "/" + s.name + "/right/image_rect", 1);
+        s.pubInfo[0] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/" + s.name + "/left/camera_info", 1);
+        s.pubInfo[1] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/" + s.name + "/right/camera_info", 1);
+    }
+    if (m_monoRect && m_rectColorEvery > 0) {
+        m_pubRectColor[0] = m_it.advertise(m_namespace + "/left/image_rect_color", 1);
+        m_pubRectColor[1] = m_it.advertise(m_namespace + "/right/image_rect_color", 1);
+    }
+    m_pubInfo[0] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/left/camera_info", 1);
+    m_pubInfo[1] = m_nh.advertise<sensor_msgs::CameraInfo>(m_namespace + "/right/camera_info", 1);
+    m_pubDiagnostics = m_nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+
+    m_calibration = loadCalibration(m_calibrationFile);
+    if (!m_calibration) {
+        std::cerr << "WARNING: No calibration, image_rect and camera_info are not available" << std::endl;
+    }
+    buildStages();
+    if (m_calibration) {
+        m_reloadService = m_pnh.advertiseService("reload_calibration", &M2CameraDriver::onReloadCalibration, this);
+        m_roiService = m_pnh.advertiseService("update_rect_roi", &M2CameraDriver::onUpdateRectRoi, this);
+        if (m_calibrationWatchPeriod > 0) {
+            m_watching = true;
+            m_watcher = std::thread(&M2CameraDriver::watchCalibration, this);
+        }
+    }
+    return openCamera();
+}
+
+void M2CameraDriver::buildStages()
+{
+    using std::placeholders::_1;
+    m_graph.setObserver([this](int id, double seconds) { m_latency.record(m_graph.name(id), seconds); });
+    // stages that don't read the decoded pixels take any decode reduction
+    std::vector<int> anyScale;
+    std::vector<std::vector<int> > streamStages(m_rectStreams.size());
+    int decode = m_graph.add("decode", std::bind(&M2CameraDriver::decode, this, _1));
+    anyScale.push_back(decode);
+    int split = m_graph.add("split", std::bind(&M2CameraDriver::split, this, _1), StageGraph::Demand(), {decode});
+    m_graph.add("raw", std::bind(&M2CameraDriver::publishRaw, this, _1),
+        [this] { return m_pubRaw[0].getNumSubscribers() > 0 || m_pubRaw[1].getNumSubscribers() > 0; },
+        {split});
+    if (m_mjpegPassthrough) {
+        // works on the bitstream, no decode input
+        anyScale.push_back(m_graph.add("raw_jpeg", std::bind(&M2CameraDriver::publishRawJpeg, this, _1),
+            [this] { return m_pubRawJpeg[0].getNumSubscribers() > 0 || m_pubRawJpeg[1].getNumSubscribers() > 0; }));
+    }
+    m_stepFirst[0] = decode;
+    m_stepFirst[1] = m_stepFirst[2] = m_stepFirst[3] = m_graph.size();
+    if (m_calibration) {
+        int rectInput = decode;
+        if (m_monoRect) {
+            // before rectify, so it stays in the decode step that owns the device buffer;
+            // cv::VideoCapture only hands out BGR
+            rectInput = m_graph.add("decode_mono", std::bind(&M2CameraDriver::decodeMono, this, _1), StageGraph::Demand(),
+                m_captureBackend == "opencv" ? std::vector<int>{decode} : std::vector<int>());
+            anyScale.push_back(rectInput);
+        }
+        int rectify = m_graph.add("rectify", std::bind(&M2CameraDriver::rectify, this, _1), StageGraph::Demand(), {rectInput});
+        int rectifyColor = -1;
+        if (m_monoRect && m_rectColorEvery > 0) {
+            rectifyColor = m_graph.add("rectify_color", std::bind(&M2CameraDriver::rectifyColor, this, _1),
+                StageGraph::Demand(), {decode});
+        }
+        std::vector<int> rectifyStreams;
+        for (size_t i = 0; i < m_rectStreams.size(); i++) {
+            rectifyStreams.push_back(m_graph.add("rectify_" + m_rectStreams[i].name,
+                std::bind(&M2CameraDriver::rectifyStream, this, _1, i), StageGraph::Demand(), {rectInput}));
+            streamStages[i].push_back(rectifyStreams[i]);
+        }
+        // after rectify, whose image_rect is cropped when it ran anyway
+        int rectifyRoi = m_graph.add("rectify_roi", std::bind(&M2CameraDriver::rectifyRoi, this, _1),
+            StageGraph::Demand(), {rectInput});
+        if (m_disparity) {
+            // reads the image_rect buffers, so before rect hands the messages out
+            m_graph.add("disparity", std::bind(&M2CameraDriver::computeDisparity, this, _1),
+                [this] { return m_pubDisparity.getNumSubscribers() > 0 || m_pubPoints.getNumSubscribers() > 0; },
+                {rectify});
+        }
+        // the encoders read the rectified messages too, they start the publish step
+        int firstPublish = -1;
+        int rectColorJpeg = -1;
+        if (m_rectCompressed) {
+            firstPublish = m_graph.add("rect_jpeg",
+                [this](StereoFrame& f) { return publishJpeg(m_rectJpeg, f, f.rectView); },
+                [this] { return m_rectJpeg.subscribed(); }, {rectify});
+            if (rectifyColor >= 0) {
+                rectColorJpeg = m_graph.add("rect_color_jpeg",
+                    [this](StereoFrame& f) { return publishJpeg(m_rectColorJpeg, f, f.rectColorView); },
+                    [this] { return m_rectColorJpeg.subscribed(); }, {rectifyColor});
+            }
+            for (size_t i = 0; i < m_rectStreams.size(); i++) {
+                RectStream& s = m_rectStreams[i];
+                streamStages[i].push_back(m_graph.add("rect_" + s.name + "_jpeg",
+                    [this, &s, i](StereoFrame& f) { return publishJpeg(s.jpeg, f, &f.streamView[2 * i]); },
+                    [&s] { return s.jpeg.subscribed(); }, {rectifyStreams[i]}));
+            }
+        }
+        int rect = m_graph.add("rect", std::bind(&M2CameraDriver::publishRect, this, _1),
+            [this] { return m_pubRect[0].getNumSubscribers() > 0 || m_pubRect[1].getNumSubscribers() > 0; },
+            {rectify});
+        if (rectifyColor >= 0) {
+            int rectColor = m_graph.add("rect_color", std::bind(&M2CameraDriver::publishRectColor, this, _1),
+                [this] { return m_pubRectColor[0].getNumSubscribers() > 0 || m_pubRectColor[1].getNumSubscribers() > 0; },
+                {rectifyColor});
+            m_colorStages = (1u << rectifyColor) | (1u << rectColor);
+            if (rectColorJpeg >= 0) {
+                m_colorStages |= 1u << rectColorJpeg;
+            }
+        }
+        for (size_t i = 0; i < m_rectStreams.size(); i++) {
+            const RectStream& s = m_rectStreams[i];
+            streamStages[i].push_back(m_graph.add("rect_" + s.name, std::bind(&M2CameraDriver::publishStream, this, _1, i),
+                [&s] { return s.pub[0].getNumSubscribers() > 0 || s.pub[1].getNumSubscribers() > 0; },
+                {rectifyStreams[i]}));
+        }
+        m_graph.add("rect_roi", std::bind(&M2CameraDriver::publishRoi, this, _1),
+            [this] { return m_pubRoi[0].getNumSubscribers() > 0 || m_pubRoi[1].getNumSubscribers() > 0; },
+            {rectifyRoi});
+        anyScale.push_back(m_graph.add("info", std::bind(&M2CameraDriver::publishInfo, this, _1), [this] {
+            bool any = m_pubInfo[0].getNumSubscribers() > 0 || m_pubInfo[1].getNumSubscribers() > 0 ||
+                       m_pubRoiInfo[0].getNumSubscribers() > 0 || m_pubRoiInfo[1].getNumSubscribers() > 0;
+            for (size_t i = 0; i < m_rectStreams.size(); i++) {
+                any = any || m_rectStreams[i].pubInfo[0].getNumSubscribers() > 0 ||
+                      m_rectStreams[i].pubInfo[1].getNumSubscribers() > 0;
+            }
+            return any;
+        }));
+        m_stepFirst[1] = rectify;
+        m_stepFirst[2] = firstPublish >= 0 ? firstPublish : rect;
+        m_stepFirst[3] = m_graph.size();
+    }
+
+    m_stageFactor.assign(m_graph.size(), 1);
+    for (size_t i = 0; i < anyScale.size(); i++) {
+        m_stageFactor[anyScale[i]] = 8;
+    }
+    for (size_t i = 0; i < streamStages.size(); i++) {
+        for (size_t j = 0; j < streamStages[i].size(); j++) {
+            m_stageFactor[streamStages[i][j]] = m_rectStreams[i].decodeFactor;
+        }
+    }
+}
+
+int M2CameraDriver::decodeFactor(unsigned stages) const
+{
+    int factor = 8 / m_decodeScale;
+    for (int id = 0; id < m_graph.size(); id++) {
+        if (stages & (1u << id)) {
+            factor = std::min(factor, m_stageFactor[id]);
+        }
+    }
+    return factor;
+}
+
+std::shared_ptr<LoadedCalibration> M2CameraDriver::loadCalibration(const std::string& path) const
+{
+    std::cout << "Read camera calib parameter from " << path << std::endl;
+    std::shared_ptr<LoadedCalibration> calib = std::make_shared<LoadedCalibration>();
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::vector<uchar> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in || !calib->model.load(path)) {
+        return nullptr;
+    }
+    calib->path = path;
+    // the maps depend on the decode scale too
+    calib->hash = contentHash(bytes) ^ ((uint64_t)m_decodeScale * 0x9e3779b97f4a7c15ULL);
+    if (m_decodeScale != 1) {
+        calib->model = calib->model.scaled(1.0 / m_decodeScale);
+        std::cout << "Decode at 1/" << m_decodeScale << ": " << calib->model.imageSize.width << "x"
+                  << calib->model.imageSize.height << " per eye" << std::endl;
+    }
+    for (int k = 0; k < 2; k++) {
+        calib->model.toCameraInfo(k, calib->cameraInfo[k]);
+    }
+    const int64_t t0 = monotonicNow();
+    calib->maps.load(mapCachePath(path), calib->hash, calib->model);
+    calib->rectifier.init(calib->maps.map1, calib->maps.map2);
+    printf("Rectification maps %s in %.1f ms\n", calib->maps.mapped() ? "mapped" : "computed",
+           (monotonicNow() - t0) * 1e-6);
+
+    for (size_t i = 0; i < m_rectStreams.size(); i++) {
+        const RectStream& s = m_rectStreams[i];
+        const cv::Size scaledSize = calib->model.scaled(s.scale).imageSize;
+        cv::Rect roi = s.roi & cv::Rect(cv::Point(), scaledSize);
+        if (roi != s.roi) {
+            std::cerr << "WARNING: roi of rect stream " << s.name << " clipped to the " << scaledSize.width << "x"
+                      << scaledSize.height << " image" << std::endl;
+        }
+        std::unique_ptr<RectifiedView> view(new RectifiedView());
+        view->model = calib->model.rectifiedView(s.scale, roi);
+        for (int k = 0; k < 2; k++) {
+            view->model.toCameraInfo(k, view->cameraInfo[k]);
+        }
+        const std::string key = std::to_string(s.scale) + " " + std::to_string(roi.x) + " " + std::to_string(roi.y) +
+                                " " + std::to_string(roi.width) + " " + std::to_string(roi.height);
+        const uint64_t hash = calib->hash ^ contentHash(key);
+        view->maps.load(mapCachePath(path, s.name), hash, calib->model, view->model);
+        view->rectifier.init(view->maps.map1, view->maps.map2);
+        for (int f = 2; f <= s.decodeFactor; f *= 2) {
+            const std::string source = "_from" + std::to_string(f);
+            std::unique_ptr<RectifiedView::Source> reduced(new RectifiedView::Source());
+            reduced->maps.load(mapCachePath(path, s.name + source), hash ^ contentHash(source),
+                               calib->model.scaled(1.0 / f), view->model);
+            reduced->rectifier.init(reduced->maps.map1, reduced->maps.map2);
+            view->reduced.push_back(std::move(reduced));
+        }
+        std::cout << "Rect stream " << s.name << ": " << view->model.imageSize.width << "x"
+                  << view->model.imageSize.height << " per eye" << std::endl;
+        calib->views.push_back(std::move(view));
+    }
+    return calib;
+}
+
+std::string M2CameraDriver::mapCachePath(const std::string& calibrationPath, const std::string& view) const
+{
+    if (m_mapCacheDir.empty()) {
+        return std::string();
+    }
+    std::string name = calibrationPath.substr(calibrationPath.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    if (!view.empty()) {
+        name += "_" + view;
+    }
+    return m_mapCacheDir + "/" + name + "_" + std::to_string(m_decodeScale) + ".rmap";
+}
+
+bool M2CameraDriver::reloadCalibration(std::string& message)
+{
+    std::lock_guard<std::mutex> lock(m_reloadMutex);
+    std::shared_ptr<LoadedCalibration> current = std::atomic_load(&m_calibration);
+    std::shared_ptr<LoadedCalibration> next = loadCalibration(m_calibrationFile);
+    if (!next) {
+        message = "can't load " + m_calibrationFile + ", keeping the current calibration";
+        return false;
+    }
+    if (current && next->model.imageSize != current->model.imageSize) {
+        message = m_calibrationFile + " is for another image size, keeping the current calibration";
+        return false;
+    }
+    if (current && next->hash == current->hash) {
+        message = "calibration unchanged";
+        return true;
+    }
+    // frames already captured finish with the calibration they carry
+    std::atomic_store(&m_calibration, next);
+    message = "calibration reloaded from " + m_calibrationFile;
+    return true;
+}
+
+bool M2CameraDriver::onReloadCalibration(std_srvs::Trigger::Request&, std_srvs::Trigger::Response& res)
+{
+    res.success = reloadCalibration(res.message);
+    std::cout << "reload_calibration: " << res.message << std::endl;
+    return true;
+}
+
+bool M2CameraDriver::loadRectRoi(std::string& message)
+{
+    XmlRpc::XmlRpcValue requests;
+    std::vector<std::pair<std::string, XmlRpc::XmlRpcValue> > entries;
+    if (m_pnh.getParam("rect_roi_requests", requests)) {
+        if (requests.getType() == XmlRpc::XmlRpcValue::TypeStruct) {
+            for (XmlRpc::XmlRpcValue::iterator it = requests.begin(); it != requests.end(); ++it) {
+                entries.push_back(*it);
+            }
+        } else if (requests.getType() == XmlRpc::XmlRpcValue::TypeArray) {
+            for (int i = 0; i < requests.size(); i++) {
+                entries.push_back(std::make_pair(std::to_string(i), requests[i]));
+            }
+        } else {
+            message = "rect_roi_requests must be a list or a dict of [x, y, width, height], keeping the current roi";
+            return false;
+        }
+    }
+    cv::Rect roi;
+    int count = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        XmlRpc::XmlRpcValue& v = entries[i].second;
+        bool ok = v.getType() == XmlRpc::XmlRpcValue::TypeArray && v.size() == 4;
+        for (int k = 0; ok && k < 4; k++) {
+            ok = v[k].getType() == XmlRpc::XmlRpcValue::TypeInt;
+        }
+        const cv::Rect r = ok ? cv::Rect(static_cast<int>(v[0]), static_cast<int>(v[1]), static_cast<int>(v[2]),
+                                         static_cast<int>(v[3]))
+                              : cv::Rect();
+        if (r.width <= 0 || r.height <= 0) {
+            std::cerr << "WARNING: Skip rect_roi_requests entry " << entries[i].first
+                      << ", it must be [x, y, width, height]" << std::endl;
+            continue;
+        }
+        // a bounding box, a list of rectangles would cost more per tile than it saves
+        roi = count++ ? roi | r : r;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_roiMutex);
+        m_rectRoi = roi;
+    }
+    if (count == 0) {
+        message = "no rect_roi_requests, roi is all of image_rect";
+    } else {
+        message = "roi [" + std::to_string(roi.x) + ", " + std::to_string(roi.y) + ", " + std::to_string(roi.width) +
+                  ", " + std::to_string(roi.height) + "] from " + std::to_string(count) + " requests";
+    }
+    return true;
+}
+
+bool M2CameraDriver::onUpdateRectRoi(std_srvs::Trigger::Request&, std_srvs::Trigger::Response& res)
+{
+    res.success = loadRectRoi(res.message);
+    std::cout << "update_rect_roi: " << res.message << std::endl;
+    return true;
+}
+
+void M2CameraDriver::watchCalibration()
+{
+    setCurrentThreadName("m2_calib_watch");
+    std::pair<int64_t, int64_t> loaded = fileStamp(m_calibrationFile);
+    std::pair<int64_t, int64_t> seen = loaded;
+    std::unique_lock<std::mutex> lock(m_watchMutex);
+    while (m_watching) {
+        m_watchCond.wait_for(lock, std::chrono::duration<double>(m_calibrationWatchPeriod));
+        if (!m_watching) {
+            break;
+        }
+        const std::pair<int64_t, int64_t> now = fileStamp(m_calibrationFile);
+        // reload once the file stopped changing for a period, not halfway through a write
+        if (now == seen && now != loaded && now.first >= 0) {
+            lock.unlock();
+            std::string message;
+            if (reloadCalibration(message)) {
+                std::cout << message << std::endl;
+            } else {
+                std::cerr << "WARNING: " << message << std::endl;
+            }
+            lock.lock();
+            loaded = now;
+        }
+        seen = now;
+    }
+}
+
+bool M2CameraDriver::openCamera()
+{
+    std::cout << "Opening camera " << m_deviceName << std::endl;
+    if (m_captureBackend == "opencv") {
+        m_capture.open(m_deviceName, cv::CAP_V4L2); // open the camera
+        if (!m_capture.isOpened())
+        {
+            std::cerr << "ERROR: Can't initialize camera capture" << std::endl;
+            return false;
+        }
+
+        int codec = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+        m_capture.set(cv::CAP_PROP_FOURCC,codec);
+        m_capture.set(cv::CAP_PROP_FRAME_WIDTH, 1280);
+        m_capture.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
+        m_capture.set(cv::CAP_PROP_FPS, 30.0);
+
+        std::cout << "Frame width: " << m_capture.get(cv::CAP_PROP_FRAME_WIDTH) << std::endl;
+        std::cout << "     height: " << m_capture.get(cv::CAP_PROP_FRAME_HEIGHT) << std::endl;
+        std::cout << "Capturing FPS: " << m_capture.get(cv::CAP_PROP_FPS) << std::endl;
+        return true;
+    }
+
+    if (m_captureBackend == "fake") {
+        m_device.reset(new FakeCapture(m_bufferCount));
+    } else if (m_captureBackend == "replay") {
+        ReplayOptions options;
+        std::string timing;
+        m_pnh.param<std::string>("replay_timing", timing, "original");
+        m_pnh.param("replay_fps", options.fps, 0.0);
+        m_pnh.param("replay_loop", options.loop, false);
+        m_pnh.param("replay_read_ahead", options.readAhead, 8);
+        if (!parseReplayTiming(timing, options.timing)) {
+            std::cerr << "WARNING: replay_timing must be original, fixed or fast, using original" << std::endl;
+        }
+        m_device.reset(new ReplayCapture(m_bufferCount, options));
+    } else {
+        m_device.reset(new V4L2Capture(m_bufferCount, m_useDmabuf));
+    }
+    CaptureFormat format;
+    format.width = 1280;
+    format.height = 480;
+    format.fps = 30.0;
+    if (!m_device->open(m_deviceName, format))
+    {
+        std::cerr << "ERROR: Can't initialize camera capture" << std::endl;
+        return false;
+    }
+    std::cout << "Frame width: " << m_device->format().width << std::endl;
+    std::cout << "     height: " << m_device->format().height << std::endl;
+    std::cout << "Capturing FPS: " << m_device->format().fps << std::endl;
+    std::cout << "Buffers: " << m_device->bufferCount() << std::endl;
+    return true;
+}
+
+bool M2CameraDriver::grab(StereoFrame& frame)
+{
+    frame.stages = m_graph.activeMask();
+    if ((frame.stages & m_colorStages) && m_colorCount++ % m_rectColorEvery != 0) {
+        // color (and its decode, unless raw needs it) only on every rect_color_every-th frame
+        frame.stages = m_graph.activeMask(m_colorStages);
+    }
+    frame.calibration = std::atomic_load(&m_calibration);
+    if (frame.calibration) {
+        const cv::Rect all(cv::Point(), frame.calibration->rectifier.size());
+        std::lock_guard<std::mutex> lock(m_roiMutex);
+        frame.rectRoi = m_rectRoi & all;
+        if (frame.rectRoi.empty()) {
+            frame.rectRoi = all;
+        }
+    }
+    frame.header[0] = m_header[0];
+    frame.header[1] = m_header[1];
+    ros::Time stamp;
+    if (!m_device) {
+        // decoding is left to retrieve() in the decode stage
+        if (!m_capture.grab()) {
+            std::cerr << "ERROR: Can't grab camera frame." << std::endl;
+            return false;
+        }
+        // no buffer timestamp through cv::VideoCapture
+        frame.captured.timestamp_ns = monotonicNow();
+        stamp = ros::Time::now();
+    } else {
+        if (!m_device->dequeue(frame.captured, 1000)) {
+            if (m_device->endOfStream()) {
+                std::cout << "End of replay" << std::endl;
+            } else {
+                std::cerr << "ERROR: Can't grab camera frame." << std::endl;
+            }
+            return false;
+        }
+        m_clock.update();
+        stamp = m_clock.toRos(frame.captured.timestamp_ns);
+        if (frame.captured.fourcc == fourcc('M', 'J', 'P', 'G')) {
+            frame.decodeFactor = decodeFactor(frame.stages);
+        }
+        m_latency.record("capture", (monotonicNow() - frame.captured.timestamp_ns) * 1e-9);
+        m_latency.frameCaptured(frame.captured.sequence);
+    }
+    frame.header[0].stamp = stamp;
+    frame.header[1].stamp = stamp;
+    return true;
+}
+
+void M2CameraDriver::releaseFrame(StereoFrame& frame)
+{
+    if (m_device && frame.captured.index >= 0) {
+        m_device->release(frame.captured);
+    }
+}
+
+sensor_msgs::ImagePtr M2CameraDriver::createImage(ImagePool& pool, const std_msgs::Header& header, cv::Size size,
+                                                  int type, cv::Mat& view)
+{
+    const uint32_t step = size.width * CV_ELEM_SIZE(type);
+    sensor_msgs::ImagePtr msg = pool.acquire((size_t)step * size.height);
+    msg->header = header;
+    msg->width = size.width;
+    msg->height = size.height;
+    msg->encoding = CV_MAT_CN(type) == 1 ? sensor_msgs::image_encodings::MONO8 : sensor_msgs::image_encodings::BGR8;
+    msg->is_bigendian = false;
+    msg->step = step;
+    view = cv::Mat(size, type, msg->data.data(), msg->step);
+    return msg;
+}
+
+bool M2CameraDriver::decode(StereoFrame& frame)
+{
+    const CapturedFrame& captured = frame.captured;
+    if (!m_device) {
+        m_capture.retrieve(frame.bgr);
+    } else if (captured.fourcc == fourcc('M', 'J', 'P', 'G')) {
+        if (!m_jpeg.decode(captured.data.ptr(), captured.bytesused, frame.bgr, m_decodeScale * frame.decodeFactor)) {
+            frame.bgr.release();
+        }
+    } else {
+        // bgr is decoded from (or, for BGR3, a view of) the driver buffer
+        convertToBgr(captured, frame.bgr);
+        if (m_decodeScale != 1 && !frame.bgr.empty()) {
+            // uncompressed formats have no cheap reduced decode
+            cv::resize(frame.bgr, frame.storage, cv::Size(), 1.0 / m_decodeScale, 1.0 / m_decodeScale, cv::INTER_AREA);
+            frame.bgr = frame.storage;
+        } else if (m_pipelined && !frame.bgr.empty() && !frame.bgr.u) {
+            // the buffer goes back to the driver before rectify runs
+            frame.bgr.copyTo(frame.storage);
+            frame.bgr = frame.storage;
+        }
+    }
+    if (frame.bgr.empty()) {
+        std::cerr << "ERROR: Can't decode camera frame." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool M2CameraDriver::decodeMono(StereoFrame& frame)
+{
+    const CapturedFrame& captured = frame.captured;
+    if (!m_device) {
+        cv::cvtColor(frame.bgr, frame.gray, cv::COLOR_BGR2GRAY);
+    } else if (captured.fourcc == fourcc('M', 'J', 'P', 'G')) {
+        if (!m_jpeg.decodeGray(captured.data.ptr(), captured.bytesused, frame.gray, m_decodeScale * frame.decodeFactor)) {
+            frame.gray.release();
+        }
+    } else {
+        // Y samples of YUYV, a view of GREY buffers
+        convertToGray(captured, frame.gray);
+        if (m_decodeScale != 1 && !frame.gray.empty()) {
+            cv::resize(frame.gray, frame.grayStorage, cv::Size(), 1.0 / m_decodeScale, 1.0 / m_decodeScale, cv::INTER_AREA);
+            frame.gray = frame.grayStorage;
+        } else if (m_pipelined && !frame.gray.empty() && !frame.gray.u) {
+            frame.gray.copyTo(frame.grayStorage);
+            frame.gray = frame.grayStorage;
+        }
+    }
+    if (frame.gray.empty()) {
+        std::cerr << "ERROR: Can't decode camera frame." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool M2CameraDriver::split(StereoFrame& frame)
+{
+    const int half = frame.bgr.size().width / 2;
+    frame.half[0] = frame.bgr(cv::Rect(0, 0, half, frame.bgr.size().height));
+    frame.half[1] = frame.bgr(cv::Rect(half, 0, half, frame.bgr.size().height));
+    return true;
+}
+
+bool M2CameraDriver::publishRaw(StereoFrame& frame)
+{
+    for (int k = 0; k < 2; k++) {
+        if (m_pubRaw[k].getNumSubscribers() == 0) {
+            continue;
+        }
+        int64_t t0 = monotonicNow();
+        cv::Mat view;
+        sensor_msgs::ImagePtr msg = createImage(m_rawPool, frame.header[k], frame.half[k].size(), frame.bgr.type(), view);
+        frame.half[k].copyTo(view);
+        int64_t t1 = monotonicNow();
+        m_pubRaw[k].publish(sensor_msgs::ImageConstPtr(msg));
+        m_latency.record("serialize", (t1 - t0) * 1e-9);
+        m_latency.record("publish", (monotonicNow() - t1) * 1e-9);
+    }
+    return true;
+}
+
+bool M2CameraDriver::publishRawJpeg(StereoFrame& frame)
+{
+    const CapturedFrame& captured = frame.captured;
+    if (!m_device || captured.fourcc != fourcc('M', 'J', 'P', 'G')) {
+        return true;
+    }
+    sensor_msgs::CompressedImagePtr msg[2];
+    for (int k = 0; k < 2; k++) {
+        msg[k] = m_rawJpegPool.acquire(0);
+        msg[k]->header = frame.header[k];
+        msg[k]->format = "bgr8; jpeg compressed bgr8";
+    }
+    if (!m_jpeg.splitHalves(captured.data.ptr(), captured.bytesused, msg[0]->data, msg[1]->data)) {
+        std::cerr << "ERROR: Can't split MJPEG frame, raw_jpeg needs an MCU aligned half width" << std::endl;
+        return true;
+    }
+    int64_t t0 = monotonicNow();
+    for (int k = 0; k < 2; k++) {
+        m_pubRawJpeg[k].publish(sensor_msgs::CompressedImageConstPtr(msg[k]));
+    }
+    m_latency.record("publish", (monotonicNow() - t0) * 1e-9);
+    return true;
+}
+
+void M2CameraDriver::rectifyInto(StereoRectifier& rectifier, ImagePool& pool, const StereoFrame& frame,
+                                 const cv::Mat& src, sensor_msgs::ImagePtr msg[2], cv::Mat view[2])
+{
+    // remap straight into the message buffers
+    for (int k = 0; k < 2; k++) {
+        msg[k] = createImage(pool, frame.header[k], rectifier.size(), src.type(), view[k]);
+    }
+    rectifier.rectify(src, view[0], view[1]);
+}
+
+bool M2CameraDriver::rectify(StereoFrame& frame)
+{
+    rectifyInto(frame.calibration->rectifier, m_rectPool, frame, m_monoRect ? frame.gray : frame.bgr, frame.rectMsg,
+                frame.rectView);
+    return true;
+}
+
+bool M2CameraDriver::rectifyColor(StereoFrame& frame)
+{
+    rectifyInto(frame.calibration->rectifier, m_rectColorPool, frame, frame.bgr, frame.rectColorMsg, frame.rectColorView);
+    return true;
+}
+
+bool M2CameraDriver::computeDisparity(StereoFrame& frame)
+{
+    const DisparityOptions& options = m_disparity->options();
+    const int s = options.downscale;
+    const cv::Rect roi = m_disparity->matchedRoi(frame.rectView[0].size());
+    // the matched image as a camera of its own, for f, T and Q
+    const StereoCameraModel model = frame.calibration->model.rectifiedView(1.0 / s,
+        cv::Rect(roi.x / s, roi.y / s, roi.width / s, roi.height / s));
+
+    stereo_msgs::DisparityImagePtr msg = boost::make_shared<stereo_msgs::DisparityImage>();
+    msg->header = frame.header[0];
+    sensor_msgs::Image& image = msg->image;
+    image.header = frame.header[0];
+    image.width = model.imageSize.width;
+    image.height = model.imageSize.height;
+    image.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
+    image.is_bigendian = false;
+    image.step = image.width * sizeof(float);
+    image.data.resize((size_t)image.step * image.height);
+    cv::Mat disparity(model.imageSize, CV_32F, image.data.data(), image.step);
+    m_disparity->compute(frame.rectView[0], frame.rectView[1], disparity);
+
+    msg->f = model.P[0].at<double>(0, 0);
+    msg->T = -model.P[1].at<double>(0, 3) / model.P[1].at<double>(0, 0);
+    msg->min_disparity = options.minDisparity;
+    msg->max_disparity = options.minDisparity + options.numDisparities - 1;
+    msg->delta_d = 1.0 / 16;
+    // columns without a full search range or block on the image, as stereo_image_proc
+    const int border = options.blockSize / 2;
+    const int left = msg->max_disparity + border;
+    const int right = (int)image.width - 1 - (options.minDisparity >= 0 ? border + options.minDisparity
+                                                                           : std::max(border, -options.minDisparity));
+    msg->valid_window.x_offset = std::max(left, 0);
+    msg->valid_window.y_offset = border;
+    msg->valid_window.width = std::max(right - left, 0);
+    msg->valid_window.height = std::max((int)image.height - 1 - 2 * border, 0);
+
+    if (m_pubPoints.getNumSubscribers() > 0) {
+        publishPoints(frame, disparity, model.Q);
+    }
+    if (m_pubDisparity.getNumSubscribers() > 0) {
+        int64_t t0 = monotonicNow();
+        m_pubDisparity.publish(stereo_msgs::DisparityImageConstPtr(msg));
+        m_latency.record("publish", (monotonicNow() - t0) * 1e-9);
+    }
+    return true;
+}
+
+void M2CameraDriver::publishPoints(const StereoFrame& frame, const cv::Mat& disparity, const cv::Mat& Q)
+{
+    sensor_msgs::PointCloud2Ptr cloud = boost::make_shared<sensor_msgs::PointCloud2>();
+    cloud->header = frame.header[0];
+    cloud->height = disparity.rows;
+    cloud->width = disparity.cols;
+    cloud->is_dense = false;
+    cloud->is_bigendian = false;
+    sensor_msgs::PointCloud2Modifier modifier(*cloud);
+    modifier.setPointCloud2Fields(3, "x", 1, sensor_msgs::PointField::FLOAT32,
+                                     "y", 1, sensor_msgs::PointField::FLOAT32,
+                                     "z", 1, sensor_msgs::PointField::FLOAT32);
+    modifier.resize((size_t)disparity.rows * disparity.cols);
+
+    // reproject straight into the message
+    cv::Mat xyz(disparity.size(), CV_32FC3, cloud->data.data(), cloud->row_step);
+    cv::reprojectImageTo3D(disparity, xyz, Q, false);
+    const float minDisparity = (float)m_disparity->options().minDisparity;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int y = 0; y < disparity.rows; y++) {
+        const float* d = disparity.ptr<float>(y);
+        cv::Vec3f* p = xyz.ptr<cv::Vec3f>(y);
+        for (int x = 0; x < disparity.cols; x++) {
+            if (!(d[x] >= minDisparity) || !std::isfinite(p[x][2])) {
+                p[x] = cv::Vec3f(nan, nan, nan);
+            }
+        }
+    }
+    int64_t t0 = monotonicNow();
+    m_pubPoints.publish(sensor_msgs::PointCloud2ConstPtr(cloud));
+    m_latency.record("publish", (monotonicNow() - t0) * 1e-9);
+}
+
+bool M2CameraDriver::rectifyStream(StereoFrame& frame, size_t i)
+{
+    if (frame.streamMsg.size() < 2 * m_rectStreams.size()) {
+        frame.streamMsg.resize(2 * m_rectStreams.size());
+        frame.streamView.resize(2 * m_rectStreams.size());
+    }
+    rectifyInto(frame.calibration->views[i]->rectifierFor(frame.decodeFactor), *m_rectStreams[i].pool, frame,
+                m_monoRect ? frame.gray : frame.bgr, &frame.streamMsg[2 * i], &frame.streamView[2 * i]);
+    return true;
+}
+
+bool M2CameraDriver::publishStream(StereoFrame& frame, size_t i)
+{
+    publishImages(m_rectStreams[i].pub, &frame.streamMsg[2 * i]);
+    return true;
+}
+
+bool M2CameraDriver::rectifyRoi(StereoFrame& frame)
+{
+    const cv::Rect& roi = frame.rectRoi;
+    const cv::Mat& src = m_monoRect ? frame.gray : frame.bgr;
+    for (int k = 0; k < 2; k++) {
+        frame.roiMsg[k] = createImage(m_roiPool, frame.header[k], roi.size(), src.type(), frame.roiView[k]);
+    }
+    if (!frame.rectView[0].empty()) {
+        // image_rect has subscribers too, a copy is cheaper than remapping again
+        for (int k = 0; k < 2; k++) {
+            frame.rectView[k](roi).copyTo(frame.roiView[k]);
+        }
+        return true;
+    }
+    frame.calibration->rectifier.rectify(src, frame.roiView[0], frame.roiView[1], roi);
+    return true;
+}
+
+bool M2CameraDriver::publishRoi(StereoFrame& frame)
+{
+    publishImages(m_pubRoi, frame.roiMsg);
+    return true;
+}
+
+void M2CameraDriver::publishImages(image_transport::Publisher pub[2], sensor_msgs::ImagePtr msg[2])
+{
+    int64_t t0 = monotonicNow();
+    for (int k = 0; k < 2; k++) {
+        pub[k].publish(sensor_msgs::ImageConstPtr(msg[k]));
+        msg[k].reset();
+    }
+    m_latency.record("publish", (monotonicNow() - t0) * 1e-9);
+}
+
+M2CameraDriver::JpegTopic M2CameraDriver::jpegTopic(int quality, const std::string& subsampling,
+                                                    const std::string& what) const
+{
+    JpegTopic topic;
+    topic.quality = quality;
+    if (quality < 1 || quality > 100) {
+        std::cerr << "WARNING: JPEG quality of " << what << " must be in [1, 100], using " << m_jpegQuality << std::endl;
+        topic.quality = m_jpegQuality;
+    }
+    if (!JpegCodec::parseSubsampling(subsampling, topic.subsampling)) {
+        std::cerr << "WARNING: JPEG subsampling of " << what << " must be 444, 422, 420 or gray, using "
+                  << m_jpegSubsampling << std::endl;
+        JpegCodec::parseSubsampling(m_jpegSubsampling, topic.subsampling);
+    }
+    topic.pool = std::make_shared<JpegPool>(m_messagePoolSize);
+    return topic;
+}
+
+void M2CameraDriver::advertiseJpeg(const std::string& prefix, const std::string& image, JpegTopic& topic)
+{
+    const char* eye[2] = { "/left/", "/right/" };
+    const std::vector<std::string> disabled(1, "image_transport/compressed");
+    for (int k = 0; k < 2; k++) {
+        const std::string base = prefix + eye[k] + image;
+        m_nh.setParam(base + "/disable_pub_plugins", disabled);
+        topic.pub[k] = m_nh.advertise<sensor_msgs::CompressedImage>(base + "/compressed", 1);
+    }
+}
+
+bool M2CameraDriver::publishJpeg(JpegTopic& topic, const StereoFrame& frame, const cv::Mat view[2])
+{
+    sensor_msgs::CompressedImagePtr msg[2];
+    bool encoded[2] = { false, false };
+    // one eye per worker, each with its own compressor
+    parallelFor(cv::Range(0, 2), [&](int k) {
+        if (topic.pub[k].getNumSubscribers() == 0) {
+            return;
+        }
+        msg[k] = topic.pool->acquire(0);
+        msg[k]->header = frame.header[k];
+        msg[k]->format = view[k].channels() == 1 ? "mono8; jpeg compressed mono8" : "bgr8; jpeg compressed bgr8";
+        encoded[k] = m_jpegEncoders[k].encode(view[k], topic.quality, topic.subsampling, msg[k]->data);
+    }, 2);
+
+    int64_t t0 = monotonicNow();
+    for (int k = 0; k < 2; k++) {
+        if (encoded[k]) {
+            topic.pub[k].publish(sensor_msgs::CompressedImageConstPtr(msg[k]));
+        }
+    }
+    m_latency.record("publish", (monotonicNow() - t0) * 1e-9);
+    return true;
+}
+
+bool M2CameraDriver::publishRect(StereoFrame& frame)
+{
+    publishImages(m_pubRect, frame.rectMsg);
+    return true;
+}
+
+bool M2CameraDriver::publishRectColor(StereoFrame& frame)
+{
+    publishImages(m_pubRectColor, frame.rectColorMsg);
+    return true;
+}
+
+bool M2CameraDriver::publishInfo(StereoFrame& frame)
+{
+    for (int k = 0; k < 2; k++) {
+        // stamped like the images so it can be synchronized with them
+        sensor_msgs::CameraInfoPtr info = boost::make_shared<sensor_msgs::CameraInfo>(frame.calibration->cameraInfo[k]);
+        info->header = frame.header[k];
+        m_pubInfo[k].publish(sensor_msgs::CameraInfoConstPtr(info));
+        for (size_t i = 0; i < m_rectStreams.size(); i++) {
+            if (m_rectStreams[i].pubInfo[k].getNumSubscribers() == 0) {
+                continue;
+            }
+            info = boost::make_shared<sensor_msgs::CameraInfo>(frame.calibration->views[i]->cameraInfo[k]);
+            info->header = frame.header[k];
+            m_rectStreams[i].pubInfo[k].publish(sensor_msgs::CameraInfoConstPtr(info));
+        }
+        if (m_pubRoiInfo[k].getNumSubscribers() > 0) {
+            info = boost::make_shared<sensor_msgs::CameraInfo>(frame.calibration->cameraInfo[k]);
+            info->header = frame.header[k];
+            info->roi.x_offset = frame.rectRoi.x;
+            info->roi.y_offset = frame.rectRoi.y;
+            info->roi.width = frame.rectRoi.width;
+            info->roi.height = frame.rectRoi.height;
+            // the roi is in rectified pixels already
+            info->roi.do_rectify = false;
+            m_pubRoiInfo[k].publish(sensor_msgs::CameraInfoConstPtr(info));
+        }
+    }
+    return true;
+}
+
+size_t M2CameraDriver::run()
+{
+    m_running = true;
+    m_lastDiagnostics = monotonicNow();
+    m_lastMasterCheck = m_lastDiagnostics;
+    const int64_t start = m_lastDiagnostics;
+    size_t nFrames = m_workerPool ? runPooled() : m_pipelined ? runPipelined() : runSerial();
+    const double seconds = (monotonicNow() - start) * 1e-9;
+    std::cout << "Number of captured frames: " << nFrames << std::endl;
+    if (seconds > 0) {
+        // with capture_backend replay and replay_timing fast, the pipeline's maximum rate
+        printf("Average rate: %.1f fps over %.1f s\n", nFrames / seconds, seconds);
+    }
+    return nFrames;
+}
+
+bool M2CameraDriver::keepRunning()
+{
+    if (!m_running || !::ros::ok()) {
+        return false;
+    }
+    // an XML-RPC round trip, not on every frame
+    const int64_t now = monotonicNow();
+    if ((now - m_lastMasterCheck) * 1e-9 < kMasterCheckPeriod) {
+        return true;
+    }
+    m_lastMasterCheck = now;
+    return ::ros::master::check();
+}
+
+size_t M2CameraDriver::runSerial()
+{
+    m_framePool.resize(1);
+    m_framePool[0].reset(new StereoFrame());
+    StereoFrame& frame = *m_framePool[0];
+
+    size_t nFrames = 0;
+    while (keepRunning()) {
+        m_graph.update();
+        if (!grab(frame)) {
+            break;
+        }
+        nFrames++;
+        // with no active stage the buffer just goes back to the driver
+        bool ok = m_graph.run(frame);
+        releaseFrame(frame);
+        if (ok) {
+            finishFrame(frame);
+        }
+        frame.reset();
+        publishDiagnostics();
+        if (!ok) {
+            break;
+        }
+    }
+    return nFrames;
+}
+
+size_t M2CameraDriver::runPipelined()
+{
+    // one frame per queue slot and per thread, so capture never waits for
+    // a free frame under drop_oldest
+    const size_t poolSize = (size_t)kSteps * m_queueSize + kSteps + 1;
+    m_framePool.resize(poolSize);
+    m_free.reset(new BoundedQueue<StereoFrame*>(poolSize));
+    for (size_t i = 0; i < poolSize; i++) {
+        m_framePool[i].reset(new StereoFrame());
+        m_free->push(m_framePool[i].get());
+    }
+    for (int i = 0; i < kSteps; i++) {
+        m_queues[i].reset(new BoundedQueue<StereoFrame*>(m_queueSize, m_queuePolicy,
+            [this](StereoFrame* const& frame) { recycle(frame); }));
+    }
+    for (int i = 0; i < kSteps; i++) {
+        m_workers[i] = std::thread(&M2CameraDriver::worker, this, i);
+    }
+
+    setCurrentThreadName("m2_capture");
+    pinCurrentThread(m_cpuAffinity[0]);
+    size_t nFrames = 0;
+    while (keepRunning()) {
+        m_graph.update();
+        StereoFrame* frame = nullptr;
+        if (!m_free->pop(frame)) {
+            break;
+        }
+        if (!grab(*frame)) {
+            recycle(frame);
+            break;
+        }
+        nFrames++;
+        publishDiagnostics();
+        if (frame->stages == 0) {
+            recycle(frame);
+            continue;
+        }
+        if (!m_queues[0]->push(frame)) {
+            recycle(frame);
+            break;
+        }
+    }
+
+    // workers drain what is queued, then close the queue after them
+    m_queues[0]->close();
+    for (int i = 0; i < kSteps; i++) {
+        m_workers[i].join();
+    }
+    size_t dropped = 0;
+    for (int i = 0; i < kSteps; i++) {
+        dropped += m_queues[i]->dropped();
+    }
+    if (dropped > 0) {
+        std::cout << "Frames dropped in the pipeline: " << dropped << std::endl;
+    }
+    return nFrames;
+}
+
+size_t M2CameraDriver::runPooled()
+{
+    // one frame being captured, one being processed, queue_size waiting
+    const size_t poolSize = (size_t)m_queueSize + 2;
+    m_framePool.resize(poolSize);
+    m_free.reset(new BoundedQueue<StereoFrame*>(poolSize));
+    for (size_t i = 0; i < poolSize; i++) {
+        m_framePool[i].reset(new StereoFrame());
+        m_free->push(m_framePool[i].get());
+    }
+    m_poolSource = m_workerPool->addSource(m_namespace, m_queueSize, m_queuePolicy);
+
+    setCurrentThreadName("m2_capture");
+    pinCurrentThread(m_cpuAffinity[0]);
+    size_t nFrames = 0;
+    while (keepRunning()) {
+        m_graph.update();
+        StereoFrame* frame = nullptr;
+        if (!m_free->pop(frame)) {
+            break;
+        }
+        if (!grab(*frame)) {
+            recycle(frame);
+            break;
+        }
+        nFrames++;
+        publishDiagnostics();
+        if (frame->stages == 0) {
+            recycle(frame);
+            continue;
+        }
+        // the pool runs one frame of this camera at a time, in order
+        WorkerPool::Task task;
+        task.run = [this, frame] { processFrame(frame); };
+        task.drop = [this, frame] { recycle(frame); };
+        if (!m_workerPool->submit(m_poolSource, task)) {
+            recycle(frame);
+            break;
+        }
+    }
+    m_workerPool->drain(m_poolSource);
+    const size_t dropped = m_workerPool->dropped(m_poolSource);
+    if (dropped > 0) {
+        std::cout << "Frames dropped in the worker pool: " << dropped << std::endl;
+    }
+    return nFrames;
+}
+
+void M2CameraDriver::processFrame(StereoFrame* frame)
+{
+    bool ok = m_graph.run(*frame);
+    releaseFrame(*frame);
+    if (ok) {
+        finishFrame(*frame);
+    } else {
+        m_running = false;
+    }
+    recycle(frame);
+}
+
+void M2CameraDriver::worker(int step)
+{
+    static const char* names[kSteps] = { "m2_decode", "m2_rectify", "m2_publish" };
+    setCurrentThreadName(names[step]);
+    pinCurrentThread(m_cpuAffinity[step + 1]);
+
+    StereoFrame* frame = nullptr;
+    while (m_queues[step]->pop(frame)) {
+        bool ok = m_graph.run(*frame, m_stepFirst[step], m_stepFirst[step + 1]);
+        if (step == 0) {
+            // later steps only need the decoded frame
+            releaseFrame(*frame);
+        }
+        if (!ok) {
+            m_running = false;
+            recycle(frame);
+        } else if (step + 1 == kSteps) {
+            finishFrame(*frame);
+            recycle(frame);
+        } else if (!m_queues[step + 1]->push(frame)) {
+            recycle(frame);
+        }
+    }
+    if (step + 1 < kSteps) {
+        m_queues[step + 1]->close();
+    }
+}
+
+void M2CameraDriver::recycle(StereoFrame* frame)
+{
+    releaseFrame(*frame);
+    frame->reset();
+    m_free->push(frame);
+}
+
+void M2CameraDriver::finishFrame(const StereoFrame& frame)
+{
+    if (frame.stages != 0) {
+        m_latency.record("end_to_end", (monotonicNow() - frame.captured.timestamp_ns) * 1e-9);
+    }
+}
+
+void M2CameraDriver::publishDiagnostics()
+{
+    const int64_t now = monotonicNow();
+    const double period = (now - m_lastDiagnostics) * 1e-9;
+    if (period < m_diagnosticPeriod) {
+        return;
+    }
+    m_lastDiagnostics = now;
+
+    if (m_pipelined) {
+        size_t dropped = 0;
+        for (int i = 0; i < kSteps; i++) {
+            dropped += m_queues[i]->dropped();
+        }
+        m_latency.setPipelineDropped(dropped);
+    } else if (m_workerPool) {
+        m_latency.setPipelineDropped(m_workerPool->dropped(m_poolSource));
+    }
+    diagnostic_msgs::DiagnosticArrayPtr msg = boost::make_shared<diagnostic_msgs::DiagnosticArray>();
+    msg->header.stamp = ros::Time::now();
+    msg->status.resize(1);
+    diagnostic_msgs::DiagnosticStatus& status = msg->status[0];
+    m_latency.report(status, period, m_maxLatency);
+    status.name = ros::this_node::getName() + ": " + m_namespace;
+    status.hardware_id = m_deviceName;
+    if (!m_clock.empty()) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", m_clock.driftPpm());
+        diagnostic_msgs::KeyValue kv;
+        kv.key = "clock drift ppm";
+        kv.value = buf;
+        status.values.push_back(kv);
+    }
+    // constant once every pool has its slots, steady state publishes allocate nothing
+    uint64_t acquired = 0, allocations = 0;
+    size_t slots = 0;
+    auto count = [&](const ImagePool::Stats& s) {
+        acquired += s.acquired;
+        allocations += s.allocations;
+        slots += s.slots;
+    };
+    count(m_rawPool.stats());
+    count(m_rectPool.stats());
+    count(m_rectColorPool.stats());
+    count(m_roiPool.stats());
+    for (size_t i = 0; i < m_rectStreams.size(); i++) {
+        count(m_rectStreams[i].pool->stats());
+    }
+    auto countJpeg = [&](const JpegPool::Stats& s) {
+        acquired += s.acquired;
+        allocations += s.allocations;
+        slots += s.slots;
+    };
+    countJpeg(m_rawJpegPool.stats());
+    if (m_rectCompressed) {
+        countJpeg(m_rectJpeg.pool->stats());
+        countJpeg(m_rectColorJpeg.pool->stats());
+        for (size_t i = 0; i < m_rectStreams.size(); i++) {
+            countJpeg(m_rectStreams[i].jpeg.pool->stats());
+        }
+    }
+    diagnostic_msgs::KeyValue kv;
+    kv.key = "messages";
+    kv.value = std::to_string(acquired);
+    status.values.push_back(kv);
+    kv.key = "message allocations";
+    kv.value = std::to_string(allocations);
+    status.values.push_back(kv);
+    kv.key = "pooled messages";
+    kv.value = std::to_string(slots);
+    status.values.push_back(kv);
+    m_pubDiagnostics.publish(diagnostic_msgs::DiagnosticArrayConstPtr(msg));
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <ros/ros.h>
+
+#include "usb_camera/m2_camera_driver.h"
+#include "usb_camera/worker_pool.h"
+
+// Several stereo cameras in one process. ~cameras lists their names, camera
+// <name> takes its parameters from ~<name>/ (device, calibration_file,
+// capture_backend, queue_size, cpu_affinity, ...) and publishes under
+// <name>/ unless ~<name>/namespace says otherwise. Every camera captures on
+// its own thread, decoding, rectification and encoding of all cameras share
+// one pool of ~pool_threads threads (0: one per core), pinned to ~pool_cpus if given.
+// Parallel loops of the stages run on the pool too; OpenCV functions run on
+// the pool thread calling them rather than on threads of their own.
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "m2_camera_multi");
+    ros::NodeHandle nh;
+    ros::NodeHandle pnh("~");
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+
+    std::vector<std::string> cameras;
+    pnh.param("cameras", cameras, std::vector<std::string>());
+    if (cameras.empty()) {
+        std::cerr << "ERROR: ~cameras lists no camera" << std::endl;
+        return 1;
+    }
+    int poolThreads;
+    pnh.param("pool_threads", poolThreads, 0);
+    if (poolThreads <= 0) {
+        poolThreads = (int)std::thread::hardware_concurrency();
+    }
+    std::vector<int> poolCpus;
+    pnh.param("pool_cpus", poolCpus, std::vector<int>());
+    // the pool is the only set of threads, don't oversubscribe its cores
+    cv::setNumThreads(1);
+    usb_camera::WorkerPool pool(poolThreads, poolCpus);
+    std::cout << cameras.size() << " cameras, " << pool.threads() << " pool threads" << std::endl;
+
+    std::vector<std::unique_ptr<usb_camera::M2CameraDriver> > drivers;
+    for (size_t i = 0; i < cameras.size(); i++) {
+        ros::NodeHandle cnh(pnh, cameras[i]);
+        if (!cnh.hasParam("namespace")) {
+            cnh.setParam("namespace", cameras[i]);
+        }
+        std::unique_ptr<usb_camera::M2CameraDriver> driver(new usb_camera::M2CameraDriver(nh, cnh));
+        driver->setWorkerPool(&pool);
+        if (!driver->init(std::vector<std::string>())) {
+            std::cerr << "ERROR: Camera " << cameras[i] << " can't be opened" << std::endl;
+            return 1;
+        }
+        drivers.push_back(std::move(driver));
+    }
+
+    std::vector<size_t> nFrames(drivers.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < drivers.size(); i++) {
+        threads.push_back(std::thread([&drivers, &nFrames, i] { nFrames[i] = drivers[i]->run(); }));
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+        total += nFrames[i];
+    }
+    pool.stop();
+    return total > 0 ? 0 : 1;
+}
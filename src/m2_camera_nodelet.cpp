@@ -0,0 +1,44 @@
+#include <memory>
+#include <thread>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "usb_camera/m2_camera_driver.h"
+
+namespace usb_camera {
+
+// Runs M2CameraDriver inside a nodelet manager. Arguments are the same as
+// for m2_camera_calib, e.g.
+//   nodelet load usb_camera/M2CameraNodelet manager /dev/video2
+class M2CameraNodelet : public nodelet::Nodelet {
+public:
+    ~M2CameraNodelet()
+    {
+        if (m_driver) {
+            m_driver->stop();
+        }
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+private:
+    void onInit() override
+    {
+        m_driver.reset(new M2CameraDriver(getNodeHandle(), getPrivateNodeHandle()));
+        if (!m_driver->init(getMyArgv())) {
+            NODELET_ERROR("m2_camera: driver initialization failed");
+            return;
+        }
+        // onInit must return, the capture loop gets its own thread
+        m_thread = std::thread([this] { m_driver->run(); });
+    }
+
+    std::unique_ptr<M2CameraDriver> m_driver;
+    std::thread m_thread;
+};
+
+}  // namespace usb_camera
+
+PLUGINLIB_EXPORT_CLASS(usb_camera::M2CameraNodelet, nodelet::Nodelet)
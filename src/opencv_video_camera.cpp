@@ -1,57 +1,65 @@
 #include <opencv2/core.hpp>
-#include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <sys/stat.h>
 
+#include "usb_camera/jpeg_codec.h"
+#include "usb_camera/stereo_recorder.h"
+#include "usb_camera/v4l2_capture.h"
+
 using namespace cv;
 using namespace std;
+using usb_camera::toggleRecording;
 
 int main(int argc, char** argv)
 {
     std::string deviceName = "/dev/video0";
-    int apiID = cv::CAP_V4L2;
     string save_path = "/dev/shm/";
-    if (argc >= 2) {
-        deviceName = argv[1];
+    bool record = false;
+    bool directIo = false;
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--record") {
+            record = true;
+        } else if (arg == "--direct-io") {
+            directIo = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() >= 1) {
+        deviceName = args[0];
     }
-    if (argc >= 3) {
-        save_path = argv[2];
+    if (args.size() >= 2) {
+        save_path = args[1];
     }
     cout << "Opening camera " << deviceName << endl;
-    VideoCapture capture(deviceName, apiID); // open the camera
-    if (!capture.isOpened())
+    // the MJPEG bitstream straight from the driver buffers, recorded undecoded
+    usb_camera::V4L2Capture capture;
+    usb_camera::CaptureFormat format;
+    // format.width = 2560;
+    // format.height = 720;
+    // format.width = 1280;
+    // format.height = 480;
+    format.width = 640;
+    format.height = 240;
+    format.fps = 30.0;
+    if (!capture.open(deviceName, format))
     {
         cerr << "ERROR: Can't initialize camera capture" << endl;
         return 1;
     }
+    format = capture.format();
 
-    int codec = VideoWriter::fourcc('M', 'J', 'P', 'G');
-    // int codec = VideoWriter::fourcc('Y', 'U', 'Y', 'V');
-    // int codec = VideoWriter::fourcc('R', 'G', 'B', '3');
-    // int codec = VideoWriter::fourcc('B', 'G', 'R', '3');
-    // int codec = VideoWriter::fourcc('Y', 'U', '1', '2');
-    // int codec = VideoWriter::fourcc('Y', 'V', '1', '2');
-    capture.set(CAP_PROP_FOURCC,codec);
-    // capture.set(CAP_PROP_FRAME_WIDTH, 2560);
-    // capture.set(CAP_PROP_FRAME_HEIGHT, 720);
-    // capture.set(CAP_PROP_FRAME_WIDTH, 1280);
-    // capture.set(CAP_PROP_FRAME_HEIGHT, 480);
-    capture.set(CAP_PROP_FRAME_WIDTH, 640);
-    capture.set(CAP_PROP_FRAME_HEIGHT, 240);
-    // capture.set(CAP_PROP_FORMAT, -1);
-    // capture.set(CAP_PROP_MODE, 3);
-    // capture.set(CAP_PROP_FRAME_WIDTH, 1280);
-    // capture.set(CAP_PROP_FRAME_HEIGHT, 720);
-    capture.set(CAP_PROP_FPS, 30.0);
+    cout << "Frame width: " << format.width << endl;
+    cout << "     height: " << format.height << endl;
+    cout << "Capturing FPS: " << format.fps << endl;
 
-    cout << "Frame width: " << capture.get(CAP_PROP_FRAME_WIDTH) << endl;
-    cout << "     height: " << capture.get(CAP_PROP_FRAME_HEIGHT) << endl;
-    cout << "Capturing FPS: " << capture.get(CAP_PROP_FPS) << endl;
-
-    cout << endl << "Press 'ESC' to quit, 's' to save image" << endl;
+    cout << endl << "Press 'ESC' to quit, 's' to save image, 'r' to start/stop recording" << endl;
     cout << endl << "Start grabbing..." << endl;
 
     std::string mkdir_pack_left = "mkdir -p " + save_path + "left/";
@@ -60,26 +68,61 @@ int main(int argc, char** argv)
     system(mkdir_pack_right.c_str());
 
     Mat frame;
+    Mat storage;
+    usb_camera::JpegCodec jpeg;
     size_t nFrames = 0;
     int64 t0 = cv::getTickCount();
     int save_id = 0;
+    // every frame goes to the recording, the disk is written from its own thread
+    usb_camera::StereoRecorder recorder;
+    if (record) {
+        toggleRecording(recorder, save_path, directIo);
+    }
     for (;;)
     {
-        capture >> frame; // read the next frame from camera
-        if (frame.empty())
+        usb_camera::CapturedFrame captured;
+        if (!capture.dequeue(captured, 1000))
         {
             cerr << "ERROR: Can't grab camera frame." << endl;
             break;
         }
         nFrames++;
+        // stamped with the V4L2 buffer timestamp (CLOCK_MONOTONIC)
+        bool ok;
+        if (captured.fourcc == usb_camera::fourcc('M', 'J', 'P', 'G')) {
+            if (recorder.isOpen()) {
+                recorder.writeJpeg(captured.timestamp_ns, captured.data.ptr(), captured.bytesused, format.width,
+                                   format.height);
+            }
+            ok = jpeg.decode(captured.data.ptr(), captured.bytesused, frame);
+        } else {
+            ok = usb_camera::convertToBgr(captured, frame);
+            if (ok && recorder.isOpen()) {
+                recorder.write(captured.timestamp_ns, frame);
+            }
+            if (ok && !frame.u) {
+                // BGR3 is a view of the driver buffer
+                frame.copyTo(storage);
+                frame = storage;
+            }
+        }
+        capture.release(captured);
+        if (!ok)
+        {
+            cerr << "ERROR: Can't decode camera frame." << endl;
+            break;
+        }
         if (nFrames % 10 == 0)
         {
             const int N = 10;
             int64 t1 = cv::getTickCount();
             cout << "Frames captured: " << cv::format("%5lld", (long long int)nFrames)
                  << "    Average FPS: " << cv::format("%9.1f", (double)getTickFrequency() * N / (t1 - t0))
-                 << "    Average time per frame: " << cv::format("%9.2f ms", (double)(t1 - t0) * 1000.0f / (N * getTickFrequency()))
-                 << std::endl;
+                 << "    Average time per frame: " << cv::format("%9.2f ms", (double)(t1 - t0) * 1000.0f / (N * getTickFrequency()));
+            if (recorder.isOpen()) {
+                cout << "    Recorded: " << recorder.recorded() << " (dropped " << recorder.dropped() << ")";
+            }
+            cout << std::endl;
             t0 = t1;
         }
         // imshow("Frame", frame);
@@ -99,9 +142,14 @@ int main(int argc, char** argv)
             cout << "Save " << save_path_left << endl;
             cout << "Save " << save_path_right << endl;
             save_id++;
+        } else if (key == 'r') {
+            toggleRecording(recorder, save_path, directIo);
         }
 
     }
+    if (recorder.isOpen()) {
+        toggleRecording(recorder, save_path, directIo);
+    }
     std::cout << "Number of captured frames: " << nFrames << endl;
     return nFrames > 0 ? 0 : 1;
 }
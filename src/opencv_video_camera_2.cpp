@@ -1,139 +1,269 @@
 #include <opencv2/core.hpp>
-#include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 #include <iostream>
 #include <string>
+#include <cstdlib>
 
 #include <thread>
-#include <mutex>
 #include <atomic>
 #include <chrono>
+#include <vector>
 
 #include <sys/stat.h>
 
+#include "usb_camera/jpeg_codec.h"
+#include "usb_camera/stereo_matcher.h"
+#include "usb_camera/stereo_recorder.h"
+#include "usb_camera/triple_buffer.h"
+#include "usb_camera/v4l2_capture.h"
+
 using namespace cv;
 using namespace std;
+using usb_camera::toggleRecording;
 
 Mat frame1, frame2;
 
-class VideoCaptureMT {
+struct StereoPair {
+    cv::Mat left, right;    // MJPEG bitstreams, 1 x size
+    int64_t stamp_ns[2];
+};
+
+// Both cameras are serviced by one thread: their V4L2 buffers are dequeued
+// back to back so the exposures are as close as the drivers allow, and the
+// MJPEG bitstreams are copied out. Frames are paired by their buffer
+// timestamps within `tolerance`, a camera that fell a frame behind has its
+// stale frame dropped instead of being paired with the wrong moment. Every
+// matched pair is handed to `recorder` (if it is recording) undecoded before
+// the display may skip it; read() decodes only the pairs it returns.
+//
+// The bitstreams are copied into preallocated buffers per camera. A buffer
+// travels through the matcher and the pair buffer and is filled again once
+// only the pool references it, so steady-state capture allocates nothing.
+class StereoCaptureMT {
 public:
-    VideoCaptureMT(std::string deviceName, int apiID, int height=480, int width=640);
-    ~VideoCaptureMT();
-    
+    StereoCaptureMT(const std::string& deviceName1, const std::string& deviceName2,
+                    double tolerance_ms, usb_camera::StereoRecorder* recorder = nullptr,
+                    int height=480, int width=640);
+    ~StereoCaptureMT();
+
     bool isOpened() {
         return m_IsOpen;
     }
     void release() {
         m_IsOpen = false;
     }
-    bool read(cv::Mat& frame);
+    // Wait for the next matched pair and decode it into the caller's Mats,
+    // which are reused when they have the size, so pass the same Mats every time.
+    bool read(cv::Mat& left, cv::Mat& right, int64_t* stamp_ns = nullptr);
+
+    size_t matched() const { return m_matched; }
+    size_t dropped(int k) const { return m_dropped[k]; }
 
 private:
-    void captureFrame();
+    void captureFrames();
+    // A buffer of camera k of at least `size` bytes nobody else references,
+    // a new one while all are in use.
+    cv::Mat& idleFrame(int k, size_t size);
+
+    // matcher depth per camera, the three pair slots and the pair being
+    // handed over
+    static const int kFrames = 8;
 
-    int m_index;
-    bool m_pFrame_next;
-    cv::VideoCapture* m_pCapture;
-    cv::Mat* m_pFrame;
-    std::mutex* m_pMutex;
+    usb_camera::V4L2Capture m_capture[2];
+    cv::Size m_size;
+    usb_camera::StereoMatcher<cv::Mat> m_matcher;
+    std::vector<cv::Mat> m_frames[2];   // capture thread only
+    usb_camera::TripleBuffer<StereoPair> m_pairs;
+    usb_camera::JpegCodec m_decoder;    // read() only
+    usb_camera::StereoRecorder* m_recorder;
     std::thread* m_pThread;
     std::atomic_bool m_IsOpen;
+    std::atomic<size_t> m_matched;
+    std::atomic<size_t> m_dropped[2];
 };
 
 
-VideoCaptureMT::VideoCaptureMT(std::string deviceName, int apiID, int height, int width)
+StereoCaptureMT::StereoCaptureMT(const std::string& deviceName1, const std::string& deviceName2,
+                                 double tolerance_ms, usb_camera::StereoRecorder* recorder, int height, int width)
+    : m_size(width, height),
+      m_matcher((int64_t)(tolerance_ms * 1e6)),
+      m_recorder(recorder),
+      m_pThread(nullptr),
+      m_matched(0)
 {
-    m_pCapture = new cv::VideoCapture(deviceName, apiID);
-
-    int codec = VideoWriter::fourcc('M', 'J', 'P', 'G');
-    m_pCapture->set(cv::CAP_PROP_FOURCC,codec);
-    m_pCapture->set(cv::CAP_PROP_FRAME_WIDTH, width);
-    m_pCapture->set(cv::CAP_PROP_FRAME_HEIGHT, height);
-    m_pCapture->set(cv::CAP_PROP_FPS, 30);
-
-    cout << "camera " << deviceName << endl;
-    cout << "Frame width: " << m_pCapture->get(CAP_PROP_FRAME_WIDTH) << endl;
-    cout << "     height: " << m_pCapture->get(CAP_PROP_FRAME_HEIGHT) << endl;
-    cout << "Capturing FPS: " << m_pCapture->get(CAP_PROP_FPS) << endl;
-
-    m_IsOpen = true;
-    m_pFrame_next = false;
-    m_pFrame = new cv::Mat(height, width, CV_8UC3);
-    m_pMutex = new std::mutex();
-    m_pThread = new std::thread(&VideoCaptureMT::captureFrame, this);
+    m_dropped[0] = 0;
+    m_dropped[1] = 0;
+    const std::string names[2] = { deviceName1, deviceName2 };
+    bool opened = true;
+    for (int k = 0; k < 2; k++) {
+        usb_camera::CaptureFormat format;
+        format.width = width;
+        format.height = height;
+        format.fps = 30;
+        if (!m_capture[k].open(names[k], format)) {
+            opened = false;
+            continue;
+        }
+        format = m_capture[k].format();
+        m_size = cv::Size(format.width, format.height);
+
+        cout << "camera " << names[k] << endl;
+        cout << "Frame width: " << format.width << endl;
+        cout << "     height: " << format.height << endl;
+        cout << "Capturing FPS: " << format.fps << endl;
+    }
+    cout << "Pairing tolerance: " << tolerance_ms << " ms" << endl;
+
+    m_IsOpen = opened;
+    for (int k = 0; k < 2; k++) {
+        m_frames[k].resize(kFrames);
+        for (int i = 0; i < kFrames; i++) {
+            // well above a compressed frame
+            m_frames[k][i].create(1, m_size.area(), CV_8UC1);
+        }
+    }
+    if (m_IsOpen) {
+        m_pThread = new std::thread(&StereoCaptureMT::captureFrames, this);
+    }
 }
 
-VideoCaptureMT::~VideoCaptureMT()
+StereoCaptureMT::~StereoCaptureMT()
 {
     m_IsOpen = false;
-    m_pThread->join();
-    if (m_pCapture->isOpened()) {
-        m_pCapture->release();
+    if (m_pThread) {
+        m_pThread->join();
+        delete m_pThread;
+    }
+    for (int k = 0; k < 2; k++) {
+        m_capture[k].close();
     }
-
-    delete m_pThread;
-    delete m_pMutex;
-    delete m_pCapture;
-    delete m_pFrame;
 }
 
-void VideoCaptureMT::captureFrame()
+cv::Mat& StereoCaptureMT::idleFrame(int k, size_t size)
 {
-    while (m_IsOpen) {
-        m_pMutex->lock();
-        (*m_pCapture) >> (*m_pFrame);
-        m_pFrame_next = true;
-        m_pMutex->unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::vector<cv::Mat>& frames = m_frames[k];
+    for (size_t i = 0; i < frames.size(); i++) {
+        // the matcher dropped it or the reader moved on; nobody but the pool
+        // can add a reference now
+        if (!frames[i].u || CV_XADD(&frames[i].u->refcount, 0) == 1) {
+            if ((size_t)frames[i].cols < size) {
+                frames[i].create(1, (int)size, CV_8UC1);
+            }
+            return frames[i];
+        }
     }
+    frames.push_back(cv::Mat(1, (int)size, CV_8UC1));
+    return frames.back();
 }
 
-bool VideoCaptureMT::read(cv::Mat& frame)
+void StereoCaptureMT::captureFrames()
 {
-    if (m_pFrame->empty()) {
-        m_IsOpen = false;
-    } else {
-        while (1) {
-            if (m_pFrame_next) {
-                m_pMutex->lock();
-                m_pFrame->copyTo(frame);
-                m_pFrame_next = false;
-                m_pMutex->unlock();
+    // the blocking dequeues pace this loop at the camera rate
+    while (m_IsOpen) {
+        int64_t stamp[2];
+        cv::Mat bitstream[2];
+        bool ok = true;
+        for (int k = 0; ok && k < 2; k++) {
+            usb_camera::CapturedFrame captured;
+            ok = m_capture[k].dequeue(captured, 1000);
+            if (!ok) {
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ok = captured.fourcc == usb_camera::fourcc('M', 'J', 'P', 'G');
+            if (ok) {
+                // a view of the pool buffer, so the pool sees it in use
+                bitstream[k] = idleFrame(k, captured.bytesused).colRange(0, (int)captured.bytesused);
+                captured.data.colRange(0, (int)captured.bytesused).copyTo(bitstream[k]);
+                stamp[k] = captured.timestamp_ns;
+            } else {
+                cerr << "ERROR: Camera " << k + 1 << " doesn't deliver MJPEG" << endl;
+            }
+            m_capture[k].release(captured);
         }
+        if (!ok) {
+            m_IsOpen = false;
+            break;
+        }
+        for (int k = 0; k < 2; k++) {
+            m_matcher.push(k, stamp[k], bitstream[k]);
+        }
+
+        usb_camera::StereoMatcher<cv::Mat>::Frame l, r;
+        while (m_matcher.pop(l, r)) {
+            if (m_recorder) {
+                // the bitstreams as the cameras sent them, no-op while not recording
+                const int64_t stamps[2] = { l.stamp_ns, r.stamp_ns };
+                m_recorder->writeJpeg(stamps, l.payload, r.payload, m_size);
+            }
+            StereoPair& pair = m_pairs.back();
+            pair.left = l.payload;
+            pair.right = r.payload;
+            pair.stamp_ns[0] = l.stamp_ns;
+            pair.stamp_ns[1] = r.stamp_ns;
+            m_pairs.publish();
+        }
+        m_matched = m_matcher.matched();
+        m_dropped[0] = m_matcher.dropped(0);
+        m_dropped[1] = m_matcher.dropped(1);
     }
-    return m_IsOpen;
+    m_pairs.close();
+}
+
+bool StereoCaptureMT::read(cv::Mat& left, cv::Mat& right, int64_t* stamp_ns)
+{
+    if (!m_pairs.waitAcquire()) {
+        return false;
+    }
+    const StereoPair& pair = m_pairs.front();
+    if (!m_decoder.decode(pair.left.ptr(), pair.left.total(), left) ||
+        !m_decoder.decode(pair.right.ptr(), pair.right.total(), right)) {
+        return false;
+    }
+    if (stamp_ns) {
+        stamp_ns[0] = pair.stamp_ns[0];
+        stamp_ns[1] = pair.stamp_ns[1];
+    }
+    return true;
 }
 
 int main(int argc, char** argv)
 {
     std::string deviceName1 = "/dev/video0";
     std::string deviceName2 = "/dev/video1";
-    int apiID = cv::CAP_V4L2;
     string save_path = "/dev/shm/";
-    if (argc < 3) {
-        cerr << "ERROR: parameter must be (deviceName1 deviceName2 [save_path])" << endl;
+    double tolerance_ms = 1000.0 / 30 / 2;   // half a frame period
+    bool record = false;
+    bool directIo = false;
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--record") {
+            record = true;
+        } else if (arg == "--direct-io") {
+            directIo = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() < 2) {
+        cerr << "ERROR: parameter must be (deviceName1 deviceName2 [save_path [tolerance_ms]] [--record] [--direct-io])" << endl;
         return 1;
     }
-    deviceName1 = argv[1];
-    deviceName2 = argv[2];
-    if (argc >= 4) {
-        save_path = argv[3];
+    deviceName1 = args[0];
+    deviceName2 = args[1];
+    if (args.size() >= 3) {
+        save_path = args[2];
     }
-    cout << "Opening camera..." << endl;
-    VideoCaptureMT capture1(deviceName1, apiID); // open the first camera
-    VideoCaptureMT capture2(deviceName2, apiID); // open the second camera
-    if (!capture1.isOpened())
-    {
-        cerr << "ERROR: Can't initialize camera capture1" << endl;
-        return 1;
+    if (args.size() >= 4) {
+        tolerance_ms = atof(args[3].c_str());
     }
-    if (!capture2.isOpened())
+    // declared before the capture so it outlives the capture thread
+    usb_camera::StereoRecorder recorder;
+    cout << "Opening camera..." << endl;
+    StereoCaptureMT capture(deviceName1, deviceName2, tolerance_ms, &recorder); // open both cameras
+    if (!capture.isOpened())
     {
-        cerr << "ERROR: Can't initialize camera capture2" << endl;
+        cerr << "ERROR: Can't initialize camera capture" << endl;
         return 1;
     }
 
@@ -157,7 +287,7 @@ int main(int argc, char** argv)
     // cout << "     height: " << capture2.get(CAP_PROP_FRAME_HEIGHT) << endl;
     // cout << "Capturing FPS: " << capture2.get(CAP_PROP_FPS) << endl;
 
-    cout << endl << "Press 'ESC' to quit, 'space' to toggle frame processing" << endl;
+    cout << endl << "Press 'ESC' to quit, 's' to save image, 'r' to start/stop recording" << endl;
     cout << endl << "Start grabbing..." << endl;
 
     std::string mkdir_pack_left = "mkdir -p " + save_path + "left/";
@@ -168,10 +298,14 @@ int main(int argc, char** argv)
     size_t nFrames = 0;
     auto t0 = chrono::steady_clock::now();
     int save_id = 0;
-    while (capture1.isOpened() && capture2.isOpened())
+    if (record) {
+        toggleRecording(recorder, save_path, directIo);
+    }
+    while (capture.isOpened())
     {
 
-        if (!capture1.read(frame1) || !capture2.read(frame2)) {
+        int64_t stamp_ns[2];
+        if (!capture.read(frame1, frame2, stamp_ns)) {
             cerr << "ERROR: Can't grab camera frame." << endl;
             break;
         }
@@ -184,7 +318,12 @@ int main(int argc, char** argv)
             cout << "Frames captured: " << cv::format("%5lld", (long long int)nFrames)
                  << "    Average FPS: " << cv::format("%9.1f", 1000000.0 * N / chrono::duration_cast<chrono::microseconds>(t1 - t0).count())
                  << "    Average time per frame: " << cv::format("%9.2f ms", chrono::duration_cast<chrono::microseconds>(t1 - t0).count()/1000.0/N)
-                 << std::endl;
+                 << "    Pair skew: " << cv::format("%6.2f ms", (stamp_ns[1] - stamp_ns[0]) / 1e6)
+                 << "    Dropped: " << capture.dropped(0) << "/" << capture.dropped(1);
+            if (recorder.isOpen()) {
+                cout << "    Recorded: " << recorder.recorded() << " (dropped " << recorder.dropped() << ")";
+            }
+            cout << std::endl;
             t0 = t1;
         }
 
@@ -203,9 +342,14 @@ int main(int argc, char** argv)
             cout << "Save " << save_path_left << endl;
             cout << "Save " << save_path_right << endl;
             save_id++;
+        } else if (key == 'r') {
+            toggleRecording(recorder, save_path, directIo);
         }
 
     }
+    if (recorder.isOpen()) {
+        toggleRecording(recorder, save_path, directIo);
+    }
     std::cout << "Number of captured frames: " << nFrames << endl;
     return nFrames > 0 ? 0 : 1;
 }
@@ -0,0 +1,178 @@
+#include "usb_camera/rectify_maps.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace usb_camera {
+
+namespace {
+
+const char kMagic[8] = { 'M', '2', 'R', 'M', 'A', 'P', 'S', '\0' };
+const size_t kAlign = 64;
+
+struct RectifyMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t sourceHash;
+    char opencvVersion[16];
+    int32_t width;
+    int32_t height;
+    uint64_t offset[4];     // map1[0], map2[0], map1[1], map2[1]
+    uint64_t fileSize;
+};
+
+size_t alignUp(size_t n)
+{
+    return (n + kAlign - 1) / kAlign * kAlign;
+}
+
+// Byte size of map `i` (map1: 2 x int16, map2: uint16 per pixel).
+size_t mapBytes(int i, cv::Size size)
+{
+    return (size_t)size.area() * (i % 2 == 0 ? 4 : 2);
+}
+
+void fillHeader(RectifyMapHeader& h, uint64_t sourceHash, cv::Size size)
+{
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = RectifyMaps::kVersion;
+    h.headerSize = sizeof(RectifyMapHeader);
+    h.sourceHash = sourceHash;
+    strncpy(h.opencvVersion, CV_VERSION, sizeof(h.opencvVersion) - 1);
+    h.width = size.width;
+    h.height = size.height;
+    size_t offset = alignUp(sizeof(RectifyMapHeader));
+    for (int i = 0; i < 4; i++) {
+        h.offset[i] = offset;
+        offset = alignUp(offset + mapBytes(i, size));
+    }
+    h.fileSize = offset;
+}
+
+// mkdir -p for the directory part of `path`
+void makeParentDirs(const std::string& path)
+{
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        mkdir(path.substr(0, pos).c_str(), 0755);
+    }
+}
+
+}  // namespace
+
+RectifyMaps::RectifyMaps()
+    : m_data(nullptr),
+      m_size(0)
+{
+}
+
+RectifyMaps::~RectifyMaps()
+{
+    unmap();
+}
+
+void RectifyMaps::unmap()
+{
+    for (int k = 0; k < 2; k++) {
+        map1[k].release();
+        map2[k].release();
+    }
+    if (m_data) {
+        munmap(m_data, m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
+
+bool RectifyMaps::load(const std::string& cachePath, uint64_t sourceHash, const StereoCameraModel& model,
+                       const StereoCameraModel& output)
+{
+    unmap();
+    if (!cachePath.empty() && mapFile(cachePath, sourceHash, output.imageSize)) {
+        return true;
+    }
+    model.rectifyMaps(output, map1, map2);
+    if (!cachePath.empty() && writeFile(cachePath, sourceHash)) {
+        std::cout << "Rectification maps cached in " << cachePath << std::endl;
+    }
+    return true;
+}
+
+bool RectifyMaps::mapFile(const std::string& path, uint64_t sourceHash, cv::Size size)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    RectifyMapHeader expected, h;
+    fillHeader(expected, sourceHash, size);
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != expected.fileSize ||
+        pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(&h, &expected, sizeof(h)) != 0) {
+        // stale, from another calibration, version or OpenCV build
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "WARNING: Can't mmap " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_data = data;
+    m_size = st.st_size;
+    // read only views, nothing writes to the maps
+    uchar* base = static_cast<uchar*>(m_data);
+    for (int k = 0; k < 2; k++) {
+        map1[k] = cv::Mat(size, CV_16SC2, base + h.offset[2 * k]);
+        map2[k] = cv::Mat(size, CV_16UC1, base + h.offset[2 * k + 1]);
+    }
+    return true;
+}
+
+bool RectifyMaps::writeFile(const std::string& path, uint64_t sourceHash) const
+{
+    const cv::Size size = map1[0].size();
+    RectifyMapHeader h;
+    fillHeader(h, sourceHash, size);
+    std::vector<uchar> file(h.fileSize, 0);
+    memcpy(file.data(), &h, sizeof(h));
+    for (int k = 0; k < 2; k++) {
+        const cv::Mat* maps[2] = { &map1[k], &map2[k] };
+        for (int m = 0; m < 2; m++) {
+            const int i = 2 * k + m;
+            const size_t rowBytes = mapBytes(i, size) / size.height;
+            for (int y = 0; y < size.height; y++) {
+                memcpy(&file[h.offset[i] + y * rowBytes], maps[m]->ptr(y), rowBytes);
+            }
+        }
+    }
+
+    // write next to the target and rename, a reader never sees half a file
+    makeParentDirs(path);
+    const std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        std::cerr << "WARNING: Can't write rectification map cache " << tmp << std::endl;
+        return false;
+    }
+    bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "WARNING: Can't replace rectification map cache " << path << std::endl;
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,339 @@
+#include "usb_camera/replay_capture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <sys/stat.h>
+
+namespace usb_camera {
+
+bool parseReplayTiming(const std::string& name, ReplayTiming& timing)
+{
+    if (name == "original") {
+        timing = ReplayTiming::Original;
+    } else if (name == "fixed") {
+        timing = ReplayTiming::Fixed;
+    } else if (name == "fast") {
+        timing = ReplayTiming::Fast;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+ReplayCapture::ReplayCapture(int bufferCount, const ReplayOptions& options)
+    : m_requestedBuffers(bufferCount < 2 ? 2 : bufferCount),
+      m_options(options),
+      m_rawSize(0),
+      m_isRecording(false),
+      m_count(0),
+      m_readerDone(false),
+      m_end(false),
+      m_sequence(0),
+      m_started(false),
+      m_prevStamp(0)
+{
+    m_options.readAhead = std::max(m_options.readAhead, 1);
+}
+
+ReplayCapture::~ReplayCapture()
+{
+    close();
+}
+
+bool ReplayCapture::open(const std::string& deviceName, const CaptureFormat& format)
+{
+    close();
+    m_format = format;
+    if (m_options.fps <= 0) {
+        m_options.fps = format.fps > 0 ? format.fps : 30.0;
+    }
+
+    m_rawSize = 0;
+    if (format.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        m_rawSize = (size_t)format.width * format.height * 2;
+    } else if (format.fourcc == fourcc('B', 'G', 'R', '3')) {
+        m_rawSize = (size_t)format.width * format.height * 3;
+    } else if (format.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        m_rawSize = (size_t)format.width * format.height;
+    }
+
+    struct stat st;
+    if (endsWith(deviceName, ".m2rec")) {
+        if (!m_recording.open(deviceName)) {
+            return false;
+        }
+        m_isRecording = true;
+        m_count = m_recording.size();
+    } else {
+        std::vector<cv::String> files;
+        if (stat(deviceName.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            cv::glob(deviceName + "/*", files);
+        } else {
+            files.push_back(deviceName);
+        }
+        m_files.assign(files.begin(), files.end());
+        m_count = m_files.size();
+        if (m_options.timing == ReplayTiming::Original) {
+            std::cout << "Frame files carry no timestamps, replaying at " << m_options.fps << " fps" << std::endl;
+        }
+    }
+    if (m_count == 0) {
+        std::cerr << "ERROR: No frames found in " << deviceName << std::endl;
+        close();
+        return false;
+    }
+
+    // the consumer may hold bufferCount frames while the reader fills the rest
+    m_buffers.assign(m_requestedBuffers + m_options.readAhead, Buffer());
+    m_empty.reset(new BoundedQueue<int>(m_buffers.size()));
+    m_ready.reset(new BoundedQueue<int>(m_buffers.size()));
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        m_empty->push((int)i);
+    }
+
+    // report the recorded format, not the requested one
+    Buffer& first = m_buffers[0];
+    if (m_isRecording && load(0, first)) {
+        m_format.width = first.width;
+        m_format.height = first.height;
+        m_format.fourcc = first.fourcc;
+    }
+    m_format.fps = m_options.fps;
+
+    m_unreadable.assign(m_count, false);
+    m_readerDone = false;
+    m_end = false;
+    m_sequence = 0;
+    m_started = false;
+    m_prevStamp = 0;
+    m_reader = std::thread(&ReplayCapture::reader, this);
+    return true;
+}
+
+void ReplayCapture::close()
+{
+    if (m_empty) {
+        m_empty->close();
+        m_ready->close();
+    }
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+    m_empty.reset();
+    m_ready.reset();
+    m_buffers.clear();
+    m_files.clear();
+    m_recording.close();
+    m_isRecording = false;
+    m_count = 0;
+}
+
+void ReplayCapture::reader()
+{
+    size_t next = 0;
+    size_t failures = 0;
+    int index = -1;
+    while (m_empty->pop(index)) {
+        if (next == m_count) {
+            if (!m_options.loop) {
+                break;
+            }
+            next = 0;
+        }
+        const size_t i = next++;
+        if (m_unreadable[i] || !load(i, m_buffers[index])) {
+            // warned once, skipped quietly on later loops
+            m_unreadable[i] = true;
+            m_empty->push(index);
+            if (++failures == m_count) {
+                std::cerr << "ERROR: None of the replay frames can be read" << std::endl;
+                break;
+            }
+            continue;
+        }
+        failures = 0;
+        if (m_isRecording) {
+            m_recording.prefetch(i + 1, i + 1 + m_options.readAhead);
+        }
+        if (!m_ready->push(index)) {
+            break;
+        }
+    }
+    m_readerDone = true;
+    m_ready->close();
+}
+
+bool ReplayCapture::load(size_t i, Buffer& b)
+{
+    return m_isRecording ? loadRecord(i, b) : loadFile(m_files[i], b);
+}
+
+bool ReplayCapture::loadFile(const std::string& path, Buffer& b)
+{
+    std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    const size_t size = (size_t)in.tellg();
+    in.seekg(0);
+    if (b.storage.size() < size) {
+        b.storage.resize(size);
+    }
+    if (size == 0 || !in.read(reinterpret_cast<char*>(b.storage.data()), size)) {
+        return false;
+    }
+    b.bytes = size;
+    b.stamp_ns = 0;
+    if (size >= 2 && b.storage[0] == 0xff && b.storage[1] == 0xd8) {
+        b.fourcc = fourcc('M', 'J', 'P', 'G');
+        b.width = m_format.width;
+        b.height = m_format.height;
+    } else if (m_rawSize && size == m_rawSize) {
+        b.fourcc = m_format.fourcc;
+        b.width = m_format.width;
+        b.height = m_format.height;
+    } else {
+        std::cerr << "WARNING: Skip " << path << ", neither a JPEG nor a " << m_format.width << "x"
+                  << m_format.height << " raw frame" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ReplayCapture::loadRecord(size_t i, Buffer& b)
+{
+    StereoRecord r;
+    if (!m_recording.read(i, r)) {
+        return false;
+    }
+    const RecordedImage& l = r.image[0];
+    b.stamp_ns = r.stamp_ns[0];
+    if (r.sideBySide) {
+        b.fourcc = l.fourcc;
+        b.width = l.width;
+        b.height = l.height;
+        b.bytes = l.data.total() * l.data.elemSize();
+        if (b.storage.size() < b.bytes) {
+            b.storage.resize(b.bytes);
+        }
+        memcpy(b.storage.data(), l.data.data, b.bytes);
+        return true;
+    }
+
+    // a pair from two cameras, joined into one side-by-side frame; MJPEG
+    // bitstreams can't be joined, they are decoded first
+    const RecordedImage& rr = r.image[1];
+    uint32_t format = l.fourcc;
+    cv::Mat halves[2] = { l.data, rr.data };
+    if (l.fourcc == fourcc('M', 'J', 'P', 'G') && rr.fourcc == l.fourcc) {
+        for (int k = 0; k < 2; k++) {
+            const cv::Mat& bits = r.image[k].data;
+            if (!m_jpeg.decode(bits.ptr(), bits.total(), m_decoded[k])) {
+                std::cerr << "WARNING: Skip record " << r.sequence << ", it can't be decoded" << std::endl;
+                return false;
+            }
+            halves[k] = m_decoded[k];
+        }
+        format = fourcc('B', 'G', 'R', '3');
+    }
+    if (l.fourcc != rr.fourcc || halves[0].rows != halves[1].rows || format == fourcc('M', 'J', 'P', 'G')) {
+        std::cerr << "WARNING: Skip record " << r.sequence << ", left and right can't be joined" << std::endl;
+        return false;
+    }
+    b.fourcc = format;
+    b.width = halves[0].cols + halves[1].cols;
+    b.height = halves[0].rows;
+    b.bytes = (size_t)b.width * b.height * halves[0].elemSize();
+    if (b.storage.size() < b.bytes) {
+        b.storage.resize(b.bytes);
+    }
+    cv::Mat joined(b.height, b.width, halves[0].type(), b.storage.data());
+    cv::hconcat(halves[0], halves[1], joined);
+    return true;
+}
+
+std::chrono::steady_clock::duration ReplayCapture::interval(const Buffer& b)
+{
+    const std::chrono::duration<double> fixed(1.0 / m_options.fps);
+    std::chrono::duration<double> d = fixed;
+    if (m_options.timing == ReplayTiming::Original && b.stamp_ns > m_prevStamp && m_prevStamp > 0) {
+        // a gap in the recording (or a loop back to the start) is not waited out
+        d = std::min(std::chrono::duration<double>((b.stamp_ns - m_prevStamp) * 1e-9), std::chrono::duration<double>(1.0));
+    }
+    m_prevStamp = b.stamp_ns;
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(d);
+}
+
+bool ReplayCapture::dequeue(CapturedFrame& frame, int timeout_ms)
+{
+    if (!m_ready) {
+        return false;
+    }
+    int index = -1;
+    if (!m_ready->popFor(index, std::chrono::milliseconds(timeout_ms))) {
+        if (m_readerDone) {
+            m_end = true;
+        }
+        return false;
+    }
+    const Buffer& b = m_buffers[index];
+
+    if (m_options.timing != ReplayTiming::Fast) {
+        const auto now = std::chrono::steady_clock::now();
+        if (!m_started) {
+            m_deadline = now;
+            m_prevStamp = b.stamp_ns;
+        } else {
+            m_deadline += interval(b);
+            if (m_deadline < now - std::chrono::seconds(1)) {
+                // the pipeline fell far behind, don't burst to catch up
+                m_deadline = now;
+            }
+        }
+        std::this_thread::sleep_until(m_deadline);
+    }
+    m_started = true;
+
+    frame.index = index;
+    frame.fourcc = b.fourcc;
+    frame.bytesused = b.bytes;
+    frame.sequence = m_sequence++;
+    // delivery time, the recorded stamp only paces Original timing
+    frame.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    frame.dmabuf_fd = -1;
+
+    uchar* ptr = const_cast<uchar*>(b.storage.data());
+    if (b.fourcc == fourcc('Y', 'U', 'Y', 'V')) {
+        frame.data = cv::Mat(b.height, b.width, CV_8UC2, ptr);
+    } else if (b.fourcc == fourcc('B', 'G', 'R', '3')) {
+        frame.data = cv::Mat(b.height, b.width, CV_8UC3, ptr);
+    } else if (b.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+        frame.data = cv::Mat(b.height, b.width, CV_8UC1, ptr);
+    } else {
+        frame.data = cv::Mat(1, (int)b.bytes, CV_8UC1, ptr);
+    }
+    return true;
+}
+
+void ReplayCapture::release(CapturedFrame& frame)
+{
+    if (frame.index < 0 || frame.index >= (int)m_buffers.size()) {
+        return;
+    }
+    if (m_empty) {
+        m_empty->push(frame.index);
+    }
+    frame.data.release();
+    frame.index = -1;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,120 @@
+#include "usb_camera/stage_graph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "usb_camera/stereo_frame.h"
+
+namespace usb_camera {
+
+int StageGraph::add(const std::string& name, const Run& run, const Demand& demand,
+                    const std::vector<int>& inputs)
+{
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i] < 0 || inputs[i] >= (int)m_stages.size()) {
+            throw std::invalid_argument("StageGraph: input of stage " + name + " must be added first");
+        }
+    }
+    if ((int)m_stages.size() == kMaxStages) {
+        throw std::length_error("StageGraph: too many stages");
+    }
+    Stage s;
+    s.name = name;
+    s.run = run;
+    s.demand = demand;
+    s.inputs = inputs;
+    s.demanded = false;
+    s.active = false;
+    m_stages.push_back(s);
+    return (int)m_stages.size() - 1;
+}
+
+bool StageGraph::update()
+{
+    std::vector<bool> needed(m_stages.size(), false);
+    for (int i = (int)m_stages.size() - 1; i >= 0; i--) {
+        m_stages[i].demanded = m_stages[i].demand && m_stages[i].demand();
+        if (m_stages[i].demanded) {
+            needed[i] = true;
+        }
+        if (needed[i]) {
+            for (size_t k = 0; k < m_stages[i].inputs.size(); k++) {
+                needed[m_stages[i].inputs[k]] = true;
+            }
+        }
+    }
+
+    bool any = false;
+    for (size_t i = 0; i < m_stages.size(); i++) {
+        Stage& s = m_stages[i];
+        if (s.active != needed[i]) {
+            s.active = needed[i];
+            std::cout << "Stage " << s.name << (s.active ? " started" : " stopped") << std::endl;
+        }
+        any = any || s.active;
+    }
+    return any;
+}
+
+bool StageGraph::run(StereoFrame& frame, int first, int last) const
+{
+    const unsigned mask = frame.stages;
+    for (int i = std::max(first, 0); i < std::min(last, size()); i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = m_stages[i].run(frame);
+        if (m_observer) {
+            m_observer(i, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StageGraph::anyActive() const
+{
+    for (size_t i = 0; i < m_stages.size(); i++) {
+        if (m_stages[i].active) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned StageGraph::activeMask() const
+{
+    unsigned mask = 0;
+    for (size_t i = 0; i < m_stages.size(); i++) {
+        if (m_stages[i].active) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+unsigned StageGraph::activeMask(unsigned skip) const
+{
+    unsigned mask = 0;
+    for (int i = (int)m_stages.size() - 1; i >= 0; i--) {
+        if (skip & (1u << i)) {
+            continue;
+        }
+        if (m_stages[i].demanded) {
+            mask |= 1u << i;
+        }
+        if (mask & (1u << i)) {
+            for (size_t k = 0; k < m_stages[i].inputs.size(); k++) {
+                mask |= 1u << m_stages[i].inputs[k];
+            }
+        }
+    }
+    return mask & ~skip;
+}
+
+}  // namespace usb_camera
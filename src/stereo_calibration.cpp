@@ -1,12 +1,30 @@
 #include <iostream>
 #include "opencv2/opencv.hpp"
 
+#include <numeric>
 #include <string>
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "usb_camera/chessboard_detector.h"
+#include "usb_camera/corner_cache.h"
+#include "usb_camera/parallel.h"
+#include "usb_camera/view_selection.h"
+
 std::string data_path_ = "/data/data/2M/demo/demo_240p";
 std::string calib_file_ = "/data/data/2M/demo/demo_240p/m2_calibration.yml";
+// no windows, no key presses: detect, report failures, calibrate, write
+bool headless_ = false;
+// detections of earlier runs are kept next to calib_file_, see cornerCachePath()
+bool use_cache_ = true;
+// detect on a pyrDown level first (auto level count), --full-res turns it off
+int pyramid_levels_ = -1;
+// calibrate on at most this many diverse views, 0: all
+int max_views_ = 40;
+// refine the result of the selected views on all views
+bool refine_ = false;
+// also calibrate on all views and report both
+bool baseline_ = false;
 
 static void calcChessboardCorners(cv::Size boardSize, float squareSize, std::vector<cv::Point3f>& corners)
 {
@@ -18,13 +36,196 @@ static void calcChessboardCorners(cv::Size boardSize, float squareSize, std::vec
                                       float(i*squareSize), 0));
 }
 
+// m2_calibration.yml -> m2_calibration.corners.yml
+static std::string cornerCachePath(const std::string& calibFile)
+{
+    size_t dot = calibFile.find_last_of('.');
+    size_t slash = calibFile.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return calibFile + ".corners.yml";
+    return calibFile.substr(0, dot) + ".corners.yml";
+}
+
+struct StereoSolution {
+    cv::Mat cameraMatrix[2], distCoeffs[2];
+    cv::Mat R, T, E, F;
+    double rms[2] = { 0, 0 };   // calibrateCamera over the views solved on, -1: refined, not solved separately
+    double stereoRms = 0;       // stereoCalibrate
+    double seconds = 0;
+
+    // Copy with buffers of its own, stereoCalibrate writes into the Mats it is given.
+    StereoSolution clone() const
+    {
+        StereoSolution c = *this;
+        for (int k = 0; k < 2; k++) {
+            c.cameraMatrix[k] = cameraMatrix[k].clone();
+            c.distCoeffs[k] = distCoeffs[k].clone();
+        }
+        c.R = R.clone();
+        c.T = T.clone();
+        c.E = E.clone();
+        c.F = F.clone();
+        return c;
+    }
+};
+
+// Calibrate both cameras on `views` concurrently, then the pair. With
+// `refine` the intrinsics in `s` are the initial guess and stereoCalibrate
+// refines them together with the extrinsics instead.
+static bool SolveStereo(const std::vector<cv::Point3f>& board, const std::vector<std::vector<cv::Point2f> > imgpt[2],
+                        const std::vector<int>& views, cv::Size imageSize, bool refine, StereoSolution& s)
+{
+    const int64 t0 = cv::getTickCount();
+    std::vector<std::vector<cv::Point3f> > objpt(views.size(), board);
+    std::vector<std::vector<cv::Point2f> > pt[2];
+    for (size_t i = 0; i < views.size(); i++) {
+        pt[0].push_back(imgpt[0][views[i]]);
+        pt[1].push_back(imgpt[1][views[i]]);
+    }
+
+    if (!refine) {
+        usb_camera::parallelFor(cv::Range(0, 2), [&](int k) {
+            std::vector<cv::Mat> rvecs, tvecs;
+            s.cameraMatrix[k] = cv::Mat_<double>::eye(3,3);
+            s.distCoeffs[k] = cv::Mat_<double>::zeros(5,1);
+            s.rms[k] = cv::calibrateCamera( objpt, pt[k], imageSize,
+                                            s.cameraMatrix[k], s.distCoeffs[k], rvecs, tvecs,
+                                            cv::CALIB_FIX_K3/*|CALIB_FIX_K4|CALIB_FIX_K5|CALIB_FIX_K6*/);
+        }, 2);
+        for (int k = 0; k < 2; k++) {
+            if (!cv::checkRange(s.cameraMatrix[k]) || !cv::checkRange(s.distCoeffs[k])) {
+                printf("Error: camera %d was not calibrated\n", k);
+                return false;
+            }
+        }
+    }
+
+    if (refine) {
+        s.rms[0] = s.rms[1] = -1;
+    }
+    const int flags = refine ? cv::CALIB_USE_INTRINSIC_GUESS | cv::CALIB_FIX_K3 : cv::CALIB_FIX_INTRINSIC;
+    s.stereoRms = cv::stereoCalibrate(  objpt, pt[0], pt[1],
+                                        s.cameraMatrix[0], s.distCoeffs[0],
+                                        s.cameraMatrix[1], s.distCoeffs[1],
+                                        imageSize, s.R, s.T, s.E, s.F, flags);
+    s.seconds = (cv::getTickCount() - t0) / cv::getTickFrequency();
+    return true;
+}
+
+// RMS reprojection error of a solution over all views: the board pose of
+// each view is fit with solvePnP per camera, `rig` projects the left pose
+// through R and T into the right camera.
+static void EvaluateStereo(const std::vector<cv::Point3f>& board, const std::vector<std::vector<cv::Point2f> > imgpt[2],
+                           const StereoSolution& s, double rms[2], double& rig)
+{
+    const int n = (int)imgpt[0].size();
+    std::vector<double> err[3];
+    for (int k = 0; k < 3; k++)
+        err[k].assign(n, 0.0);
+    const cv::Matx33d R(s.R);
+    const cv::Vec3d T(s.T);
+    usb_camera::parallelFor(cv::Range(0, n), [&](int i) {
+        std::vector<cv::Point2f> projected;
+        cv::Vec3d rvec[2], tvec[2];
+        for (int k = 0; k < 2; k++) {
+            cv::solvePnP(board, imgpt[k][i], s.cameraMatrix[k], s.distCoeffs[k], rvec[k], tvec[k]);
+            cv::projectPoints(board, rvec[k], tvec[k], s.cameraMatrix[k], s.distCoeffs[k], projected);
+            for (size_t j = 0; j < projected.size(); j++)
+                err[k][i] += cv::norm(projected[j] - imgpt[k][i][j]) * cv::norm(projected[j] - imgpt[k][i][j]);
+        }
+        cv::Matx33d Rl;
+        cv::Rodrigues(rvec[0], Rl);
+        cv::Vec3d rr;
+        cv::Rodrigues(R * Rl, rr);
+        cv::projectPoints(board, rr, R * tvec[0] + T, s.cameraMatrix[1], s.distCoeffs[1], projected);
+        for (size_t j = 0; j < projected.size(); j++)
+            err[2][i] += cv::norm(projected[j] - imgpt[1][i][j]) * cv::norm(projected[j] - imgpt[1][i][j]);
+    });
+    const double points = (double)n * board.size();
+    for (int k = 0; k < 2; k++)
+        rms[k] = std::sqrt(std::accumulate(err[k].begin(), err[k].end(), 0.0) / points);
+    rig = std::sqrt(std::accumulate(err[2].begin(), err[2].end(), 0.0) / points);
+}
+
+static void ReportStereo(const char* name, int views, const std::vector<cv::Point3f>& board,
+                         const std::vector<std::vector<cv::Point2f> > imgpt[2], const StereoSolution& s)
+{
+    double rms[2], rig;
+    EvaluateStereo(board, imgpt, s, rms, rig);
+    char solved[2][16];
+    for (int k = 0; k < 2; k++) {
+        if (s.rms[k] < 0)
+            snprintf(solved[k], sizeof(solved[k]), "-");
+        else
+            snprintf(solved[k], sizeof(solved[k]), "%.4f", s.rms[k]);
+    }
+    printf("  %-14s %4d %8.2f %8s %8s %8.4f %8.4f %8.4f %8.4f\n", name, views, s.seconds,
+           solved[0], solved[1], s.stereoRms, rms[0], rms[1], rig);
+}
+
+// Check of the pyramid path on field data (test/test_chessboard_detector.cpp
+// covers it on rendered boards): detect every image at full resolution and
+// through the pyramid and compare. Fails if the pyramid misses a board or a
+// corner moves by more than maxError pixels.
+int VerifyPyramidDetection() {
+    const double maxError = 0.25;
+    std::vector<cv::String> images, right_images;
+    cv::glob(data_path_ + "/left/*.jpg", images);
+    cv::glob(data_path_ + "/right/*.jpg", right_images);
+    images.insert(images.end(), right_images.begin(), right_images.end());
+    std::vector<std::string> files(images.begin(), images.end());
+
+    usb_camera::ChessboardOptions full, pyramid;
+    full.pyramidLevels = 0;
+    pyramid.pyramidLevels = -1;
+    printf("Full resolution detection of %d images...\n", (int)files.size());
+    int64 t0 = cv::getTickCount();
+    std::vector<usb_camera::CornerDetection> a = usb_camera::detectChessboards(files, full);
+    int64 t1 = cv::getTickCount();
+    printf("Pyramid detection...\n");
+    std::vector<usb_camera::CornerDetection> b = usb_camera::detectChessboards(files, pyramid);
+    int64 t2 = cv::getTickCount();
+
+    int both = 0, missed = 0, extra = 0, bad = 0;
+    double sum = 0, worst = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (a[i].found != b[i].found) {
+            printf("  %s: %s\n", files[i].c_str(), a[i].found ? "missed by the pyramid" : "only found by the pyramid");
+            (a[i].found ? missed : extra)++;
+            continue;
+        }
+        if (!a[i].found)
+            continue;
+        both++;
+        // the board may be reported in reverse order, compare the closer of both
+        double fwd = 0, rev = 0;
+        const size_t n = a[i].corners.size();
+        for (size_t j = 0; j < n; j++) {
+            fwd = std::max(fwd, (double)cv::norm(a[i].corners[j] - b[i].corners[j]));
+            rev = std::max(rev, (double)cv::norm(a[i].corners[j] - b[i].corners[n - 1 - j]));
+        }
+        double err = std::min(fwd, rev);
+        sum += err;
+        worst = std::max(worst, err);
+        if (err > maxError) {
+            printf("  %s: corners differ by %.3f px\n", files[i].c_str(), err);
+            bad++;
+        }
+    }
+    printf("Full resolution %.2f s, pyramid %.2f s\n",
+           (t1 - t0) / cv::getTickFrequency(), (t2 - t1) / cv::getTickFrequency());
+    printf("Found by both: %d, missed by pyramid: %d, only pyramid: %d\n", both, missed, extra);
+    printf("Max corner difference per image: mean %.3f px, worst %.3f px, above %.2f px: %d\n",
+           both ? sum / both : 0.0, worst, maxError, bad);
+    return (missed == 0 && bad == 0) ? 0 : -1;
+}
+
 int StereoCalibrate() {
     int i, k;
     int flags = 0;
     cv::Size boardSize = cv::Size(9, 6);
     cv::Size imageSize;
     const float squareSize = 0.0245f;
-    float aspectRatio = 1.0;
 
     std::string outputFilename = calib_file_;
     std::string inputFilename = data_path_;
@@ -32,87 +233,141 @@ int StereoCalibrate() {
     std::vector<cv::String> left_images, right_images;
     cv::glob(inputFilename + "/left/*.jpg", left_images);
     cv::glob(inputFilename + "/right/*.jpg", right_images);
-
-    // init
-    cv::Mat cameraMatrix[2], distCoeffs[2];
-    for( k = 0; k < 2; k++ ) {
-        cameraMatrix[k] = cv::Mat_<double>::eye(3,3);
-        cameraMatrix[k].at<double>(0,0) = aspectRatio;
-        cameraMatrix[k].at<double>(1,1) = 1;
-        distCoeffs[k] = cv::Mat_<double>::zeros(5,1);
+    if (left_images.size() != right_images.size()) {
+        printf("Warning: %d left and %d right images, pairing by index\n",
+               (int)left_images.size(), (int)right_images.size());
+        left_images.resize(std::min(left_images.size(), right_images.size()));
+        right_images.resize(left_images.size());
     }
 
-    printf("Find chessboard corners...\n");
+    printf("Find chessboard corners in %d pairs on %d threads...\n", (int)left_images.size(), cv::getNumThreads());
 
+    usb_camera::ChessboardOptions options;
+    options.boardSize = boardSize;
+    options.pyramidLevels = pyramid_levels_;
+    std::vector<std::string> files[2] = {
+        std::vector<std::string>(left_images.begin(), left_images.end()),
+        std::vector<std::string>(right_images.begin(), right_images.end())
+    };
+    usb_camera::CornerCache cache;
+    const std::string cachePath = cornerCachePath(outputFilename);
+    if (use_cache_) {
+        cache.load(cachePath);
+        printf("Corner cache %s: %d detections\n", cachePath.c_str(), (int)cache.size());
+    }
+    std::vector<usb_camera::CornerDetection> detections[2];
+    int cached = 0;
+    for (k = 0; k < 2; k++) {
+        detections[k] = usb_camera::detectChessboards(files[k], options, use_cache_ ? &cache : nullptr);
+        for (i = 0; i < (int)detections[k].size(); i++) {
+            cached += detections[k][i].cached;
+        }
+    }
+    if (use_cache_) {
+        printf("%d of %d images taken from the cache\n", cached, (int)(files[0].size() + files[1].size()));
+        if (cache.modified()) {
+            cache.save(cachePath);
+        }
+    }
+
+    // join in file order so the result does not depend on thread timing
     std::vector<std::vector<cv::Point2f> > imgpt[2];
+    std::vector<double> sharpness;
+    std::vector<std::string> failed;
     for( i = 0; i < (int)(left_images.size()); i++ ) {
-        printf("%s\n", left_images[i].c_str());
-        printf("%s\n", right_images[i].c_str());
-    
-        bool found[2];
-        cv::Mat view[2], viewGray[2];
-        std::vector<cv::Point2f> ptvec[2];
-
-        view[0] = cv::imread(left_images[i], cv::IMREAD_COLOR);
-        view[1] = cv::imread(right_images[i], cv::IMREAD_COLOR);
-        if(view[0].empty() || view[1].empty()) 
-            continue;
-        for (int k = 0; k < 2; k++) {
-            imageSize = view[k].size();
-            cv::cvtColor(view[k], viewGray[k], cv::COLOR_BGR2GRAY);
-            found[k] = cv::findChessboardCorners( view[k], boardSize, ptvec[k], cv::CALIB_CB_ADAPTIVE_THRESH );
-
-            cv::cornerSubPix(viewGray[k], ptvec[k], cv::Size(5, 5), cv::Size(-1, -1),
-                cv::TermCriteria(cv::TermCriteria::EPS+cv::TermCriteria::COUNT, 30, 0.1));
-
-            cv::drawChessboardCorners( view[k], boardSize, cv::Mat(ptvec[k]), found[k] );
-            cv::imshow("view", view[k]);
-            int c = cv::waitKey() & 255;
-            if( c == 27 || c == 'q' || c == 'Q' )
-                return -1;
+        const usb_camera::CornerDetection* d[2] = { &detections[0][i], &detections[1][i] };
+        for (k = 0; k < 2; k++) {
+            if (!d[k]->loaded) {
+                failed.push_back(files[k][i] + ": can't read image");
+            } else if (!d[k]->found) {
+                failed.push_back(files[k][i] + ": board not found");
+            } else if (imageSize.area() == 0) {
+                imageSize = d[k]->imageSize;
+            } else if (d[k]->imageSize != imageSize) {
+                failed.push_back(files[k][i] + ": image size differs");
+            }
+        }
+        bool usable = d[0]->found && d[1]->found && d[0]->imageSize == imageSize && d[1]->imageSize == imageSize;
+
+        if (!headless_) {
+            for (k = 0; k < 2 && d[k]->loaded; k++) {
+                cv::Mat view = cv::imread(files[k][i], cv::IMREAD_COLOR);
+                cv::drawChessboardCorners( view, boardSize, cv::Mat(d[k]->corners), d[k]->found );
+                cv::imshow("view", view);
+                int c = cv::waitKey() & 255;
+                if( c == 27 || c == 'q' || c == 'Q' )
+                    return -1;
+            }
         }
-        if( found[0] && found[1] ) {
-            imgpt[0].push_back(ptvec[0]);
-            imgpt[1].push_back(ptvec[1]);
+        if( usable ) {
+            imgpt[0].push_back(d[0]->corners);
+            imgpt[1].push_back(d[1]->corners);
+            sharpness.push_back(d[0]->sharpness < 0 || d[1]->sharpness < 0 ? -1 : std::min(d[0]->sharpness, d[1]->sharpness));
         }
     }
 
-    printf("Running calibration...\n");
+    printf("Board found in %d of %d pairs\n", (int)imgpt[0].size(), (int)left_images.size());
+    if (!failed.empty()) {
+        printf("%d images not used:\n", (int)failed.size());
+        for (i = 0; i < (int)failed.size(); i++) {
+            printf("  %s\n", failed[i].c_str());
+        }
+    }
 
-    // calibrate each camera individually
-    std::vector<cv::Mat> rvecs, tvecs;
-    std::vector<std::vector<cv::Point3f> > objpt(1);
-    calcChessboardCorners(boardSize, squareSize, objpt[0]);
+    std::vector<cv::Point3f> board;
+    calcChessboardCorners(boardSize, squareSize, board);
 
     int N = imgpt[0].size();
-    int Np = imgpt[0][0].size() * N;
     if(N < 3) {
         printf("Error: not enough views for stereo.\n");
-        return false;
+        return -1;
     }
-    objpt.resize(N, objpt[0]);
 
-    for (int k = 0; k < 2; k++) {
-        double err = cv::calibrateCamera(   objpt, imgpt[k], imageSize, 
-                                            cameraMatrix[k], distCoeffs[k], rvecs, tvecs,
-                                            flags | cv::CALIB_FIX_K3/*|CALIB_FIX_K4|CALIB_FIX_K5|CALIB_FIX_K6*/);
-        bool ok = cv::checkRange(cameraMatrix[k]) && cv::checkRange(distCoeffs[k]);
-        if(!ok) {
-            printf("Error: camera %d was not calibrated\n", k);
-            return false;
-        }
-        printf("Camera %d calibration reprojection error = %f\n", k, sqrt(err/Np));
+    // most views are near duplicates, solve on a bounded diverse subset
+    std::vector<usb_camera::StereoView> views(N);
+    for (i = 0; i < N; i++) {
+        views[i].corners[0] = &imgpt[0][i];
+        views[i].corners[1] = &imgpt[1][i];
+        views[i].sharpness = sharpness[i];
     }
+    usb_camera::ViewSelectionOptions selection;
+    selection.maxViews = max_views_;
+    std::vector<int> subset = usb_camera::selectViews(views, boardSize, imageSize, selection);
+    std::vector<int> all(N);
+    std::iota(all.begin(), all.end(), 0);
+    printf("Calibrating on %d of %d views\n", (int)subset.size(), N);
 
-    printf("Running stereo calibration...\n");
-    cv::Mat R, T, E, F;
-    double err = cv::stereoCalibrate(   objpt, imgpt[0], imgpt[1], 
-                                        cameraMatrix[0], distCoeffs[0], 
-                                        cameraMatrix[1], distCoeffs[1], 
-                                        imageSize, R, T, E, F, 
-                                        flags | cv::CALIB_FIX_INTRINSIC);
-    printf("Calibration reprojection error = %f\n", sqrt(err/(Np*2)));
-
+    printf("Running calibration...\n");
+    printf("  %-14s %4s %8s %8s %8s %8s %8s %8s %8s\n", "", "", "", "solved", "", "", "all", "views", "");
+    printf("  %-14s %4s %8s %8s %8s %8s %8s %8s %8s\n", "", "views", "time [s]", "left", "right", "stereo",
+           "left", "right", "rig");
+    StereoSolution solution;
+    if (!SolveStereo(board, imgpt, subset, imageSize, false, solution)) {
+        return -1;
+    }
+    ReportStereo("selected", (int)subset.size(), board, imgpt, solution);
+    if (baseline_ && (int)subset.size() < N) {
+        StereoSolution baseline;
+        if (SolveStereo(board, imgpt, all, imageSize, false, baseline)) {
+            ReportStereo("all views", N, board, imgpt, baseline);
+        }
+    }
+    if (refine_ && (int)subset.size() < N) {
+        // the selected views' result stays intact if the refinement fails
+        StereoSolution refined = solution.clone();
+        SolveStereo(board, imgpt, all, imageSize, true, refined);
+        if (cv::checkRange(refined.cameraMatrix[0]) && cv::checkRange(refined.cameraMatrix[1]) &&
+            cv::checkRange(refined.distCoeffs[0]) && cv::checkRange(refined.distCoeffs[1]) &&
+            cv::checkRange(refined.R) && cv::checkRange(refined.T)) {
+            ReportStereo("refined", N, board, imgpt, refined);
+            solution = refined;
+        } else {
+            printf("Warning: refinement on all views failed, keeping the selected views' result\n");
+        }
+    }
+    cv::Mat* cameraMatrix = solution.cameraMatrix;
+    cv::Mat* distCoeffs = solution.distCoeffs;
+    cv::Mat R = solution.R, T = solution.T, E = solution.E, F = solution.F;
 
     printf("Running rectification\n");
     cv::Mat R1, R2, P1, P2, Q;
@@ -140,6 +395,11 @@ int StereoCalibrate() {
     fs << "Q" << Q;
     fs.release();
 
+    printf("Wrote %s\n", outputFilename.c_str());
+    if (headless_) {
+        return 0;
+    }
+
     cv::Mat map1[2], map2[2];
     cv::initUndistortRectifyMap(cameraMatrix[0], distCoeffs[0], R1, P1, imageSize, CV_16SC2, map1[0], map2[0]);
     cv::initUndistortRectifyMap(cameraMatrix[1], distCoeffs[1], R2, P2, imageSize, CV_16SC2, map1[1], map2[1]);
@@ -175,7 +435,43 @@ int StereoCalibrate() {
     return 0;
 }
 
-int main() {
-    StereoCalibrate();
-    return 0;
+int main(int argc, char** argv) {
+    // stereo_calibration [data_path [calib_file]] [--headless] [--threads N] [--no-cache]
+    //                   [--full-res] [--verify-pyramid] [--max-views N] [--refine] [--baseline]
+    int positional = 0;
+    bool verify = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            headless_ = true;
+        } else if (arg == "--no-cache") {
+            use_cache_ = false;
+        } else if (arg == "--full-res") {
+            pyramid_levels_ = 0;
+        } else if (arg == "--verify-pyramid") {
+            verify = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            cv::setNumThreads(atoi(argv[++i]));
+        } else if (arg == "--max-views" && i + 1 < argc) {
+            max_views_ = atoi(argv[++i]);
+        } else if (arg == "--refine") {
+            refine_ = true;
+        } else if (arg == "--baseline") {
+            baseline_ = true;
+        } else if (positional == 0) {
+            data_path_ = arg;
+            positional++;
+        } else if (positional == 1) {
+            calib_file_ = arg;
+            positional++;
+        } else {
+            printf("Usage: %s [data_path [calib_file]] [--headless] [--threads N] [--no-cache] [--full-res] [--verify-pyramid]"
+                   " [--max-views N] [--refine] [--baseline]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (verify) {
+        return VerifyPyramidDetection() == 0 ? 0 : 1;
+    }
+    return StereoCalibrate() == 0 ? 0 : 1;
 }
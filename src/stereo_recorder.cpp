@@ -0,0 +1,641 @@
+#include "usb_camera/stereo_recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "usb_camera/capture_device.h"
+
+namespace usb_camera {
+
+namespace {
+
+// O_DIRECT needs block aligned buffers, offsets and lengths; 4 KiB covers
+// the logical block size of common disks and flash.
+const size_t kBlock = 4096;
+const uint32_t kFormatVersion = 1;
+const char kFileMagic[8] = { 'M', '2', 'S', 'T', 'R', 'E', 'C', '\0' };
+const char kChunkMagic[8] = { 'M', '2', 'C', 'H', 'U', 'N', 'K', '\0' };
+const char kIndexMagic[8] = { 'M', '2', 'I', 'N', 'D', 'E', 'X', '\0' };
+const char kTrailerMagic[8] = { 'M', '2', 'T', 'R', 'A', 'I', 'L', '\0' };
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockSize;
+};
+
+struct ChunkHeader {
+    char magic[8];
+    uint32_t records;
+    uint32_t reserved;
+    uint64_t used;      // header and records
+    uint64_t size;      // including padding, the next chunk starts there
+};
+
+struct ImageHeader {
+    uint32_t fourcc;
+    int32_t width;
+    int32_t height;
+    uint32_t reserved;
+    uint64_t size;      // bytes that follow, padded to 8
+};
+
+struct RecordHeader {
+    uint64_t sequence;
+    int64_t stamp_ns[2];
+    uint32_t sideBySide;
+    uint32_t images;
+    ImageHeader image[2];
+};
+
+struct IndexHeader {
+    char magic[8];
+    uint64_t count;
+};
+
+struct IndexRecord {
+    uint64_t sequence;
+    int64_t stamp_ns;
+    uint64_t offset;
+};
+
+struct Trailer {
+    char magic[8];
+    uint64_t indexOffset;
+    uint64_t count;
+};
+
+size_t alignUp(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+uchar* allocBlocks(size_t size)
+{
+    void* p = nullptr;
+    if (posix_memalign(&p, kBlock, size) != 0) {
+        return nullptr;
+    }
+    return static_cast<uchar*>(p);
+}
+
+}  // namespace
+
+StereoRecorder::StereoRecorder()
+    : m_open(false),
+      m_fd(-1),
+      m_directIo(false),
+      m_fill(nullptr),
+      m_sequence(0),
+      m_fileOffset(0),
+      m_writeFailed(false),
+      m_recorded(0),
+      m_dropped(0),
+      m_bytesWritten(0)
+{
+}
+
+StereoRecorder::~StereoRecorder()
+{
+    close();
+}
+
+bool StereoRecorder::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_open;
+}
+
+std::string StereoRecorder::path() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_path;
+}
+
+uint32_t StereoRecorder::fourccOf(const cv::Mat& image)
+{
+    switch (image.type()) {
+    case CV_8UC3:
+        return fourcc('B', 'G', 'R', '3');
+    case CV_8UC1:
+        return fourcc('G', 'R', 'E', 'Y');
+    default:
+        return 0;
+    }
+}
+
+bool StereoRecorder::open(const std::string& path, const RecorderOptions& options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_open) {
+        std::cerr << "ERROR: Already recording to " << m_path << std::endl;
+        return false;
+    }
+    m_options = options;
+    m_options.chunkSize = alignUp(std::max(options.chunkSize, 2 * kBlock), kBlock);
+    m_options.chunks = std::max(options.chunks, 2);
+
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    m_directIo = false;
+    m_fd = -1;
+    if (m_options.directIo) {
+        m_fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (m_fd >= 0) {
+            m_directIo = true;
+        } else if (errno == EINVAL) {
+            // tmpfs and some others refuse O_DIRECT
+            std::cerr << "WARNING: " << path << " doesn't support O_DIRECT, using buffered writes" << std::endl;
+        }
+    }
+    if (m_fd < 0) {
+        m_fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (m_fd < 0) {
+        std::cerr << "ERROR: Can't create " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_free.reset(new BoundedQueue<Chunk*>(m_options.chunks));
+    m_full.reset(new BoundedQueue<Chunk*>(m_options.chunks));
+    m_chunks.clear();
+    for (int i = 0; i < m_options.chunks; i++) {
+        std::unique_ptr<Chunk> chunk(new Chunk());
+        chunk->data = allocBlocks(m_options.chunkSize);
+        if (!chunk->data) {
+            std::cerr << "ERROR: Can't allocate the recording buffers" << std::endl;
+            freeChunks();
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        m_free->push(chunk.get());
+        m_chunks.push_back(std::move(chunk));
+    }
+
+    uchar* header = allocBlocks(kBlock);
+    bool ok = header != nullptr;
+    if (ok) {
+        memset(header, 0, kBlock);
+        FileHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, kFileMagic, sizeof(kFileMagic));
+        h.version = kFormatVersion;
+        h.blockSize = kBlock;
+        memcpy(header, &h, sizeof(h));
+        ok = writeAll(header, kBlock);
+        free(header);
+    }
+    if (!ok) {
+        std::cerr << "ERROR: Can't write " << path << ": " << strerror(errno) << std::endl;
+        freeChunks();
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    m_path = path;
+    m_fill = nullptr;
+    m_sequence = 0;
+    m_fileOffset = kBlock;
+    m_index.clear();
+    m_writeFailed = false;
+    m_recorded = 0;
+    m_dropped = 0;
+    m_bytesWritten = kBlock;
+    m_writer = std::thread(&StereoRecorder::writer, this);
+    m_open = true;
+    return true;
+}
+
+void StereoRecorder::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) {
+            return;
+        }
+        // producers see a closed recorder from here on, flushing happens
+        // outside the lock so they don't wait for the disk
+        m_open = false;
+        if (m_fill && m_fill->records > 0) {
+            m_full->push(m_fill);
+        }
+        m_fill = nullptr;
+    }
+    m_full->close();
+    m_writer.join();
+    writeIndex();
+    ::close(m_fd);
+    m_fd = -1;
+    freeChunks();
+}
+
+void StereoRecorder::freeChunks()
+{
+    for (size_t i = 0; i < m_chunks.size(); i++) {
+        free(m_chunks[i]->data);
+    }
+    m_chunks.clear();
+    m_free.reset();
+    m_full.reset();
+}
+
+bool StereoRecorder::write(int64_t stamp_ns, const cv::Mat& frame)
+{
+    Source s = { fourccOf(frame), frame.cols, frame.rows, &frame, nullptr, frame.total() * frame.elemSize() };
+    const int64_t stamps[2] = { stamp_ns, stamp_ns };
+    return s.fourcc != 0 && append(stamps, true, &s, 1);
+}
+
+bool StereoRecorder::write(const int64_t stamp_ns[2], const cv::Mat& left, const cv::Mat& right)
+{
+    Source s[2] = {
+        { fourccOf(left), left.cols, left.rows, &left, nullptr, left.total() * left.elemSize() },
+        { fourccOf(right), right.cols, right.rows, &right, nullptr, right.total() * right.elemSize() },
+    };
+    return s[0].fourcc != 0 && s[1].fourcc != 0 && append(stamp_ns, false, s, 2);
+}
+
+bool StereoRecorder::writeJpeg(int64_t stamp_ns, const uchar* data, size_t size, int width, int height)
+{
+    Source s = { fourcc('M', 'J', 'P', 'G'), width, height, nullptr, data, size };
+    const int64_t stamps[2] = { stamp_ns, stamp_ns };
+    return append(stamps, true, &s, 1);
+}
+
+bool StereoRecorder::writeJpeg(const int64_t stamp_ns[2], const cv::Mat& left, const cv::Mat& right, cv::Size size)
+{
+    CV_Assert(left.isContinuous() && right.isContinuous());
+    Source s[2] = {
+        { fourcc('M', 'J', 'P', 'G'), size.width, size.height, nullptr, left.ptr(), left.total() * left.elemSize() },
+        { fourcc('M', 'J', 'P', 'G'), size.width, size.height, nullptr, right.ptr(), right.total() * right.elemSize() },
+    };
+    return append(stamp_ns, false, s, 2);
+}
+
+bool StereoRecorder::append(const int64_t stamp_ns[2], bool sideBySide, const Source* sources, int count)
+{
+    size_t need = sizeof(RecordHeader);
+    for (int i = 0; i < count; i++) {
+        need += alignUp(sources[i].size, 8);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_open) {
+        return false;
+    }
+    if (sizeof(ChunkHeader) + need > m_options.chunkSize) {
+        std::cerr << "ERROR: " << need << " byte frame doesn't fit a " << m_options.chunkSize
+                  << " byte recording chunk" << std::endl;
+        m_dropped++;
+        return false;
+    }
+    if (m_fill && m_fill->used + need > m_options.chunkSize) {
+        m_full->push(m_fill);
+        m_fill = nullptr;
+    }
+    if (!m_fill) {
+        if (!m_free->tryPop(m_fill)) {
+            // the writer is behind by the whole pool, don't stall the caller
+            m_fill = nullptr;
+            m_dropped++;
+            return false;
+        }
+        m_fill->used = sizeof(ChunkHeader);
+        m_fill->records = 0;
+        m_fill->index.clear();
+    }
+
+    uchar* out = m_fill->data + m_fill->used;
+    RecordHeader h;
+    memset(&h, 0, sizeof(h));
+    h.sequence = m_sequence;
+    h.stamp_ns[0] = stamp_ns[0];
+    h.stamp_ns[1] = stamp_ns[1];
+    h.sideBySide = sideBySide ? 1 : 0;
+    h.images = count;
+    size_t pos = sizeof(RecordHeader);
+    for (int i = 0; i < count; i++) {
+        const Source& s = sources[i];
+        h.image[i].fourcc = s.fourcc;
+        h.image[i].width = s.width;
+        h.image[i].height = s.height;
+        h.image[i].size = s.size;
+        if (s.image) {
+            // rows are packed, ROIs (a half of a side-by-side frame) included
+            const size_t rowBytes = s.image->cols * s.image->elemSize();
+            for (int y = 0; y < s.image->rows; y++) {
+                memcpy(out + pos + y * rowBytes, s.image->ptr(y), rowBytes);
+            }
+        } else {
+            memcpy(out + pos, s.bytes, s.size);
+        }
+        pos += alignUp(s.size, 8);
+    }
+    memcpy(out, &h, sizeof(h));
+
+    IndexEntry e = { m_sequence, stamp_ns[0], m_fill->used };
+    m_fill->index.push_back(e);
+    m_fill->used += need;
+    m_fill->records++;
+    m_sequence++;
+    m_recorded++;
+    return true;
+}
+
+void StereoRecorder::writer()
+{
+    Chunk* chunk = nullptr;
+    while (m_full->pop(chunk)) {
+        ChunkHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, kChunkMagic, sizeof(kChunkMagic));
+        h.records = chunk->records;
+        h.used = chunk->used;
+        h.size = alignUp(chunk->used, kBlock);
+        memcpy(chunk->data, &h, sizeof(h));
+        memset(chunk->data + chunk->used, 0, h.size - chunk->used);
+
+        if (!m_writeFailed) {
+            if (writeAll(chunk->data, h.size)) {
+                for (size_t i = 0; i < chunk->index.size(); i++) {
+                    IndexEntry e = chunk->index[i];
+                    e.offset += m_fileOffset;
+                    m_index.push_back(e);
+                }
+                m_fileOffset += h.size;
+                m_bytesWritten += h.size;
+            } else {
+                std::cerr << "ERROR: Can't write " << m_path << ": " << strerror(errno)
+                          << ", recording stopped" << std::endl;
+                m_writeFailed = true;
+            }
+        }
+        if (m_writeFailed) {
+            m_dropped += chunk->records;
+        }
+        m_free->push(chunk);
+    }
+}
+
+bool StereoRecorder::writeAll(const uchar* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(m_fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void StereoRecorder::writeIndex()
+{
+    if (m_writeFailed) {
+        // readers rebuild the index from the chunks that made it
+        return;
+    }
+    const size_t bytes = sizeof(IndexHeader) + m_index.size() * sizeof(IndexRecord) + sizeof(Trailer);
+    const size_t size = alignUp(bytes, kBlock);
+    uchar* buf = allocBlocks(size);
+    if (!buf) {
+        return;
+    }
+    memset(buf, 0, size);
+    IndexHeader ih;
+    memcpy(ih.magic, kIndexMagic, sizeof(kIndexMagic));
+    ih.count = m_index.size();
+    memcpy(buf, &ih, sizeof(ih));
+    for (size_t i = 0; i < m_index.size(); i++) {
+        IndexRecord r = { m_index[i].sequence, m_index[i].stamp_ns, m_index[i].offset };
+        memcpy(buf + sizeof(IndexHeader) + i * sizeof(IndexRecord), &r, sizeof(r));
+    }
+    Trailer t;
+    memcpy(t.magic, kTrailerMagic, sizeof(kTrailerMagic));
+    t.indexOffset = m_fileOffset;
+    t.count = m_index.size();
+    memcpy(buf + size - sizeof(Trailer), &t, sizeof(t));
+    if (writeAll(buf, size)) {
+        m_bytesWritten += size;
+    } else {
+        std::cerr << "ERROR: Can't write the index of " << m_path << std::endl;
+    }
+    free(buf);
+}
+
+std::string recordingPath(const std::string& dir)
+{
+    char name[64];
+    time_t now = time(nullptr);
+    strftime(name, sizeof(name), "stereo_%Y%m%d_%H%M%S.m2rec", localtime(&now));
+    return dir + name;
+}
+
+void toggleRecording(StereoRecorder& recorder, const std::string& dir, bool directIo)
+{
+    if (recorder.isOpen()) {
+        recorder.close();
+        std::cout << "Recorded " << recorder.recorded() << " frames (" << recorder.dropped() << " dropped, "
+                  << recorder.bytesWritten() / (1 << 20) << " MiB) to " << recorder.path() << std::endl;
+        return;
+    }
+    RecorderOptions options;
+    options.directIo = directIo;
+    if (recorder.open(recordingPath(dir), options)) {
+        std::cout << "Recording to " << recorder.path() << std::endl;
+    }
+}
+
+StereoRecordReader::StereoRecordReader()
+    : m_data(nullptr),
+      m_size(0)
+{
+}
+
+StereoRecordReader::~StereoRecordReader()
+{
+    close();
+}
+
+void StereoRecordReader::close()
+{
+    if (m_data) {
+        munmap(const_cast<uchar*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+    m_index.clear();
+}
+
+bool StereoRecordReader::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "ERROR: Can't open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < kBlock) {
+        std::cerr << "ERROR: " << path << " is not a stereo recording" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "ERROR: Can't mmap " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_data = static_cast<const uchar*>(data);
+    m_size = st.st_size;
+
+    FileHeader h;
+    memcpy(&h, m_data, sizeof(h));
+    if (memcmp(h.magic, kFileMagic, sizeof(kFileMagic)) != 0 || h.version != kFormatVersion) {
+        std::cerr << "ERROR: " << path << " is not a version " << kFormatVersion << " stereo recording" << std::endl;
+        close();
+        return false;
+    }
+    if (!readIndex()) {
+        std::cerr << "WARNING: " << path << " has no index (interrupted recording?), scanning it" << std::endl;
+        scanChunks();
+    }
+    return true;
+}
+
+bool StereoRecordReader::readIndex()
+{
+    Trailer t;
+    memcpy(&t, m_data + m_size - sizeof(Trailer), sizeof(t));
+    if (memcmp(t.magic, kTrailerMagic, sizeof(kTrailerMagic)) != 0 ||
+        t.indexOffset + sizeof(IndexHeader) + t.count * sizeof(IndexRecord) > m_size) {
+        return false;
+    }
+    IndexHeader ih;
+    memcpy(&ih, m_data + t.indexOffset, sizeof(ih));
+    if (memcmp(ih.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 || ih.count != t.count) {
+        return false;
+    }
+    m_index.resize(t.count);
+    for (size_t i = 0; i < m_index.size(); i++) {
+        IndexRecord r;
+        memcpy(&r, m_data + t.indexOffset + sizeof(IndexHeader) + i * sizeof(IndexRecord), sizeof(r));
+        m_index[i].sequence = r.sequence;
+        m_index[i].stamp_ns = r.stamp_ns;
+        m_index[i].offset = r.offset;
+    }
+    return true;
+}
+
+bool StereoRecordReader::scanChunks()
+{
+    m_index.clear();
+    uint64_t offset = kBlock;
+    while (offset + sizeof(ChunkHeader) <= m_size) {
+        ChunkHeader h;
+        memcpy(&h, m_data + offset, sizeof(h));
+        if (memcmp(h.magic, kChunkMagic, sizeof(kChunkMagic)) != 0 || h.size == 0 || offset + h.size > m_size) {
+            break;
+        }
+        uint64_t pos = offset + sizeof(ChunkHeader);
+        for (uint32_t r = 0; r < h.records; r++) {
+            size_t size = 0;
+            if (!recordExtent(pos, size)) {
+                break;
+            }
+            RecordHeader rh;
+            memcpy(&rh, m_data + pos, sizeof(rh));
+            Entry e = { rh.sequence, rh.stamp_ns[0], pos };
+            m_index.push_back(e);
+            pos += size;
+        }
+        offset += h.size;
+    }
+    return !m_index.empty();
+}
+
+bool StereoRecordReader::recordExtent(uint64_t offset, size_t& size) const
+{
+    if (offset + sizeof(RecordHeader) > m_size) {
+        return false;
+    }
+    RecordHeader h;
+    memcpy(&h, m_data + offset, sizeof(h));
+    if (h.images < 1 || h.images > 2) {
+        return false;
+    }
+    size = sizeof(RecordHeader);
+    for (uint32_t i = 0; i < h.images; i++) {
+        size += alignUp(h.image[i].size, 8);
+    }
+    return offset + size <= m_size;
+}
+
+bool StereoRecordReader::read(size_t i, StereoRecord& record) const
+{
+    size_t size = 0;
+    if (i >= m_index.size() || !recordExtent(m_index[i].offset, size)) {
+        return false;
+    }
+    const uchar* p = m_data + m_index[i].offset;
+    RecordHeader h;
+    memcpy(&h, p, sizeof(h));
+    record.sequence = h.sequence;
+    record.stamp_ns[0] = h.stamp_ns[0];
+    record.stamp_ns[1] = h.stamp_ns[1];
+    record.sideBySide = h.sideBySide != 0;
+    record.image[1] = RecordedImage();
+    // views into the read only mapping, nothing writes through them
+    uchar* data = const_cast<uchar*>(p) + sizeof(RecordHeader);
+    for (uint32_t k = 0; k < h.images; k++) {
+        const ImageHeader& ih = h.image[k];
+        RecordedImage& image = record.image[k];
+        image.fourcc = ih.fourcc;
+        image.width = ih.width;
+        image.height = ih.height;
+        if (ih.fourcc == fourcc('B', 'G', 'R', '3') || ih.fourcc == fourcc('G', 'R', 'E', 'Y')) {
+            const int type = ih.fourcc == fourcc('G', 'R', 'E', 'Y') ? CV_8UC1 : CV_8UC3;
+            if ((uint64_t)ih.width * ih.height * CV_ELEM_SIZE(type) != ih.size) {
+                return false;
+            }
+            image.data = cv::Mat(ih.height, ih.width, type, data);
+        } else {
+            image.data = cv::Mat(1, (int)ih.size, CV_8UC1, data);
+        }
+        data += alignUp(ih.size, 8);
+    }
+    return true;
+}
+
+void StereoRecordReader::prefetch(size_t first, size_t last) const
+{
+    last = std::min(last, m_index.size());
+    if (first >= last) {
+        return;
+    }
+    size_t size = 0;
+    recordExtent(m_index[last - 1].offset, size);
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t begin = m_index[first].offset / page * page;
+    const size_t end = std::min(m_size, (size_t)(m_index[last - 1].offset + size));
+    if (end > begin) {
+        madvise(const_cast<uchar*>(m_data) + begin, end - begin, MADV_WILLNEED);
+    }
+}
+
+}  // namespace usb_camera
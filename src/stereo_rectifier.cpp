@@ -0,0 +1,228 @@
+#include "usb_camera/stereo_rectifier.h"
+
+#include <algorithm>
+
+#include "usb_camera/parallel.h"
+#include "usb_camera/rectify_kernels.h"
+
+namespace usb_camera {
+
+RectifyWeights::RectifyWeights()
+{
+    for (int fy = 0; fy < 32; fy++) {
+        for (int fx = 0; fx < 32; fx++) {
+            uint32_t w00 = (32 - fx) * (32 - fy), w01 = fx * (32 - fy);
+            uint32_t w10 = (32 - fx) * fy, w11 = fx * fy;
+            top[fy * 32 + fx] = w00 | (w01 << 16);
+            bottom[fy * 32 + fx] = w10 | (w11 << 16);
+        }
+    }
+}
+
+const RectifyWeights g_rectifyWeights;
+
+namespace {
+
+// The AVX2 rows are built in their own unit, whatever -march the rest of the
+// library gets, and used when the CPU has AVX2.
+#if defined(USB_CAMERA_HAVE_AVX2)
+const bool g_avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+#endif
+
+void remapRowC3(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst)
+{
+#if defined(USB_CAMERA_HAVE_AVX2)
+    if (g_avx2) {
+        remapRowC3Avx2(c, ofs, frac, n, dst);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        blendPixelC3(c, ofs, frac, i, dst + i * 3);
+    }
+}
+
+void remapRowC1(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst)
+{
+#if defined(USB_CAMERA_HAVE_AVX2)
+    if (g_avx2) {
+        remapRowC1Avx2(c, ofs, frac, n, dst);
+        return;
+    }
+#endif
+    for (int i = 0; i < n; i++) {
+        blendPixel(c, ofs, frac, i, dst + i);
+    }
+}
+
+void remapRow(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst)
+{
+    if (c.cn == 3) {
+        remapRowC3(c, ofs, frac, n, dst);
+    } else if (c.cn == 1) {
+        remapRowC1(c, ofs, frac, n, dst);
+    } else {
+        for (int i = 0; i < n; i++) {
+            blendPixel(c, ofs, frac, i, dst + i * c.cn);
+        }
+    }
+}
+
+}  // namespace
+
+StereoRectifier::StereoRectifier()
+    : m_tilesPerRow(0),
+      m_bands(0),
+      m_uses(0)
+{
+}
+
+void StereoRectifier::init(const cv::Mat map1[2], const cv::Mat map2[2])
+{
+    CV_Assert(map1[0].type() == CV_16SC2 && map1[1].type() == CV_16SC2);
+    CV_Assert(map2[0].type() == CV_16UC1 && map2[1].type() == CV_16UC1);
+    CV_Assert(map1[0].size() == map1[1].size() && map2[0].size() == map1[0].size() && map2[1].size() == map1[0].size());
+
+    m_size = map1[0].size();
+    m_tilesPerRow = (m_size.width + kTileWidth - 1) / kTileWidth;
+    m_bands = (m_size.height + kTileHeight - 1) / kTileHeight;
+    m_tiles.clear();
+    size_t first = 0;
+    for (int by = 0; by < m_bands; by++) {
+        for (int bx = 0; bx < m_tilesPerRow; bx++) {
+            Tile t;
+            t.x = bx * kTileWidth;
+            t.y = by * kTileHeight;
+            t.width = std::min(kTileWidth, m_size.width - t.x);
+            t.height = std::min(kTileHeight, m_size.height - t.y);
+            t.first = first;
+            first += (size_t)t.width * t.height;
+            m_tiles.push_back(t);
+        }
+    }
+
+    for (int k = 0; k < 2; k++) {
+        m_map1[k] = map1[k];
+        m_frac[k].resize(first);
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            const Tile& t = m_tiles[i];
+            for (int r = 0; r < t.height; r++) {
+                const ushort* f = map2[k].ptr<ushort>(t.y + r) + t.x;
+                std::copy(f, f + t.width, &m_frac[k][t.first + (size_t)r * t.width]);
+            }
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        m_layouts[i] = Layout();
+    }
+    m_uses = 0;
+}
+
+const StereoRectifier::Layout& StereoRectifier::layout(size_t step, int cn, cv::Size srcSize)
+{
+    Layout* l = &m_layouts[0];
+    for (int i = 0; i < 2; i++) {
+        if (m_layouts[i].cn == cn && m_layouts[i].step == step && m_layouts[i].src == srcSize) {
+            l = &m_layouts[i];
+            l->lastUse = ++m_uses;
+            return *l;
+        }
+        if (m_layouts[i].lastUse < l->lastUse) {
+            l = &m_layouts[i];
+        }
+    }
+    l->step = step;
+    l->cn = cn;
+    l->src = srcSize;
+    pack(*l);
+    l->lastUse = ++m_uses;
+    return *l;
+}
+
+void StereoRectifier::pack(Layout& l) const
+{
+    const size_t step = l.step;
+    const int cn = l.cn;
+    const cv::Size srcSize = l.src;
+    for (int k = 0; k < 2; k++) {
+        l.ofs[k].resize(m_frac[k].size());
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            const Tile& t = m_tiles[i];
+            for (int r = 0; r < t.height; r++) {
+                const cv::Vec2s* xy = m_map1[k].ptr<cv::Vec2s>(t.y + r) + t.x;
+                int32_t* ofs = &l.ofs[k][t.first + (size_t)r * t.width];
+                for (int j = 0; j < t.width; j++) {
+                    const int x = xy[j][0], y = xy[j][1];
+                    // both taps plus the 4 byte loads of the kernels stay inside the eye
+                    const bool inside = x >= 0 && y >= 0 && y + 1 < srcSize.height &&
+                                        (x + 1) * cn + 4 <= srcSize.width * cn;
+                    ofs[j] = inside ? (int32_t)(y * step + x * cn) : -1;
+                }
+            }
+        }
+    }
+}
+
+void StereoRectifier::rectify(const cv::Mat& frame, cv::Mat& left, cv::Mat& right)
+{
+    rectify(frame, left, right, cv::Rect(cv::Point(), m_size));
+}
+
+void StereoRectifier::rectify(const cv::Mat& frame, cv::Mat& left, cv::Mat& right, const cv::Rect& roi)
+{
+    CV_Assert(frame.cols % 2 == 0);
+    const int half = frame.cols / 2;
+    rectify(frame(cv::Rect(0, 0, half, frame.rows)), frame(cv::Rect(half, 0, half, frame.rows)), left, right, roi);
+}
+
+void StereoRectifier::rectify(const cv::Mat& srcL, const cv::Mat& srcR, cv::Mat& left, cv::Mat& right)
+{
+    rectify(srcL, srcR, left, right, cv::Rect(cv::Point(), m_size));
+}
+
+void StereoRectifier::rectify(const cv::Mat& srcL, const cv::Mat& srcR, cv::Mat& left, cv::Mat& right,
+                              const cv::Rect& roi)
+{
+    CV_Assert(!empty());
+    CV_Assert(srcL.type() == srcR.type() && srcL.depth() == CV_8U && srcL.channels() <= 4);
+    CV_Assert(srcL.size() == srcR.size() && srcL.step == srcR.step);
+    const cv::Rect r = roi & cv::Rect(cv::Point(), m_size);
+    CV_Assert(r.area() > 0);
+
+    const Layout& l = layout(srcL.step, srcL.channels(), srcL.size());
+    left.create(r.size(), srcL.type());
+    right.create(r.size(), srcL.type());
+
+    const cv::Mat src[2] = { srcL, srcR };
+    cv::Mat dst[2] = { left, right };
+    const int first = r.y / kTileHeight;
+    const int last = (r.y + r.height - 1) / kTileHeight;
+    parallelFor(cv::Range(first, last + 1), [&](int b) { rectifyBand(b, l, src, dst, r); }, last + 1 - first);
+}
+
+void StereoRectifier::rectifyBand(int band, const Layout& l, const cv::Mat* src, cv::Mat* dst, const cv::Rect& roi) const
+{
+    const int cn = src[0].channels();
+    const int firstTile = band * m_tilesPerRow + roi.x / kTileWidth;
+    const int lastTile = band * m_tilesPerRow + (roi.x + roi.width - 1) / kTileWidth;
+    for (int k = 0; k < 2; k++) {
+        RowContext c;
+        c.src = src[k].ptr();
+        c.step = src[k].step;
+        c.srcSize = src[k].size();
+        c.cn = cn;
+        for (int i = firstTile; i <= lastTile; i++) {
+            const Tile& t = m_tiles[i];
+            // the part of the tile inside roi, all of it for a full frame
+            const int x0 = std::max(t.x, roi.x), x1 = std::min(t.x + t.width, roi.x + roi.width);
+            const int y0 = std::max(t.y, roi.y), y1 = std::min(t.y + t.height, roi.y + roi.height);
+            for (int y = y0; y < y1; y++) {
+                const size_t e = t.first + (size_t)(y - t.y) * t.width + (x0 - t.x);
+                c.xy = m_map1[k].ptr<cv::Vec2s>(y) + x0;
+                remapRow(c, &l.ofs[k][e], &m_frac[k][e], x1 - x0, dst[k].ptr(y - roi.y) + (x0 - roi.x) * cn);
+            }
+        }
+    }
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,76 @@
+// Built with -mavx2 and only entered after a runtime check, see
+// remapRowC3/remapRowC1 in stereo_rectifier.cpp.
+
+#include "usb_camera/rectify_kernels.h"
+
+#include <immintrin.h>
+
+namespace usb_camera {
+
+void remapRowC3Avx2(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst)
+{
+    const __m256i round = _mm256_set1_epi32(512);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        if ((ofs[i] | ofs[i + 1]) < 0) {
+            blendPixelC3(c, ofs, frac, i, dst + i * 3);
+            blendPixelC3(c, ofs, frac, i + 1, dst + i * 3 + 3);
+            continue;
+        }
+        const uchar* s0 = c.src + ofs[i];
+        const uchar* s1 = c.src + ofs[i + 1];
+        __m256i t = _mm256_inserti128_si256(_mm256_castsi128_si256(tapsC3(s0)), tapsC3(s1), 1);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(tapsC3(s0 + c.step)), tapsC3(s1 + c.step), 1);
+        const int wt0 = (int)g_rectifyWeights.top[frac[i]], wt1 = (int)g_rectifyWeights.top[frac[i + 1]];
+        const int wb0 = (int)g_rectifyWeights.bottom[frac[i]], wb1 = (int)g_rectifyWeights.bottom[frac[i + 1]];
+        __m256i acc = _mm256_add_epi32(_mm256_madd_epi16(t, _mm256_setr_epi32(wt0, wt0, wt0, wt0, wt1, wt1, wt1, wt1)),
+                                       _mm256_madd_epi16(b, _mm256_setr_epi32(wb0, wb0, wb0, wb0, wb1, wb1, wb1, wb1)));
+        acc = _mm256_srli_epi32(_mm256_add_epi32(acc, round), 10);
+        acc = _mm256_packus_epi16(_mm256_packs_epi32(acc, acc), acc);
+        uint32_t v0 = (uint32_t)_mm256_cvtsi256_si32(acc);
+        uint32_t v1 = (uint32_t)_mm256_extract_epi32(acc, 4);
+        memcpy(dst + i * 3, &v0, 3);
+        memcpy(dst + i * 3 + 3, &v1, 3);
+    }
+    for (; i < n; i++) {
+        blendPixelC3(c, ofs, frac, i, dst + i * 3);
+    }
+}
+
+void remapRowC1Avx2(const RowContext& c, const int32_t* ofs, const uint16_t* frac, int n, uchar* dst)
+{
+    // 8 pixels per step: gather the two taps of the top and bottom row as one
+    // 32 bit load each, spread them to int16 pairs and blend with madd.
+    const __m256i spread = _mm256_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+                                            0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+    const __m256i round = _mm256_set1_epi32(512);
+    const int* top = reinterpret_cast<const int*>(c.src);
+    const int* bottom = reinterpret_cast<const int*>(c.src + c.step);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i o = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ofs + i));
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(o)) != 0) {
+            for (int j = i; j < i + 8; j++) {
+                blendPixel(c, ofs, frac, j, dst + j);
+            }
+            continue;
+        }
+        __m256i f = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(frac + i)));
+        __m256i wt = _mm256_i32gather_epi32(reinterpret_cast<const int*>(g_rectifyWeights.top), f, 4);
+        __m256i wb = _mm256_i32gather_epi32(reinterpret_cast<const int*>(g_rectifyWeights.bottom), f, 4);
+        __m256i t = _mm256_shuffle_epi8(_mm256_i32gather_epi32(top, o, 1), spread);
+        __m256i b = _mm256_shuffle_epi8(_mm256_i32gather_epi32(bottom, o, 1), spread);
+        __m256i acc = _mm256_add_epi32(_mm256_madd_epi16(t, wt), _mm256_madd_epi16(b, wb));
+        acc = _mm256_srli_epi32(_mm256_add_epi32(acc, round), 10);
+        acc = _mm256_packus_epi16(_mm256_packs_epi32(acc, acc), acc);
+        uint32_t v0 = (uint32_t)_mm256_cvtsi256_si32(acc);
+        uint32_t v1 = (uint32_t)_mm256_extract_epi32(acc, 4);
+        memcpy(dst + i, &v0, 4);
+        memcpy(dst + i + 4, &v1, 4);
+    }
+    for (; i < n; i++) {
+        blendPixel(c, ofs, frac, i, dst + i);
+    }
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,32 @@
+#include "usb_camera/thread_util.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace usb_camera {
+
+bool pinCurrentThread(int cpu)
+{
+    if (cpu < 0) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r != 0) {
+        std::cerr << "WARNING: Can't pin thread to CPU " << cpu << ": " << strerror(r) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void setCurrentThreadName(const std::string& name)
+{
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+}
+
+}  // namespace usb_camera
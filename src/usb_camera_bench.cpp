@@ -0,0 +1,410 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+
+#include <ros/package.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include "usb_camera/camera_model.h"
+#include "usb_camera/disparity_estimator.h"
+#include "usb_camera/jpeg_codec.h"
+#include "usb_camera/message_pool.h"
+#include "usb_camera/stereo_rectifier.h"
+
+// Synthetic benchmark of the m2_camera image pipeline, no camera needed.
+//
+//   usb_camera_bench [--frames N] [--resolutions 240p,480p,720p] [--filter substring]
+//                    [--calib-dir dir]
+//
+// Every stage runs on generated side-by-side frames with the calibrations in
+// calib/ (720p is the 480p calibration scaled by 1.5). One JSON object per
+// resolution and stage goes to stdout: throughput, mean/p50/p99 latency and
+// allocations per frame (operator new, which includes one per cv::Mat
+// buffer). Progress goes to stderr.
+
+namespace {
+
+// every operator new; a cv::Mat buffer counts once, through the UMatData
+// the standard allocator creates next to the fastMalloc'ed pixels
+std::atomic<size_t> g_allocations(0);
+
+}  // namespace
+
+void* operator new(size_t size)
+{
+    g_allocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+struct Resolution {
+    std::string name;
+    usb_camera::StereoCameraModel model;
+    cv::Size frameSize;     // side by side
+};
+
+struct Result {
+    std::string resolution;
+    std::string stage;
+    int frames = 0;
+    double fps = 0;
+    double mean_ms = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    double allocs_per_frame = 0;
+    double bytes_per_frame = 0;    // stage output size, 0 if not meaningful
+};
+
+double percentile(std::vector<double> v, double q)
+{
+    if (v.empty()) {
+        return 0.0;
+    }
+    size_t k = std::min(v.size() - 1, (size_t)(q * (v.size() - 1) + 0.5));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+// Run `body` frames times after a short warm-up, timing every call.
+Result bench(const std::string& resolution, const std::string& stage, int frames,
+             const std::function<size_t(int)>& body)
+{
+    for (int i = 0; i < 3; i++) {
+        body(i);
+    }
+    std::vector<double> ms(frames);
+    size_t bytes = 0;
+    size_t allocs0 = g_allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        bytes += body(i);
+        ms[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t allocs = g_allocations.load() - allocs0;
+
+    Result r;
+    r.resolution = resolution;
+    r.stage = stage;
+    r.frames = frames;
+    r.fps = total > 0 ? frames / total : 0.0;
+    double sum = 0;
+    for (size_t i = 0; i < ms.size(); i++) {
+        sum += ms[i];
+    }
+    r.mean_ms = frames ? sum / frames : 0.0;
+    r.p50_ms = percentile(ms, 0.5);
+    r.p99_ms = percentile(ms, 0.99);
+    r.allocs_per_frame = frames ? (double)allocs / frames : 0.0;
+    r.bytes_per_frame = frames ? (double)bytes / frames : 0.0;
+    return r;
+}
+
+void print(const Result& r)
+{
+    std::ostringstream s;
+    s.precision(4);
+    s << std::fixed;
+    s << "{\"resolution\": \"" << r.resolution << "\", \"stage\": \"" << r.stage << "\""
+      << ", \"frames\": " << r.frames
+      << ", \"fps\": " << r.fps
+      << ", \"mean_ms\": " << r.mean_ms
+      << ", \"p50_ms\": " << r.p50_ms
+      << ", \"p99_ms\": " << r.p99_ms
+      << ", \"allocs_per_frame\": " << r.allocs_per_frame
+      << ", \"bytes_per_frame\": " << r.bytes_per_frame << "}";
+    std::cout << s.str() << std::endl;
+    std::cerr << cv::format("%-6s %-24s %9.1f fps  p50 %8.3f ms  p99 %8.3f ms  %6.1f allocs/frame",
+                            r.resolution.c_str(), r.stage.c_str(), r.fps, r.p50_ms, r.p99_ms, r.allocs_per_frame)
+              << std::endl;
+}
+
+// Textured side-by-side frame: gradients, a grid and noise, so JPEG sizes
+// and remap access patterns look like a real scene rather than a flat image.
+cv::Mat syntheticFrame(cv::Size size, int seed)
+{
+    cv::Mat frame(size, CV_8UC3);
+    for (int y = 0; y < size.height; y++) {
+        cv::Vec3b* row = frame.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < size.width; x++) {
+            const bool cell = ((x / 32) + (y / 32)) % 2 == 0;
+            row[x] = cv::Vec3b((uchar)(x * 255 / size.width), (uchar)(y * 255 / size.height), cell ? 200 : 40);
+        }
+    }
+    cv::Mat noise(size, CV_8UC3);
+    cv::RNG rng(seed);
+    rng.fill(noise, cv::RNG::NORMAL, 0, 12);
+    cv::add(frame, noise, frame);
+    return frame;
+}
+
+bool loadResolutions(const std::string& calibDir, const std::vector<std::string>& names, std::vector<Resolution>& out)
+{
+    usb_camera::StereoCameraModel m240, m480;
+    if (!m240.load(calibDir + "/m2_calibration_240p.yml") || !m480.load(calibDir + "/m2_calibration_480p.yml")) {
+        return false;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        Resolution r;
+        r.name = names[i];
+        if (names[i] == "240p") {
+            r.model = m240;
+        } else if (names[i] == "480p") {
+            r.model = m480;
+        } else if (names[i] == "720p") {
+            r.model = m480.scaled(1.5);
+        } else {
+            std::cerr << "ERROR: Unknown resolution " << names[i] << std::endl;
+            return false;
+        }
+        r.frameSize = cv::Size(2 * r.model.imageSize.width, r.model.imageSize.height);
+        out.push_back(r);
+    }
+    return true;
+}
+
+std::vector<std::string> splitList(const std::string& s)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int frames = 200;
+    std::string filter;
+    std::string calibDir = ros::package::getPath("usb_camera") + "/calib";
+    std::vector<std::string> names = splitList("240p,480p,720p");
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--resolutions" && i + 1 < argc) {
+            names = splitList(argv[++i]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--calib-dir" && i + 1 < argc) {
+            calibDir = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--frames N] [--resolutions 240p,480p,720p]"
+                      << " [--filter substring] [--calib-dir dir]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Resolution> resolutions;
+    if (!loadResolutions(calibDir, names, resolutions)) {
+        return 1;
+    }
+
+    for (size_t ri = 0; ri < resolutions.size(); ri++) {
+        const Resolution& res = resolutions[ri];
+        const std::string& rn = res.name;
+        const int half = res.frameSize.width / 2;
+        const cv::Rect roi[2] = { cv::Rect(0, 0, half, res.frameSize.height),
+                                  cv::Rect(half, 0, half, res.frameSize.height) };
+        std::cerr << rn << ": " << res.frameSize.width << "x" << res.frameSize.height << std::endl;
+
+        // a few distinct frames so caches don't see the same pixels every time
+        std::vector<cv::Mat> input, inputGray;
+        std::vector<std::vector<uchar> > jpegs;
+        for (int k = 0; k < 4; k++) {
+            input.push_back(syntheticFrame(res.frameSize, k));
+            jpegs.push_back(std::vector<uchar>());
+            cv::imencode(".jpg", input.back(), jpegs.back());
+            inputGray.push_back(cv::Mat());
+            cv::cvtColor(input.back(), inputGray.back(), cv::COLOR_BGR2GRAY);
+        }
+        auto frame = [&](int i) -> const cv::Mat& { return input[i % input.size()]; };
+        auto frameGray = [&](int i) -> const cv::Mat& { return inputGray[i % inputGray.size()]; };
+        auto jpeg = [&](int i) -> const std::vector<uchar>& { return jpegs[i % jpegs.size()]; };
+
+        cv::Mat map1[2], map2[2];
+        res.model.rectifyMaps(map1, map2);
+        usb_camera::StereoRectifier rectifier;
+        rectifier.init(map1, map2);
+        usb_camera::JpegCodec codec;
+        cv::Mat out[2], gray[2], lower[2], decoded, disparity;
+        std::vector<uchar> encoded;
+        usb_camera::DisparityOptions disparityOptions;
+        usb_camera::DisparityEstimator sgbm(disparityOptions);
+        disparityOptions.strips = 1;
+        usb_camera::DisparityEstimator sgbmOneStrip(disparityOptions);
+        std_msgs::Header header;
+        usb_camera::MessagePool<sensor_msgs::Image> messagePool;
+
+        struct Stage {
+            const char* name;
+            std::function<size_t(int)> body;
+        };
+        std::vector<Stage> stages = {
+            { "split", [&](int i) {
+                for (int k = 0; k < 2; k++) {
+                    frame(i)(roi[k]).copyTo(out[k]);
+                }
+                return out[0].total() * out[0].elemSize() * 2;
+            } },
+            { "init_rectify_map", [&](int) {
+                cv::Mat m1[2], m2[2];
+                res.model.rectifyMaps(m1, m2);
+                return (size_t)0;
+            } },
+            { "remap", [&](int i) {
+                for (int k = 0; k < 2; k++) {
+                    cv::remap(frame(i)(roi[k]), out[k], map1[k], map2[k], cv::INTER_LINEAR);
+                }
+                return out[0].total() * out[0].elemSize() * 2;
+            } },
+            { "stereo_rectifier", [&](int i) {
+                rectifier.rectify(frame(i), out[0], out[1]);
+                return out[0].total() * out[0].elemSize() * 2;
+            } },
+            { "stereo_rectifier_mono", [&](int i) {
+                rectifier.rectify(frameGray(i), gray[0], gray[1]);
+                return gray[0].total() * 2;
+            } },
+            { "stereo_rectifier_lower_half", [&](int i) {
+                const cv::Size size = rectifier.size();
+                rectifier.rectify(frame(i), lower[0], lower[1], cv::Rect(0, size.height / 2, size.width, size.height / 2));
+                return lower[0].total() * lower[0].elemSize() * 2;
+            } },
+            { "disparity_sgbm", [&](int i) {
+                sgbm.compute(frameGray(i)(roi[0]), frameGray(i)(roi[1]), disparity);
+                return disparity.total() * disparity.elemSize();
+            } },
+            { "disparity_sgbm_one_strip", [&](int i) {
+                sgbmOneStrip.compute(frameGray(i)(roi[0]), frameGray(i)(roi[1]), disparity);
+                return disparity.total() * disparity.elemSize();
+            } },
+            { "bgr_to_mono", [&](int i) {
+                for (int k = 0; k < 2; k++) {
+                    cv::cvtColor(frame(i)(roi[k]), gray[k], cv::COLOR_BGR2GRAY);
+                }
+                return gray[0].total() * 2;
+            } },
+            { "to_image_msg", [&](int i) {
+                size_t bytes = 0;
+                for (int k = 0; k < 2; k++) {
+                    sensor_msgs::ImagePtr msg = cv_bridge::CvImage(header, "bgr8", frame(i)(roi[k])).toImageMsg();
+                    bytes += msg->data.size();
+                }
+                return bytes;
+            } },
+            { "image_msg_in_place", [&](int i) {
+                // a new message per image: size it, write into it
+                size_t bytes = 0;
+                for (int k = 0; k < 2; k++) {
+                    sensor_msgs::ImagePtr msg = boost::make_shared<sensor_msgs::Image>();
+                    msg->header = header;
+                    msg->width = half;
+                    msg->height = res.frameSize.height;
+                    msg->encoding = sensor_msgs::image_encodings::BGR8;
+                    msg->step = half * 3;
+                    msg->data.resize((size_t)msg->step * msg->height);
+                    frame(i)(roi[k]).copyTo(cv::Mat(res.frameSize.height, half, CV_8UC3, msg->data.data(), msg->step));
+                    bytes += msg->data.size();
+                }
+                return bytes;
+            } },
+            { "image_msg_pooled", [&](int i) {
+                // M2CameraDriver since the message pool: the buffers of released messages are reused
+                size_t bytes = 0;
+                for (int k = 0; k < 2; k++) {
+                    sensor_msgs::ImagePtr msg = messagePool.acquire((size_t)half * 3 * res.frameSize.height);
+                    msg->header = header;
+                    msg->width = half;
+                    msg->height = res.frameSize.height;
+                    msg->encoding = sensor_msgs::image_encodings::BGR8;
+                    msg->step = half * 3;
+                    frame(i)(roi[k]).copyTo(cv::Mat(res.frameSize.height, half, CV_8UC3, msg->data.data(), msg->step));
+                    bytes += msg->data.size();
+                }
+                return bytes;
+            } },
+            { "jpeg_encode", [&](int i) {
+                std::vector<uchar> buf;
+                cv::imencode(".jpg", frame(i), buf);
+                return buf.size();
+            } },
+            { "jpeg_encode_turbo_halves", [&](int i) {
+                // what ~rect_compressed does per eye, here one after the other
+                size_t bytes = 0;
+                for (int k = 0; k < 2; k++) {
+                    codec.encode(frame(i)(roi[k]), 80, TJSAMP_420, encoded);
+                    bytes += encoded.size();
+                }
+                return bytes;
+            } },
+            { "jpeg_decode_opencv", [&](int i) {
+                cv::imdecode(jpeg(i), cv::IMREAD_COLOR, &decoded);
+                return decoded.total() * decoded.elemSize();
+            } },
+            { "jpeg_decode_turbo", [&](int i) {
+                codec.decode(jpeg(i).data(), jpeg(i).size(), decoded, 1);
+                return decoded.total() * decoded.elemSize();
+            } },
+            { "jpeg_decode_turbo_1_2", [&](int i) {
+                codec.decode(jpeg(i).data(), jpeg(i).size(), decoded, 2);
+                return decoded.total() * decoded.elemSize();
+            } },
+            { "jpeg_decode_turbo_gray", [&](int i) {
+                codec.decodeGray(jpeg(i).data(), jpeg(i).size(), decoded, 1);
+                return decoded.total() * decoded.elemSize();
+            } },
+            { "jpeg_split", [&](int i) {
+                std::vector<uchar> left, right;
+                codec.splitHalves(jpeg(i).data(), jpeg(i).size(), left, right);
+                return left.size() + right.size();
+            } },
+        };
+
+        for (size_t s = 0; s < stages.size(); s++) {
+            if (!filter.empty() && std::string(stages[s].name).find(filter) == std::string::npos) {
+                continue;
+            }
+            print(bench(rn, stages[s].name, frames, stages[s].body));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,283 @@
+#include "usb_camera/v4l2_capture.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+namespace usb_camera {
+
+static int xioctl(int fd, unsigned long request, void* arg)
+{
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static std::string fourccToString(uint32_t code)
+{
+    std::string s(4, ' ');
+    for (int i = 0; i < 4; i++) {
+        s[i] = (char)((code >> (8 * i)) & 0xff);
+    }
+    return s;
+}
+
+V4L2Capture::V4L2Capture(int bufferCount, bool exportDmabuf)
+    : m_fd(-1),
+      m_requestedBuffers(bufferCount < 2 ? 2 : bufferCount),
+      m_exportDmabuf(exportDmabuf),
+      m_streaming(false),
+      m_bytesPerLine(0)
+{
+}
+
+V4L2Capture::~V4L2Capture()
+{
+    close();
+}
+
+bool V4L2Capture::open(const std::string& deviceName, const CaptureFormat& format)
+{
+    close();
+
+    m_fd = ::open(deviceName.c_str(), O_RDWR | O_NONBLOCK);
+    if (m_fd < 0) {
+        std::cerr << "ERROR: Can't open " << deviceName << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(m_fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        std::cerr << "ERROR: " << deviceName << " is not a V4L2 device" << std::endl;
+        close();
+        return false;
+    }
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        std::cerr << "ERROR: " << deviceName << " does not support streaming capture" << std::endl;
+        close();
+        return false;
+    }
+
+    if (!setFormat(format) || !initBuffers()) {
+        close();
+        return false;
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(m_fd, VIDIOC_STREAMON, &type) < 0) {
+        std::cerr << "ERROR: VIDIOC_STREAMON failed: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    m_streaming = true;
+    return true;
+}
+
+void V4L2Capture::close()
+{
+    if (m_fd < 0) {
+        return;
+    }
+    if (m_streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+        m_streaming = false;
+    }
+    freeBuffers();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+bool V4L2Capture::setFormat(const CaptureFormat& format)
+{
+    v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = format.width;
+    fmt.fmt.pix.height = format.height;
+    fmt.fmt.pix.pixelformat = format.fourcc;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) < 0) {
+        std::cerr << "ERROR: VIDIOC_S_FMT failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (fmt.fmt.pix.pixelformat != format.fourcc) {
+        std::cerr << "ERROR: Pixel format " << fourccToString(format.fourcc) << " not supported, driver offers "
+                  << fourccToString(fmt.fmt.pix.pixelformat) << std::endl;
+        return false;
+    }
+    m_format.width = fmt.fmt.pix.width;
+    m_format.height = fmt.fmt.pix.height;
+    m_format.fourcc = fmt.fmt.pix.pixelformat;
+    m_bytesPerLine = fmt.fmt.pix.bytesperline;
+
+    v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1000;
+    parm.parm.capture.timeperframe.denominator = (uint32_t)(format.fps * 1000.0);
+    m_format.fps = format.fps;
+    if (xioctl(m_fd, VIDIOC_S_PARM, &parm) == 0 && parm.parm.capture.timeperframe.numerator != 0) {
+        m_format.fps = (double)parm.parm.capture.timeperframe.denominator / parm.parm.capture.timeperframe.numerator;
+    }
+    return true;
+}
+
+bool V4L2Capture::initBuffers()
+{
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = m_requestedBuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(m_fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        std::cerr << "ERROR: VIDIOC_REQBUFS failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    m_buffers.resize(req.count);
+    for (uint32_t i = 0; i < req.count; i++) {
+        v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            std::cerr << "ERROR: VIDIOC_QUERYBUF failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        m_buffers[i].length = buf.length;
+        m_buffers[i].start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+        if (m_buffers[i].start == MAP_FAILED) {
+            m_buffers[i].start = nullptr;
+            std::cerr << "ERROR: mmap of buffer " << i << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        if (m_exportDmabuf) {
+            v4l2_exportbuffer expbuf;
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            expbuf.index = i;
+            expbuf.flags = O_RDONLY | O_CLOEXEC;
+            if (xioctl(m_fd, VIDIOC_EXPBUF, &expbuf) == 0) {
+                m_buffers[i].dmabuf_fd = expbuf.fd;
+            } else {
+                std::cerr << "WARNING: VIDIOC_EXPBUF not supported, DMABUF export disabled" << std::endl;
+                m_exportDmabuf = false;
+            }
+        }
+
+        if (xioctl(m_fd, VIDIOC_QBUF, &buf) < 0) {
+            std::cerr << "ERROR: VIDIOC_QBUF failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void V4L2Capture::freeBuffers()
+{
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        if (m_buffers[i].dmabuf_fd >= 0) {
+            ::close(m_buffers[i].dmabuf_fd);
+        }
+        if (m_buffers[i].start) {
+            munmap(m_buffers[i].start, m_buffers[i].length);
+        }
+    }
+    m_buffers.clear();
+
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(m_fd, VIDIOC_REQBUFS, &req);
+}
+
+bool V4L2Capture::dequeue(CapturedFrame& frame, int timeout_ms)
+{
+    if (!m_streaming) {
+        return false;
+    }
+
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r;
+    do {
+        r = poll(&pfd, 1, timeout_ms);
+    } while (r == -1 && errno == EINTR);
+    if (r <= 0) {
+        return false;
+    }
+
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(m_fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN) {
+            std::cerr << "ERROR: VIDIOC_DQBUF failed: " << strerror(errno) << std::endl;
+        }
+        return false;
+    }
+
+    const Buffer& b = m_buffers[buf.index];
+    uchar* ptr = static_cast<uchar*>(b.start);
+    frame.index = buf.index;
+    frame.fourcc = m_format.fourcc;
+    frame.bytesused = buf.bytesused;
+    frame.sequence = buf.sequence;
+    frame.timestamp_ns = (int64_t)buf.timestamp.tv_sec * 1000000000LL + (int64_t)buf.timestamp.tv_usec * 1000LL;
+    frame.dmabuf_fd = b.dmabuf_fd;
+
+    switch (m_format.fourcc) {
+    case V4L2_PIX_FMT_YUYV:
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC2, ptr, m_bytesPerLine);
+        break;
+    case V4L2_PIX_FMT_BGR24:
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC3, ptr, m_bytesPerLine);
+        break;
+    case V4L2_PIX_FMT_GREY:
+        frame.data = cv::Mat(m_format.height, m_format.width, CV_8UC1, ptr, m_bytesPerLine);
+        break;
+    default:
+        // compressed formats (MJPG, JPEG): hand out the bitstream as is
+        frame.data = cv::Mat(1, (int)buf.bytesused, CV_8UC1, ptr);
+        break;
+    }
+    return true;
+}
+
+void V4L2Capture::release(CapturedFrame& frame)
+{
+    if (frame.index < 0 || !m_streaming) {
+        return;
+    }
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = frame.index;
+    if (xioctl(m_fd, VIDIOC_QBUF, &buf) < 0) {
+        std::cerr << "ERROR: VIDIOC_QBUF failed: " << strerror(errno) << std::endl;
+    }
+    frame.data.release();
+    frame.index = -1;
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,138 @@
+#include "usb_camera/view_selection.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace usb_camera {
+
+BoardPose boardPose(const std::vector<cv::Point2f>& corners, cv::Size boardSize, cv::Size imageSize)
+{
+    BoardPose p;
+    if (corners.size() != (size_t)boardSize.area() || imageSize.area() == 0) {
+        return p;
+    }
+    // outer corners in findChessboardCorners order
+    const cv::Point2f ul = corners[0];
+    const cv::Point2f ur = corners[boardSize.width - 1];
+    const cv::Point2f dr = corners.back();
+    const cv::Point2f dl = corners[corners.size() - boardSize.width];
+
+    cv::Point2f sum(0, 0);
+    for (size_t i = 0; i < corners.size(); i++) {
+        sum += corners[i];
+    }
+    p.x = sum.x / corners.size() / imageSize.width;
+    p.y = sum.y / corners.size() / imageSize.height;
+
+    const std::vector<cv::Point2f> quad = { ul, ur, dr, dl };
+    p.size = std::min(1.0, std::sqrt(cv::contourArea(quad) / imageSize.area()));
+
+    const cv::Point2f a = ur - ul;
+    const cv::Point2f b = dl - ul;
+    const double angle = std::acos(std::max(-1.0, std::min(1.0, a.dot(b) / (cv::norm(a) * cv::norm(b) + 1e-12))));
+    p.skew = std::min(1.0, 2 * std::fabs(CV_PI / 2 - angle));
+    return p;
+}
+
+namespace {
+
+// Cells of both cameras hit by the board, camera 1 after camera 0.
+std::vector<int> cells(const StereoView& view, cv::Size grid, cv::Size imageSize)
+{
+    std::vector<int> out;
+    for (int k = 0; k < 2; k++) {
+        const std::vector<cv::Point2f>& c = *view.corners[k];
+        for (size_t i = 0; i < c.size(); i++) {
+            const int cx = std::max(0, std::min(grid.width - 1, (int)(c[i].x * grid.width / imageSize.width)));
+            const int cy = std::max(0, std::min(grid.height - 1, (int)(c[i].y * grid.height / imageSize.height)));
+            out.push_back(k * grid.area() + cy * grid.width + cx);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+double distance(const BoardPose& a, const BoardPose& b)
+{
+    const double dx = a.x - b.x, dy = a.y - b.y, ds = a.size - b.size, dk = a.skew - b.skew;
+    return std::sqrt(dx * dx + dy * dy + ds * ds + dk * dk);
+}
+
+}  // namespace
+
+std::vector<int> selectViews(const std::vector<StereoView>& views, cv::Size boardSize, cv::Size imageSize,
+                             const ViewSelectionOptions& options)
+{
+    const int n = (int)views.size();
+    const int limit = options.maxViews <= 0 ? n : std::min(options.maxViews, n);
+    std::vector<int> selected;
+    if (limit == n) {
+        for (int i = 0; i < n; i++) {
+            selected.push_back(i);
+        }
+        return selected;
+    }
+
+    std::vector<double> known;
+    for (int i = 0; i < n; i++) {
+        if (views[i].sharpness >= 0) {
+            known.push_back(views[i].sharpness);
+        }
+    }
+    double median = 0;
+    if (!known.empty()) {
+        std::nth_element(known.begin(), known.begin() + known.size() / 2, known.end());
+        median = known[known.size() / 2];
+    }
+
+    std::vector<BoardPose> pose(n);
+    std::vector<std::vector<int> > hit(n);
+    std::vector<double> sharp(n, 1.0);
+    for (int i = 0; i < n; i++) {
+        pose[i] = boardPose(*views[i].corners[0], boardSize, imageSize);
+        hit[i] = cells(views[i], options.grid, imageSize);
+        if (views[i].sharpness >= 0 && median > 0) {
+            sharp[i] = std::min(1.0, views[i].sharpness / median);
+        }
+    }
+
+    std::vector<int> count(2 * options.grid.area(), 0);
+    std::vector<double> nearest(n, 1.0);    // pose distance to the selection, capped
+    std::vector<bool> taken(n, false);
+    while ((int)selected.size() < limit) {
+        int best = -1;
+        bool bestBlurry = true;
+        double bestGain = 0;
+        for (int i = 0; i < n; i++) {
+            if (taken[i]) {
+                continue;
+            }
+            double area = 0;
+            for (size_t c = 0; c < hit[i].size(); c++) {
+                area += 1.0 / (1 + count[hit[i][c]]);
+            }
+            area /= std::max<size_t>(hit[i].size(), 1);
+            const double gain = sharp[i] * (area + nearest[i]);
+            const bool blurry = sharp[i] < options.minSharpness;
+            if (best < 0 || (bestBlurry && !blurry) || (blurry == bestBlurry && gain > bestGain)) {
+                best = i;
+                bestBlurry = blurry;
+                bestGain = gain;
+            }
+        }
+        taken[best] = true;
+        selected.push_back(best);
+        for (size_t c = 0; c < hit[best].size(); c++) {
+            count[hit[best][c]]++;
+        }
+        for (int i = 0; i < n; i++) {
+            nearest[i] = std::min(nearest[i], distance(pose[i], pose[best]));
+        }
+    }
+    return selected;
+}
+
+}  // namespace usb_camera
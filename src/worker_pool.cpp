@@ -0,0 +1,235 @@
+#include "usb_camera/worker_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "usb_camera/thread_util.h"
+
+namespace usb_camera {
+
+namespace {
+
+// set on pool workers, for parallel() from inside a task
+thread_local WorkerPool* t_pool = nullptr;
+thread_local int t_worker = -1;
+
+}  // namespace
+
+WorkerPool::WorkerPool(int threads, const std::vector<int>& cpus)
+    : m_cursor(0),
+      m_stopping(false)
+{
+    threads = std::max(threads, 1);
+    m_chunks.resize(threads);
+    for (int i = 0; i < threads; i++) {
+        const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        m_threads.push_back(std::thread(&WorkerPool::worker, this, i, cpu));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+int WorkerPool::addSource(const std::string& name, size_t capacity, QueuePolicy policy)
+{
+    std::unique_ptr<Source> s(new Source());
+    s->name = name;
+    s->ring.resize(std::max<size_t>(capacity, 1));
+    s->policy = policy;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sources.push_back(std::move(s));
+    return (int)m_sources.size() - 1;
+}
+
+bool WorkerPool::submit(int source, const Task& task)
+{
+    Task evicted;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Source& s = *m_sources[source];
+        if (s.policy == QueuePolicy::Block) {
+            m_changed.wait(lock, [&] { return m_stopping || s.size < s.ring.size(); });
+        }
+        if (m_stopping) {
+            return false;
+        }
+        if (s.size == s.ring.size()) {
+            evicted = std::move(s.ring[s.head]);
+            s.head = (s.head + 1) % s.ring.size();
+            s.size--;
+            s.dropped++;
+        }
+        s.ring[(s.head + s.size) % s.ring.size()] = task;
+        s.size++;
+    }
+    m_work.notify_one();
+    if (evicted.drop) {
+        evicted.drop();
+    }
+    return true;
+}
+
+void WorkerPool::drain(int source)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const Source& s = *m_sources[source];
+    m_changed.wait(lock, [&] { return s.size == 0 && !s.running; });
+}
+
+size_t WorkerPool::dropped(int source) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sources[source]->dropped;
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work.notify_all();
+    m_changed.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        if (m_threads[i].joinable()) {
+            m_threads[i].join();
+        }
+    }
+}
+
+WorkerPool* WorkerPool::current()
+{
+    return t_pool;
+}
+
+void WorkerPool::parallel(int begin, int end, const std::function<void(int, int)>& body, int stripes)
+{
+    const int n = end - begin;
+    if (n <= 0) {
+        return;
+    }
+    stripes = std::min(n, stripes > 0 ? stripes : threads());
+    if (t_pool != this || stripes == 1) {
+        body(begin, end);
+        return;
+    }
+    Job job;
+    job.body = &body;
+    job.pending = stripes;
+    std::deque<Chunk>& own = m_chunks[t_worker];
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (int i = 0; i < stripes; i++) {
+        Chunk c;
+        c.job = &job;
+        c.begin = begin + (int)((int64_t)n * i / stripes);
+        c.end = begin + (int)((int64_t)n * (i + 1) / stripes);
+        own.push_back(c);
+    }
+    m_work.notify_all();
+    while (job.pending > 0) {
+        // below our chunks may be those of an enclosing parallel(), they wait for it
+        if (!own.empty() && own.back().job == &job) {
+            const Chunk c = own.back();
+            own.pop_back();
+            lock.unlock();
+            body(c.begin, c.end);
+            lock.lock();
+            job.pending--;
+            continue;
+        }
+        // the rest is running on thieves
+        m_chunkDone.wait(lock);
+    }
+}
+
+bool WorkerPool::steal(int self, Chunk& chunk)
+{
+    const size_t n = m_chunks.size();
+    for (size_t k = 1; k <= n; k++) {
+        std::deque<Chunk>& d = m_chunks[(self + k) % n];
+        if (!d.empty()) {
+            chunk = d.front();
+            d.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkerPool::next(int& source, Task& task)
+{
+    const size_t n = m_sources.size();
+    for (size_t k = 0; k < n; k++) {
+        const size_t i = (m_cursor + k) % n;
+        Source& s = *m_sources[i];
+        if (s.size == 0 || s.running) {
+            continue;
+        }
+        task = std::move(s.ring[s.head]);
+        s.ring[s.head] = Task();
+        s.head = (s.head + 1) % s.ring.size();
+        s.size--;
+        s.running = true;
+        // the next pick starts after this source
+        m_cursor = (i + 1) % n;
+        source = (int)i;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::worker(int index, int cpu)
+{
+    setCurrentThreadName("m2_pool_" + std::to_string(index));
+    pinCurrentThread(cpu);
+    t_pool = this;
+    t_worker = index;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        // chunks of frames in flight before new frames
+        Chunk chunk;
+        if (steal(index, chunk)) {
+            lock.unlock();
+            (*chunk.job->body)(chunk.begin, chunk.end);
+            lock.lock();
+            if (--chunk.job->pending == 0) {
+                m_chunkDone.notify_all();
+            }
+            continue;
+        }
+        int source = -1;
+        Task task;
+        if (!next(source, task)) {
+            bool queued = false;
+            for (size_t i = 0; i < m_sources.size(); i++) {
+                queued = queued || m_sources[i]->size > 0;
+            }
+            // leave once stopped and nothing is left; tasks of running
+            // sources are picked up by the worker running them
+            if (m_stopping && !queued) {
+                return;
+            }
+            m_work.wait(lock);
+            continue;
+        }
+        m_changed.notify_all();     // room for a blocked submit()
+        lock.unlock();
+        task.run();
+        lock.lock();
+        Source& s = *m_sources[source];
+        s.running = false;
+        if (m_stopping) {
+            // idle workers re-check whether anything is left
+            m_work.notify_all();
+        } else if (s.size > 0) {
+            // its next task may be waiting for exactly this
+            m_work.notify_one();
+        }
+        m_changed.notify_all();
+    }
+}
+
+}  // namespace usb_camera
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <vector>
+
+#include "usb_camera/chessboard_detector.h"
+
+// The pyramid path of detectChessboard on rendered 1280x720 frames: it must
+// find what the full resolution search finds, at the same sub-pixel corners.
+
+namespace {
+
+const int kSquare = 50;
+const int kMargin = 50;
+
+// A board with boardSize inner corners under a perspective, and the true
+// corners in image pixels.
+cv::Mat renderBoard(cv::Size boardSize, std::vector<cv::Point2f>& truth)
+{
+    cv::Mat board((boardSize.height + 1) * kSquare + 2 * kMargin, (boardSize.width + 1) * kSquare + 2 * kMargin,
+                  CV_8U, cv::Scalar(255));
+    for (int y = 0; y <= boardSize.height; y++) {
+        for (int x = 0; x <= boardSize.width; x++) {
+            if ((x + y) % 2 == 0) {
+                board(cv::Rect(kMargin + x * kSquare, kMargin + y * kSquare, kSquare, kSquare)).setTo(0);
+            }
+        }
+    }
+    const cv::Point2f from[4] = { cv::Point2f(0, 0), cv::Point2f((float)board.cols, 0),
+                                  cv::Point2f((float)board.cols, (float)board.rows), cv::Point2f(0, (float)board.rows) };
+    const cv::Point2f to[4] = { cv::Point2f(300, 140), cv::Point2f(980, 110), cv::Point2f(1010, 610),
+                                cv::Point2f(270, 580) };
+    const cv::Mat H = cv::getPerspectiveTransform(from, to);
+    cv::Mat image;
+    cv::warpPerspective(board, image, H, cv::Size(1280, 720), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(255));
+    cv::GaussianBlur(image, image, cv::Size(3, 3), 0);
+
+    // square edges lie between pixels, half a pixel before the centers
+    std::vector<cv::Point2f> corners;
+    for (int y = 1; y <= boardSize.height; y++) {
+        for (int x = 1; x <= boardSize.width; x++) {
+            corners.push_back(cv::Point2f(kMargin + x * kSquare - 0.5f, kMargin + y * kSquare - 0.5f));
+        }
+    }
+    cv::perspectiveTransform(corners, truth, H);
+    return image;
+}
+
+}  // namespace
+
+TEST(ChessboardDetector, PyramidMatchesFullResolution)
+{
+    usb_camera::ChessboardOptions options;
+    std::vector<cv::Point2f> truth;
+    const cv::Mat image = renderBoard(options.boardSize, truth);
+
+    std::vector<cv::Point2f> full, pyramid;
+    options.pyramidLevels = 0;
+    ASSERT_TRUE(usb_camera::detectChessboard(image, options, full));
+    options.pyramidLevels = -1;
+    ASSERT_TRUE(usb_camera::detectChessboard(image, options, pyramid));
+
+    ASSERT_EQ(full.size(), truth.size());
+    ASSERT_EQ(pyramid.size(), full.size());
+    for (size_t i = 0; i < full.size(); i++) {
+        EXPECT_LE(cv::norm(pyramid[i] - full[i]), 0.25) << "corner " << i;
+        EXPECT_LE(cv::norm(full[i] - truth[i]), 0.5) << "corner " << i;
+    }
+}
+
+TEST(ChessboardDetector, RejectsFrameWithoutBoard)
+{
+    // a gradient with sensor noise
+    cv::Mat image(720, 1280, CV_8U);
+    for (int y = 0; y < image.rows; y++) {
+        uchar* row = image.ptr(y);
+        for (int x = 0; x < image.cols; x++) {
+            row[x] = (uchar)(40 + 160 * x / image.cols);
+        }
+    }
+    cv::Mat noise(image.size(), CV_8S);
+    cv::theRNG().state = 1;
+    cv::randn(noise, 0, 10);
+    cv::add(image, noise, image, cv::noArray(), CV_8U);
+
+    usb_camera::ChessboardOptions options;
+    options.pyramidLevels = -1;
+    std::vector<cv::Point2f> corners;
+    EXPECT_FALSE(usb_camera::detectChessboard(image, options, corners));
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+
+#include "usb_camera/clock_mapper.h"
+
+// ClockMapper fed with synthetic offset samples through addSample().
+
+namespace {
+
+const int64_t kSecond = 1000000000LL;
+
+// ROS time of monotonic `t`: a 5 s offset slewing at `ppm`.
+int64_t slewing(int64_t t, double ppm)
+{
+    return t + 5 * kSecond + (int64_t)std::llround(t * ppm * 1e-6);
+}
+
+}  // namespace
+
+TEST(ClockMapper, FitsSlewingOffset)
+{
+    usb_camera::ClockMapper mapper(30);
+    EXPECT_TRUE(mapper.empty());
+    const int64_t start = 1000 * kSecond;
+    for (int i = 0; i < 40; i++) {
+        const int64_t t = start + i * kSecond;
+        mapper.addSample(t, slewing(t, 50.0));
+    }
+    EXPECT_NEAR(mapper.driftPpm(), 50.0, 0.01);
+
+    // between samples and half a period past the newest one
+    for (int64_t t = start + 20 * kSecond; t < start + 40 * kSecond; t += kSecond / 3) {
+        EXPECT_NEAR((double)mapper.toRosNs(t), (double)slewing(t, 50.0), 1000.0);
+    }
+    EXPECT_EQ(mapper.toRos(start).toNSec(), (uint64_t)mapper.toRosNs(start));
+}
+
+TEST(ClockMapper, FollowsOnlyTheWindow)
+{
+    usb_camera::ClockMapper mapper(10);
+    const int64_t start = 1000 * kSecond;
+    for (int i = 0; i < 20; i++) {
+        const int64_t t = start + i * kSecond;
+        mapper.addSample(t, slewing(t, -20.0));
+    }
+    // the slew changed, the old samples fall out of the window
+    const int64_t base = slewing(start + 19 * kSecond, -20.0) - (start + 19 * kSecond);
+    for (int i = 20; i < 40; i++) {
+        const int64_t t = start + i * kSecond;
+        mapper.addSample(t, t + base + (int64_t)std::llround((i - 19) * kSecond * 80e-6));
+    }
+    EXPECT_NEAR(mapper.driftPpm(), 80.0, 0.01);
+}
+
+TEST(ClockMapper, ResetsOnJump)
+{
+    usb_camera::ClockMapper mapper(30);
+    const int64_t start = 1000 * kSecond;
+    for (int i = 0; i < 10; i++) {
+        const int64_t t = start + i * kSecond;
+        mapper.addSample(t, slewing(t, 100.0));
+    }
+    EXPECT_NEAR(mapper.driftPpm(), 100.0, 0.01);
+
+    // settimeofday: the ROS clock steps 2 s ahead
+    const int64_t t = start + 10 * kSecond;
+    mapper.addSample(t, slewing(t, 100.0) + 2 * kSecond);
+    // one sample left, no drift and exactly the new offset
+    EXPECT_EQ(mapper.driftPpm(), 0.0);
+    EXPECT_EQ(mapper.toRosNs(t), slewing(t, 100.0) + 2 * kSecond);
+    EXPECT_EQ(mapper.toRosNs(t + kSecond), slewing(t, 100.0) + 3 * kSecond);
+}
+
+TEST(ClockMapper, KeepsSamplesAcrossSmallSteps)
+{
+    usb_camera::ClockMapper mapper(30);
+    const int64_t start = 1000 * kSecond;
+    for (int i = 0; i < 10; i++) {
+        const int64_t t = start + i * kSecond;
+        mapper.addSample(t, slewing(t, 0.0));
+    }
+    // a 0.5 s step is below the reset threshold, it is averaged in
+    const int64_t t = start + 10 * kSecond;
+    mapper.addSample(t, slewing(t, 0.0) + kSecond / 2);
+    EXPECT_GT(mapper.driftPpm(), 0.0);
+    EXPECT_LT(mapper.toRosNs(t), slewing(t, 0.0) + kSecond / 2);
+}
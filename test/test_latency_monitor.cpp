@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+
+#include "usb_camera/latency_monitor.h"
+
+// Frame loss counting of LatencyMonitor from V4L2 sequence numbers.
+
+namespace {
+
+std::string value(const diagnostic_msgs::DiagnosticStatus& status, const std::string& key)
+{
+    for (size_t i = 0; i < status.values.size(); i++) {
+        if (status.values[i].key == key) {
+            return status.values[i].value;
+        }
+    }
+    return std::string();
+}
+
+std::string missed(usb_camera::LatencyMonitor& monitor, diagnostic_msgs::DiagnosticStatus& status)
+{
+    monitor.report(status, 1.0, 1.0);
+    return value(status, "frames missed (sequence)");
+}
+
+}  // namespace
+
+TEST(LatencyMonitor, CountsSequenceGaps)
+{
+    usb_camera::LatencyMonitor monitor;
+    diagnostic_msgs::DiagnosticStatus status;
+    // the first frame starts wherever the driver is
+    monitor.frameCaptured(100);
+    monitor.frameCaptured(101);
+    monitor.frameCaptured(102);
+    EXPECT_EQ(missed(monitor, status), "0");
+    EXPECT_EQ(status.level, diagnostic_msgs::DiagnosticStatus::OK);
+
+    monitor.frameCaptured(104);
+    monitor.frameCaptured(110);
+    EXPECT_EQ(missed(monitor, status), "6");
+    EXPECT_EQ(status.level, diagnostic_msgs::DiagnosticStatus::WARN);
+
+    // cumulative, but only reported as a warning while it grows
+    monitor.frameCaptured(111);
+    EXPECT_EQ(missed(monitor, status), "6");
+    EXPECT_EQ(status.level, diagnostic_msgs::DiagnosticStatus::OK);
+}
+
+TEST(LatencyMonitor, SequenceWrapsAround)
+{
+    usb_camera::LatencyMonitor monitor;
+    diagnostic_msgs::DiagnosticStatus status;
+    monitor.frameCaptured(0xfffffffeu);
+    monitor.frameCaptured(0xffffffffu);
+    monitor.frameCaptured(0);
+    monitor.frameCaptured(1);
+    EXPECT_EQ(missed(monitor, status), "0");
+
+    monitor.frameCaptured(0xffffffffu);
+    EXPECT_EQ(missed(monitor, status), "0");    // went back, a restart
+    monitor.frameCaptured(2);
+    EXPECT_EQ(missed(monitor, status), "2");    // 0 and 1 across the wrap
+}
+
+TEST(LatencyMonitor, IgnoresRestartedSequence)
+{
+    usb_camera::LatencyMonitor monitor;
+    diagnostic_msgs::DiagnosticStatus status;
+    monitor.frameCaptured(5000);
+    // the device was reopened and counts from 0 again
+    monitor.frameCaptured(0);
+    monitor.frameCaptured(1);
+    EXPECT_EQ(missed(monitor, status), "0");
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "usb_camera/stereo_matcher.h"
+
+// StereoMatcher driven by synthetic timestamp streams, the payload is the
+// frame's index in its stream.
+
+namespace {
+
+typedef usb_camera::StereoMatcher<int> Matcher;
+
+const int64_t kMs = 1000000;
+const int64_t kPeriod = 33 * kMs;
+
+// All pairs that are ready, as (left payload, right payload).
+std::vector<std::pair<int, int> > popAll(Matcher& matcher)
+{
+    std::vector<std::pair<int, int> > pairs;
+    Matcher::Frame l, r;
+    while (matcher.pop(l, r)) {
+        pairs.push_back(std::make_pair(l.payload, r.payload));
+    }
+    return pairs;
+}
+
+}  // namespace
+
+TEST(StereoMatcher, MatchesWithinTolerance)
+{
+    Matcher matcher(kPeriod / 2);
+    std::vector<std::pair<int, int> > pairs;
+    for (int i = 0; i < 20; i++) {
+        // the right camera runs 3 ms behind with some jitter
+        matcher.push(0, i * kPeriod, i);
+        matcher.push(1, i * kPeriod + 3 * kMs + (i % 3) * kMs, i);
+        std::vector<std::pair<int, int> > ready = popAll(matcher);
+        pairs.insert(pairs.end(), ready.begin(), ready.end());
+    }
+    ASSERT_EQ(pairs.size(), 20u);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        EXPECT_EQ(pairs[i].first, (int)i);
+        EXPECT_EQ(pairs[i].second, (int)i);
+    }
+    EXPECT_EQ(matcher.matched(), 20u);
+    EXPECT_EQ(matcher.dropped(0), 0u);
+    EXPECT_EQ(matcher.dropped(1), 0u);
+}
+
+TEST(StereoMatcher, DropsStaleFrames)
+{
+    Matcher matcher(5 * kMs);
+    std::vector<std::pair<int, int> > pairs;
+    for (int i = 0; i < 10; i++) {
+        matcher.push(0, i * kPeriod, i);
+        // the right camera misses frame 4
+        if (i != 4) {
+            matcher.push(1, i * kPeriod + kMs, i);
+        }
+        std::vector<std::pair<int, int> > ready = popAll(matcher);
+        pairs.insert(pairs.end(), ready.begin(), ready.end());
+    }
+    ASSERT_EQ(pairs.size(), 9u);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        // never paired with the wrong moment
+        EXPECT_EQ(pairs[i].first, pairs[i].second);
+        EXPECT_NE(pairs[i].first, 4);
+    }
+    EXPECT_EQ(matcher.dropped(0), 1u);
+    EXPECT_EQ(matcher.dropped(1), 0u);
+}
+
+TEST(StereoMatcher, DropsFramesOutOfTolerance)
+{
+    Matcher matcher(5 * kMs);
+    for (int i = 0; i < 10; i++) {
+        matcher.push(0, i * kPeriod, i);
+        matcher.push(1, i * kPeriod + 15 * kMs, i);
+        EXPECT_TRUE(popAll(matcher).empty());
+    }
+    EXPECT_EQ(matcher.matched(), 0u);
+    EXPECT_GT(matcher.dropped(0) + matcher.dropped(1), 0u);
+}
+
+TEST(StereoMatcher, PrefersTheCloserNextFrame)
+{
+    Matcher matcher(kPeriod / 2);
+    matcher.push(0, 0, 0);
+    matcher.push(0, 10 * kMs, 1);
+    matcher.push(1, 9 * kMs, 0);
+    std::vector<std::pair<int, int> > pairs = popAll(matcher);
+    ASSERT_EQ(pairs.size(), 1u);
+    EXPECT_EQ(pairs[0].first, 1);
+    EXPECT_EQ(pairs[0].second, 0);
+    EXPECT_EQ(matcher.dropped(0), 1u);
+}
+
+TEST(StereoMatcher, BoundsWaitingFrames)
+{
+    const size_t depth = 4;
+    Matcher matcher(5 * kMs, depth);
+    // the right camera stalls
+    for (int i = 0; i < 10; i++) {
+        matcher.push(0, i * kPeriod, i);
+        EXPECT_TRUE(popAll(matcher).empty());
+        EXPECT_LE(matcher.pending(0), depth);
+    }
+    EXPECT_EQ(matcher.pending(0), depth);
+    EXPECT_EQ(matcher.dropped(0), 10 - depth);
+
+    // it comes back, the newest waiting frame is still matched
+    matcher.push(1, 9 * kPeriod + kMs, 0);
+    std::vector<std::pair<int, int> > pairs = popAll(matcher);
+    ASSERT_EQ(pairs.size(), 1u);
+    EXPECT_EQ(pairs[0].first, 9);
+    EXPECT_EQ(matcher.pending(0), 0u);
+}
+
+TEST(StereoMatcher, ClockStepClearsTheQueue)
+{
+    Matcher matcher(5 * kMs);
+    matcher.push(0, 100 * kPeriod, 0);
+    matcher.push(0, 101 * kPeriod, 1);
+    matcher.push(0, kPeriod, 2);
+    EXPECT_EQ(matcher.pending(0), 1u);
+    EXPECT_EQ(matcher.dropped(0), 2u);
+    matcher.push(1, kPeriod, 0);
+    std::vector<std::pair<int, int> > pairs = popAll(matcher);
+    ASSERT_EQ(pairs.size(), 1u);
+    EXPECT_EQ(pairs[0].first, 2);
+}
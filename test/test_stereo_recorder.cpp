@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "usb_camera/capture_device.h"
+#include "usb_camera/stereo_recorder.h"
+
+// StereoRecorder -> StereoRecordReader round trips through a temporary file,
+// with and without the index.
+
+namespace {
+
+using usb_camera::StereoRecord;
+using usb_camera::StereoRecordReader;
+using usb_camera::StereoRecorder;
+using usb_camera::fourcc;
+
+const int kFrames = 20;
+
+std::string tempPath()
+{
+    char path[] = "/tmp/usb_camera_test_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+    return std::string(path) + ".m2rec";
+}
+
+// A stand-in bitstream of frame i, sizes vary so records straddle chunks.
+std::vector<uchar> bitstream(int i, int eye)
+{
+    std::vector<uchar> bytes(1500 + 397 * i + eye * 61);
+    for (size_t j = 0; j < bytes.size(); j++) {
+        bytes[j] = (uchar)(j * 31 + i * 7 + eye);
+    }
+    return bytes;
+}
+
+cv::Mat image(int i, int type)
+{
+    cv::Mat m(24, 32, type);
+    for (int y = 0; y < m.rows; y++) {
+        uchar* p = m.ptr(y);
+        for (size_t x = 0; x < m.cols * m.elemSize(); x++) {
+            p[x] = (uchar)(x + 3 * y + i);
+        }
+    }
+    return m;
+}
+
+bool sameBytes(const cv::Mat& a, const uchar* b, size_t size)
+{
+    return a.total() * a.elemSize() == size && a.isContinuous() && memcmp(a.ptr(), b, size) == 0;
+}
+
+// Three kinds of records in turn: a side-by-side MJPEG frame, an MJPEG pair
+// and a BGR / gray pair.
+void record(const std::string& path)
+{
+    usb_camera::RecorderOptions options;
+    options.chunkSize = 32 << 10;
+    options.chunks = 64;
+    StereoRecorder recorder;
+    ASSERT_TRUE(recorder.open(path, options));
+    for (int i = 0; i < kFrames; i++) {
+        const int64_t stamps[2] = { 1000 + i * 33, 1001 + i * 33 };
+        const std::vector<uchar> left = bitstream(i, 0);
+        const std::vector<uchar> right = bitstream(i, 1);
+        switch (i % 3) {
+        case 0:
+            ASSERT_TRUE(recorder.writeJpeg(stamps[0], left.data(), left.size(), 1280, 480));
+            break;
+        case 1:
+            ASSERT_TRUE(recorder.writeJpeg(stamps, cv::Mat(1, (int)left.size(), CV_8UC1, (void*)left.data()),
+                                           cv::Mat(1, (int)right.size(), CV_8UC1, (void*)right.data()),
+                                           cv::Size(640, 480)));
+            break;
+        default:
+            ASSERT_TRUE(recorder.write(stamps, image(i, CV_8UC3), image(i, CV_8UC1)));
+            break;
+        }
+    }
+    recorder.close();
+    EXPECT_EQ(recorder.recorded(), (size_t)kFrames);
+    EXPECT_EQ(recorder.dropped(), 0u);
+}
+
+void verify(const StereoRecordReader& reader)
+{
+    ASSERT_EQ(reader.size(), (size_t)kFrames);
+    for (int i = 0; i < kFrames; i++) {
+        StereoRecord r;
+        ASSERT_TRUE(reader.read(i, r)) << i;
+        EXPECT_EQ(r.sequence, (uint64_t)i);
+        EXPECT_EQ(reader.stamp(i), 1000 + i * 33);
+        const std::vector<uchar> left = bitstream(i, 0);
+        const std::vector<uchar> right = bitstream(i, 1);
+        switch (i % 3) {
+        case 0:
+            EXPECT_TRUE(r.sideBySide);
+            EXPECT_EQ(r.image[0].fourcc, fourcc('M', 'J', 'P', 'G'));
+            EXPECT_EQ(r.image[0].width, 1280);
+            EXPECT_TRUE(sameBytes(r.image[0].data, left.data(), left.size())) << i;
+            EXPECT_TRUE(r.image[1].data.empty());
+            break;
+        case 1:
+            EXPECT_FALSE(r.sideBySide);
+            EXPECT_EQ(r.stamp_ns[1], 1001 + i * 33);
+            EXPECT_EQ(r.image[1].fourcc, fourcc('M', 'J', 'P', 'G'));
+            EXPECT_EQ(r.image[1].width, 640);
+            EXPECT_TRUE(sameBytes(r.image[0].data, left.data(), left.size())) << i;
+            EXPECT_TRUE(sameBytes(r.image[1].data, right.data(), right.size())) << i;
+            break;
+        default: {
+            EXPECT_EQ(r.image[0].fourcc, fourcc('B', 'G', 'R', '3'));
+            EXPECT_EQ(r.image[1].fourcc, fourcc('G', 'R', 'E', 'Y'));
+            const cv::Mat bgr = image(i, CV_8UC3);
+            const cv::Mat gray = image(i, CV_8UC1);
+            EXPECT_EQ(r.image[0].data.type(), CV_8UC3);
+            EXPECT_TRUE(sameBytes(r.image[0].data, bgr.ptr(), bgr.total() * bgr.elemSize())) << i;
+            EXPECT_TRUE(sameBytes(r.image[1].data, gray.ptr(), gray.total() * gray.elemSize())) << i;
+            break;
+        }
+        }
+    }
+}
+
+}  // namespace
+
+TEST(StereoRecorder, RoundTrip)
+{
+    const std::string path = tempPath();
+    record(path);
+    StereoRecordReader reader;
+    ASSERT_TRUE(reader.open(path));
+    verify(reader);
+    reader.close();
+    remove(path.c_str());
+}
+
+TEST(StereoRecorder, ScansChunksWithoutIndex)
+{
+    const std::string path = tempPath();
+    record(path);
+    // cut the file where the index starts, as if the recording was interrupted
+    uint64_t indexOffset = 0;
+    {
+        std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+        const std::streamoff size = in.tellg();
+        // trailer: magic, index offset, count
+        in.seekg(size - 16);
+        in.read(reinterpret_cast<char*>(&indexOffset), sizeof(indexOffset));
+        ASSERT_TRUE(in.good());
+        ASSERT_GT(indexOffset, 0u);
+        ASSERT_LT((std::streamoff)indexOffset, size);
+    }
+    ASSERT_EQ(truncate(path.c_str(), (off_t)indexOffset), 0);
+
+    StereoRecordReader reader;
+    ASSERT_TRUE(reader.open(path));
+    verify(reader);
+    reader.close();
+    remove(path.c_str());
+}
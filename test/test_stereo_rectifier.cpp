@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "usb_camera/stereo_rectifier.h"
+
+// StereoRectifier against cv::remap(INTER_LINEAR, BORDER_CONSTANT) on the
+// same fixed-point maps. The output size isn't a multiple of the tile size,
+// and the maps reach a few pixels past every edge of the source, so partial
+// tiles and border pixels are covered. Whichever row kernel this CPU gets
+// (AVX2 or the SSE2/NEON/scalar one) is the one tested.
+
+namespace {
+
+using usb_camera::StereoRectifier;
+
+const cv::Size kSource(160, 120);
+const cv::Size kOutput(200, 100);
+
+// A smooth warp of the source per eye, as CV_16SC2 + CV_16UC1 maps.
+void makeMaps(cv::Mat map1[2], cv::Mat map2[2])
+{
+    for (int k = 0; k < 2; k++) {
+        cv::Mat mapx(kOutput, CV_32FC1), mapy(kOutput, CV_32FC1);
+        for (int y = 0; y < kOutput.height; y++) {
+            for (int x = 0; x < kOutput.width; x++) {
+                mapx.at<float>(y, x) = -6.0f + 3 * k + x * (kSource.width + 12.0f) / kOutput.width +
+                                       2.0f * std::sin(y * 0.05f);
+                mapy.at<float>(y, x) = -5.0f + y * (kSource.height + 10.0f) / kOutput.height +
+                                       1.5f * std::cos(x * 0.04f + k);
+            }
+        }
+        cv::convertMaps(mapx, mapy, map1[k], map2[k], CV_16SC2);
+    }
+}
+
+cv::Mat randomImage(cv::Size size, int type, uint64_t seed)
+{
+    cv::Mat m(size, type);
+    cv::RNG rng(seed);
+    rng.fill(m, cv::RNG::UNIFORM, 0, 256);
+    return m;
+}
+
+// Left and right of `rectifier` on a side-by-side frame of `type`, against
+// cv::remap, only `roi` of the output.
+void expectMatchesRemap(StereoRectifier& rectifier, const cv::Mat map1[2], const cv::Mat map2[2], int type,
+                        const cv::Rect& roi)
+{
+    const cv::Mat frame = randomImage(cv::Size(kSource.width * 2, kSource.height), type, 42 + type);
+    cv::Mat out[2];
+    rectifier.rectify(frame, out[0], out[1], roi);
+    const cv::Rect r = roi & cv::Rect(cv::Point(), kOutput);
+    for (int k = 0; k < 2; k++) {
+        cv::Mat expected;
+        cv::remap(frame(cv::Rect(k * kSource.width, 0, kSource.width, kSource.height)), expected, map1[k],
+                  map2[k], cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        ASSERT_EQ(out[k].type(), type);
+        ASSERT_EQ(out[k].size(), r.size());
+        EXPECT_LE(cv::norm(out[k], expected(r), cv::NORM_INF), 1.0) << "eye " << k;
+    }
+}
+
+class StereoRectifierTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        makeMaps(map1, map2);
+        rectifier.init(map1, map2);
+    }
+
+    cv::Mat map1[2];
+    cv::Mat map2[2];
+    StereoRectifier rectifier;
+};
+
+}  // namespace
+
+TEST_F(StereoRectifierTest, BgrMatchesRemap)
+{
+    expectMatchesRemap(rectifier, map1, map2, CV_8UC3, cv::Rect(cv::Point(), kOutput));
+}
+
+TEST_F(StereoRectifierTest, MonoMatchesRemap)
+{
+    expectMatchesRemap(rectifier, map1, map2, CV_8UC1, cv::Rect(cv::Point(), kOutput));
+}
+
+TEST_F(StereoRectifierTest, BorderPixelsAreBlendedWithZero)
+{
+    // the first and last columns and rows sample around the source's edges
+    const cv::Rect edges[] = { cv::Rect(0, 0, kOutput.width, 3), cv::Rect(0, kOutput.height - 3, kOutput.width, 3),
+                               cv::Rect(0, 0, 9, kOutput.height), cv::Rect(kOutput.width - 9, 0, 9, kOutput.height) };
+    for (const cv::Rect& r : edges) {
+        expectMatchesRemap(rectifier, map1, map2, CV_8UC3, r);
+        expectMatchesRemap(rectifier, map1, map2, CV_8UC1, r);
+    }
+}
+
+TEST_F(StereoRectifierTest, SubRoiMatchesRemap)
+{
+    // not aligned to tiles, and one clipped at the bottom-right corner
+    expectMatchesRemap(rectifier, map1, map2, CV_8UC3, cv::Rect(37, 21, 101, 45));
+    expectMatchesRemap(rectifier, map1, map2, CV_8UC1, cv::Rect(37, 21, 101, 45));
+    expectMatchesRemap(rectifier, map1, map2, CV_8UC3, cv::Rect(150, 90, 100, 40));
+}
+
+TEST_F(StereoRectifierTest, AlternatingLayouts)
+{
+    // bgr8 and mono8 frames in turn keep both packed layouts
+    for (int i = 0; i < 3; i++) {
+        expectMatchesRemap(rectifier, map1, map2, CV_8UC3, cv::Rect(cv::Point(), kOutput));
+        expectMatchesRemap(rectifier, map1, map2, CV_8UC1, cv::Rect(cv::Point(), kOutput));
+    }
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#include "usb_camera/worker_pool.h"
+
+// WorkerPool::parallel() from inside pool tasks, as parallelFor() uses it.
+
+namespace {
+
+using usb_camera::QueuePolicy;
+using usb_camera::WorkerPool;
+
+// Submit `run` to a fresh source of `pool` and wait for it.
+void runTask(WorkerPool& pool, const std::function<void()>& run)
+{
+    const int source = pool.addSource("test", 1, QueuePolicy::Block);
+    WorkerPool::Task task;
+    task.run = run;
+    ASSERT_TRUE(pool.submit(source, task));
+    pool.drain(source);
+}
+
+}  // namespace
+
+TEST(WorkerPool, ParallelCoversRangeOnce)
+{
+    WorkerPool pool(4);
+    std::vector<std::atomic<int> > hits(1000);
+    bool inside = false;
+    runTask(pool, [&] {
+        inside = WorkerPool::current() == &pool;
+        pool.parallel(0, (int)hits.size(), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                hits[i]++;
+            }
+        }, 7);
+    });
+    EXPECT_TRUE(inside);
+    for (size_t i = 0; i < hits.size(); i++) {
+        ASSERT_EQ(hits[i], 1) << i;
+    }
+}
+
+TEST(WorkerPool, ParallelNests)
+{
+    WorkerPool pool(3);
+    std::atomic<int> sum(0);
+    runTask(pool, [&] {
+        pool.parallel(0, 8, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                pool.parallel(0, 100, [&](int b, int e) { sum += e - b; }, 4);
+            }
+        }, 8);
+    });
+    EXPECT_EQ(sum, 800);
+}
+
+TEST(WorkerPool, ParallelOutsideTaskRunsOnCaller)
+{
+    WorkerPool pool(2);
+    EXPECT_EQ(WorkerPool::current(), nullptr);
+    int calls = 0;
+    int covered = 0;
+    pool.parallel(5, 25, [&](int begin, int end) {
+        calls++;
+        covered += end - begin;
+    }, 4);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(covered, 20);
+}
+
+TEST(WorkerPool, SourcesKeepRunningAroundParallel)
+{
+    WorkerPool pool(2);
+    const int a = pool.addSource("a", 4, QueuePolicy::Block);
+    const int b = pool.addSource("b", 4, QueuePolicy::Block);
+    std::atomic<int> chunks(0);
+    std::atomic<int> tasks(0);
+    for (int i = 0; i < 8; i++) {
+        WorkerPool::Task task;
+        task.run = [&] {
+            pool.parallel(0, 16, [&](int begin, int end) { chunks += end - begin; }, 4);
+            tasks++;
+        };
+        ASSERT_TRUE(pool.submit(i % 2 ? a : b, task));
+    }
+    pool.drain(a);
+    pool.drain(b);
+    EXPECT_EQ(tasks, 8);
+    EXPECT_EQ(chunks, 8 * 16);
+}